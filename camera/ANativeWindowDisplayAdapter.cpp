@@ -135,6 +135,18 @@ const size_t getBufSize(const char* parameters_format, int width, int height)
 
     return buf_size;
 }
+static inline unsigned int hashHandle(const void *handle, unsigned int mask)
+{
+    // Gralloc handles are heap pointers, fold the high bits into the
+    // low ones before masking
+    uint32_t key = (uint32_t) handle;
+    key ^= key >> 16;
+    key *= 0x45d9f3b;
+    key ^= key >> 16;
+
+    return key & mask;
+}
+
 /*--------------------ANativeWindowDisplayAdapter Class STARTS here-----------------------------*/
 
 
@@ -144,20 +156,16 @@ const size_t getBufSize(const char* parameters_format, int width, int height)
 ANativeWindowDisplayAdapter::ANativeWindowDisplayAdapter():mDisplayThread(NULL),
                                         mDisplayState(ANativeWindowDisplayAdapter::DISPLAY_INIT),
                                         mDisplayEnabled(false),
-                                        mBufferCount(0)
+                                        mBufferCount(0),
+                                        mDisplayFps("display")
 
 
 
 {
     LOG_FUNCTION_NAME;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
+#if CAMHAL_TRACE
     mShotToShot = false;
-    mStartCapture.tv_sec = 0;
-    mStartCapture.tv_usec = 0;
-    mStandbyToShot.tv_sec = 0;
-    mStandbyToShot.tv_usec = 0;
     mMeasureStandby = false;
 #endif
 
@@ -165,6 +173,11 @@ ANativeWindowDisplayAdapter::ANativeWindowDisplayAdapter():mDisplayThread(NULL),
     mBufferHandleMap = NULL;
     mGrallocHandleMap = NULL;
     mOffsetsMap = NULL;
+    mFramesWithCameraAdapter = NULL;
+    mHandleSlotTable = NULL;
+    mHandleSlotMask = 0;
+    mGrallocLocked = NULL;
+    mCpuAccess = false;
     mFrameProvider = NULL;
     mANativeWindow = NULL;
 
@@ -303,7 +316,7 @@ int ANativeWindowDisplayAdapter::setFrameProvider(FrameNotifier *frameProvider)
     /** Dont do anything here, Just save the pointer for use when display is
          actually enabled or disabled
     */
-    mFrameProvider = new FrameProvider(frameProvider, this, frameCallbackRelay);
+    mFrameProvider = new FrameProvider(frameProvider, this, frameCallbackRelay, CameraFrameStats::CONSUMER_DISPLAY);
 
     LOG_FUNCTION_NAME_EXIT;
 
@@ -332,29 +345,12 @@ int ANativeWindowDisplayAdapter::setErrorHandler(ErrorNotifier *errorNotifier)
     return ret;
 }
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-status_t ANativeWindowDisplayAdapter::setSnapshotTimeRef(struct timeval *refTime)
+status_t ANativeWindowDisplayAdapter::dump(int fd)
 {
-    status_t ret = NO_ERROR;
-
-    LOG_FUNCTION_NAME;
-
-    if ( NULL != refTime )
-        {
-        Mutex::Autolock lock(mLock);
-        memcpy(&mStartCapture, refTime, sizeof(struct timeval));
-    }
-
-    LOG_FUNCTION_NAME_EXIT;
-
-    return ret;
+    return mDisplayFps.dump(fd);
 }
 
-#endif
-
-
-int ANativeWindowDisplayAdapter::enableDisplay(int width, int height, struct timeval *refTime, S3DParameters *s3dParams)
+int ANativeWindowDisplayAdapter::enableDisplay(int width, int height, S3DParameters *s3dParams)
 {
     Semaphore sem;
     TIUTILS::Message msg;
@@ -369,18 +365,18 @@ int ANativeWindowDisplayAdapter::enableDisplay(int width, int height, struct tim
         return NO_ERROR;
     }
 
+    mDisplayFps.reset();
+
 #if 0 //TODO: s3d is not part of bringup...will reenable
     if (s3dParams)
         mOverlay->set_s3d_params(s3dParams->mode, s3dParams->framePacking,
                                     s3dParams->order, s3dParams->subSampling);
 #endif
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
+#if CAMHAL_TRACE
 
-    if ( NULL != refTime )
-        {
+    {
         Mutex::Autolock lock(mLock);
-        memcpy(&mStandbyToShot, refTime, sizeof(struct timeval));
         mMeasureStandby = true;
     }
 
@@ -427,6 +423,8 @@ int ANativeWindowDisplayAdapter::disableDisplay(bool cancel_buffer)
         return ALREADY_EXISTS;
     }
 
+    mDisplayFps.log();
+
     // Unregister with the frame provider here
     mFrameProvider->disableFrameNotification(CameraFrame::PREVIEW_FRAME_SYNC);
     mFrameProvider->removeFramePointers();
@@ -469,14 +467,17 @@ int ANativeWindowDisplayAdapter::disableDisplay(bool cancel_buffer)
 
        if(cancel_buffer)
         {
-        // Return the buffers to ANativeWindow here, the mFramesWithCameraAdapterMap is also cleared inside
+        // Return the buffers to ANativeWindow here, the mFramesWithCameraAdapter flags are also cleared inside
         returnBuffersToWindow();
         }
        else
         {
         mANativeWindow = NULL;
-        // Clear the frames with camera adapter map
-        mFramesWithCameraAdapterMap.clear();
+        // Clear the frames with camera adapter flags
+        if ( NULL != mFramesWithCameraAdapter )
+            {
+            memset(mFramesWithCameraAdapter, 0, sizeof(bool) * mBufferCount);
+            }
         }
 
 
@@ -528,6 +529,10 @@ void* ANativeWindowDisplayAdapter::allocateBuffer(int width, int height, const c
     const int lnumBufs = numBufs;
     mBufferHandleMap = new buffer_handle_t*[lnumBufs];
     mGrallocHandleMap = new IMG_native_handle_t*[lnumBufs];
+    mFramesWithCameraAdapter = new bool[lnumBufs];
+    memset(mFramesWithCameraAdapter, 0, sizeof(bool) * lnumBufs);
+    mGrallocLocked = new bool[lnumBufs];
+    memset(mGrallocLocked, 0, sizeof(bool) * lnumBufs);
     int undequeued = 0;
     GraphicBufferMapper &mapper = GraphicBufferMapper::get();
     Rect bounds;
@@ -621,12 +626,18 @@ void* ANativeWindowDisplayAdapter::allocateBuffer(int width, int height, const c
 
         mBufferHandleMap[i] = (buffer_handle_t*) hndl2hndl;
         mGrallocHandleMap[i] = handle;
-        mFramesWithCameraAdapterMap.add((int) mGrallocHandleMap[i], i);
+        mFramesWithCameraAdapter[i] = true;
 
         bytes =  getBufSize(format, width, height);
 
     }
 
+    if ( NO_ERROR != initHandleSlotTable() )
+    {
+        CAMHAL_LOGEA("Couldn't create handle lookup table for ANativeWindow buffers");
+        goto fail;
+    }
+
     // lock the initial queueable buffers
     bounds.left = 0;
     bounds.top = 0;
@@ -641,6 +652,14 @@ void* ANativeWindowDisplayAdapter::allocateBuffer(int width, int height, const c
 
         mapper.lock((buffer_handle_t) mGrallocHandleMap[i], CAMHAL_GRALLOC_USAGE, bounds, y_uv);
         mFrameProvider->addFramePointers(mGrallocHandleMap[i] , y_uv);
+
+        // The mapping obtained above stays valid for the lifetime of the
+        // buffer set, keep the buffer locked only if the CPU reads it
+        if ( mCpuAccess ) {
+            mGrallocLocked[i] = true;
+        } else {
+            mapper.unlock((buffer_handle_t) mGrallocHandleMap[i]);
+        }
     }
 
     // return the rest of the buffers back to ANativeWindow
@@ -657,7 +676,7 @@ void* ANativeWindowDisplayAdapter::allocateBuffer(int width, int height, const c
 
             goto fail;
         }
-        mFramesWithCameraAdapterMap.removeItem((int) mGrallocHandleMap[i]);
+        mFramesWithCameraAdapter[i] = false;
         //LOCK UNLOCK TO GET YUV POINTERS
         void *y_uv[2];
         mapper.lock((buffer_handle_t) mGrallocHandleMap[i], CAMHAL_GRALLOC_USAGE, bounds, y_uv);
@@ -680,7 +699,7 @@ void* ANativeWindowDisplayAdapter::allocateBuffer(int width, int height, const c
           CAMHAL_LOGEB("cancelBuffer failed w/ error 0x%08x", err);
           break;
         }
-        mFramesWithCameraAdapterMap.removeItem((int) mGrallocHandleMap[start]);
+        mFramesWithCameraAdapter[start] = false;
     }
 
     freeBuffer(mGrallocHandleMap);
@@ -808,14 +827,15 @@ status_t ANativeWindowDisplayAdapter::returnBuffersToWindow()
 {
     status_t ret = NO_ERROR;
 
-     GraphicBufferMapper &mapper = GraphicBufferMapper::get();
     //Give the buffers back to display here -  sort of free it
-     if (mANativeWindow)
-         for(unsigned int i = 0; i < mFramesWithCameraAdapterMap.size(); i++) {
-             int value = mFramesWithCameraAdapterMap.valueAt(i);
+     if ( mANativeWindow && ( NULL != mFramesWithCameraAdapter ) )
+         for(int value = 0; value < mBufferCount; value++) {
+             if ( !mFramesWithCameraAdapter[value] ) {
+                 continue;
+             }
 
              // unlock buffer before giving it up
-             mapper.unlock((buffer_handle_t) mGrallocHandleMap[value]);
+             unlockBuffer(value);
 
              ret = mANativeWindow->cancel_buffer(mANativeWindow, mBufferHandleMap[value]);
              if ( ENODEV == ret ) {
@@ -832,8 +852,10 @@ status_t ANativeWindowDisplayAdapter::returnBuffersToWindow()
      else
          ALOGE("mANativeWindow is NULL");
 
-     ///Clear the frames with camera adapter map
-     mFramesWithCameraAdapterMap.clear();
+     ///Clear the frames with camera adapter flags
+     if ( NULL != mFramesWithCameraAdapter ) {
+         memset(mFramesWithCameraAdapter, 0, sizeof(bool) * mBufferCount);
+     }
 
      return ret;
 
@@ -877,6 +899,20 @@ int ANativeWindowDisplayAdapter::freeBuffer(void* buf)
         mOffsetsMap = NULL;
     }
 
+    if ( NULL != mFramesWithCameraAdapter )
+    {
+        delete [] mFramesWithCameraAdapter;
+        mFramesWithCameraAdapter = NULL;
+    }
+
+    if ( NULL != mGrallocLocked )
+    {
+        delete [] mGrallocLocked;
+        mGrallocLocked = NULL;
+    }
+
+    clearHandleSlotTable();
+
     if( mFD != -1)
     {
         close(mFD);  // close duped handle
@@ -1031,7 +1067,6 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
     status_t ret = NO_ERROR;
     uint32_t actualFramesWithDisplay = 0;
     android_native_buffer_t *buffer = NULL;
-    GraphicBufferMapper &mapper = GraphicBufferMapper::get();
     int i;
 
     ///@todo Do cropping based on the stabilized frame coordinates
@@ -1044,12 +1079,10 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
         return -EINVAL;
     }
 
-    for ( i = 0; i < mBufferCount; i++ )
-        {
-        if ( ((int) dispFrame.mBuffer ) == (int)mGrallocHandleMap[i] )
-            {
-            break;
-        }
+    i = getSlotForHandle(dispFrame.mBuffer);
+    if ( 0 > i ) {
+        CAMHAL_LOGEB("Unknown buffer 0x%x sent to PostFrame", (unsigned int) dispFrame.mBuffer);
+        return -EINVAL;
     }
 
     if ( mDisplayState == ANativeWindowDisplayAdapter::DISPLAY_STARTED &&
@@ -1096,13 +1129,15 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
         }
 
         // unlock buffer before sending to display
-        mapper.unlock((buffer_handle_t) mGrallocHandleMap[i]);
+        unlockBuffer(i);
         ret = mANativeWindow->enqueue_buffer(mANativeWindow, mBufferHandleMap[i]);
         if (ret != 0) {
             ALOGE("Surface::queueBuffer returned error %d", ret);
+        } else {
+            mDisplayFps.frame(systemTime(SYSTEM_TIME_MONOTONIC));
         }
 
-        mFramesWithCameraAdapterMap.removeItem((int) dispFrame.mBuffer);
+        mFramesWithCameraAdapter[i] = false;
 
 
         // HWComposer has not minimum buffer requirement. We should be able to dequeue
@@ -1111,21 +1146,21 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
         mDisplayQ.put(&msg);
 
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
+#if CAMHAL_TRACE
 
         if ( mMeasureStandby )
             {
-            CameraHal::PPM("Standby to first shot: Sensor Change completed - ", &mStandbyToShot);
+            CAMHAL_TRACE_EVENT(PREVIEW_FIRST_FRAME, dispFrame.mFrameId, i, 0);
             mMeasureStandby = false;
             }
         else if (CameraFrame::CameraFrame::SNAPSHOT_FRAME == dispFrame.mType)
             {
-            CameraHal::PPM("Shot to snapshot: ", &mStartCapture);
+            CAMHAL_TRACE_EVENT(CAPTURE_SNAPSHOT, dispFrame.mFrameId, i, 0);
             mShotToShot = true;
             }
         else if ( mShotToShot )
             {
-            CameraHal::PPM("Shot to shot: ", &mStartCapture);
+            CAMHAL_TRACE_EVENT(CAPTURE_PREVIEW_RESUMED, dispFrame.mFrameId, i, 0);
             mShotToShot = false;
         }
 #endif
@@ -1136,7 +1171,7 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
         Mutex::Autolock lock(mLock);
 
         // unlock buffer before giving it up
-        mapper.unlock((buffer_handle_t) mGrallocHandleMap[i]);
+        unlockBuffer(i);
 
         // cancel buffer and dequeue another one
         ret = mANativeWindow->cancel_buffer(mANativeWindow, mBufferHandleMap[i]);
@@ -1144,7 +1179,7 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
             ALOGE("Surface::queueBuffer returned error %d", ret);
         }
 
-        mFramesWithCameraAdapterMap.removeItem((int) dispFrame.mBuffer);
+        mFramesWithCameraAdapter[i] = false;
 
         TIUTILS::Message msg;
         mDisplayQ.put(&msg);
@@ -1161,9 +1196,7 @@ bool ANativeWindowDisplayAdapter::handleFrameReturn()
     buffer_handle_t* buf;
     int i = 0;
     int stride;  // dummy variable to get stride
-    GraphicBufferMapper &mapper = GraphicBufferMapper::get();
-    Rect bounds;
-    void *y_uv[2];
+    bool cpuAccess;
 
     // TODO(XXX): Do we need to keep stride information in camera hal?
 
@@ -1171,6 +1204,13 @@ bool ANativeWindowDisplayAdapter::handleFrameReturn()
         return false;
     }
 
+    // setCpuAccess() may change it meanwhile, the whole frame
+    // is handled with the value seen here
+    {
+        Mutex::Autolock lock(mLock);
+        cpuAccess = mCpuAccess;
+    }
+
     err = mANativeWindow->dequeue_buffer(mANativeWindow, &buf, &stride);
     if (err != 0) {
         CAMHAL_LOGEB("dequeueBuffer failed: %s (%d)", strerror(-err), -err);
@@ -1195,35 +1235,146 @@ bool ANativeWindowDisplayAdapter::handleFrameReturn()
         return false;
     }
 
-    for(i = 0; i < mBufferCount; i++)
-    {
-        if (mBufferHandleMap[i] == buf)
-            break;
+    i = getSlotForHandle(*buf);
+    if ( 0 > i ) {
+        CAMHAL_LOGEA("Dequeued buffer doesn't belong to the camera buffer set");
+        return false;
+    }
+
+    // lock buffer before sending to FrameProvider for filling, this is
+    // needed only when some CPU consumer reads the preview frames
+    if ( cpuAccess && ( NO_ERROR != lockBuffer(i) ) ) {
+        return false;
+    }
+
+    mFramesWithCameraAdapter[i] = true;
+
+    CAMHAL_LOGVB("handleFrameReturn: found graphic buffer %d of %d", i, mBufferCount-1);
+    mFrameProvider->returnFrame( (void*)mGrallocHandleMap[i], CameraFrame::PREVIEW_FRAME_SYNC);
+    return true;
+}
+
+int ANativeWindowDisplayAdapter::setCpuAccess(bool enable)
+{
+    LOG_FUNCTION_NAME;
+
+    Mutex::Autolock lock(mLock);
+
+    // Buffers currently owned by the camera keep their lock state,
+    // new state applies from the next dequeued buffer on
+    if ( mCpuAccess != enable ) {
+        CAMHAL_LOGDB("Preview buffer CPU access %s", enable ? "enabled" : "disabled");
+        mCpuAccess = enable;
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+status_t ANativeWindowDisplayAdapter::lockBuffer(int slot)
+{
+    GraphicBufferMapper &mapper = GraphicBufferMapper::get();
+    Rect bounds;
+    void *y_uv[2];
+    int lock_try_count = 0;
+
+    if ( mGrallocLocked[slot] ) {
+        return NO_ERROR;
     }
 
-    // lock buffer before sending to FrameProvider for filling
     bounds.left = 0;
     bounds.top = 0;
     bounds.right = mFrameWidth;
     bounds.bottom = mFrameHeight;
 
-    int lock_try_count = 0;
-    while (mapper.lock((buffer_handle_t) mGrallocHandleMap[i], CAMHAL_GRALLOC_USAGE, bounds, y_uv) < 0){
+    while (mapper.lock((buffer_handle_t) mGrallocHandleMap[slot], CAMHAL_GRALLOC_USAGE, bounds, y_uv) < 0){
       if (++lock_try_count > LOCK_BUFFER_TRIES){
         if ( NULL != mErrorNotifier.get() ){
           mErrorNotifier->errorNotify(CAMERA_ERROR_UNKNOWN);
         }
-        return false;
+        return UNKNOWN_ERROR;
       }
       CAMHAL_LOGEA("Gralloc Lock FrameReturn Error: Sleeping 15ms");
       usleep(15000);
     }
 
-    mFramesWithCameraAdapterMap.add((int) mGrallocHandleMap[i], i);
+    mGrallocLocked[slot] = true;
 
-    CAMHAL_LOGVB("handleFrameReturn: found graphic buffer %d of %d", i, mBufferCount-1);
-    mFrameProvider->returnFrame( (void*)mGrallocHandleMap[i], CameraFrame::PREVIEW_FRAME_SYNC);
-    return true;
+    return NO_ERROR;
+}
+
+void ANativeWindowDisplayAdapter::unlockBuffer(int slot)
+{
+    GraphicBufferMapper &mapper = GraphicBufferMapper::get();
+
+    if ( ( NULL != mGrallocLocked ) && mGrallocLocked[slot] ) {
+        mapper.unlock((buffer_handle_t) mGrallocHandleMap[slot]);
+        mGrallocLocked[slot] = false;
+    }
+}
+
+status_t ANativeWindowDisplayAdapter::initHandleSlotTable()
+{
+    unsigned int tableSize = 1;
+
+    LOG_FUNCTION_NAME;
+
+    clearHandleSlotTable();
+
+    ///Keep the load factor at or below 0.5, so probe sequences stay short
+    while ( tableSize < ( unsigned int ) ( mBufferCount * 2 ) ) {
+        tableSize <<= 1;
+    }
+
+    mHandleSlotTable = new int[tableSize];
+    if ( NULL == mHandleSlotTable ) {
+        LOG_FUNCTION_NAME_EXIT;
+        return NO_MEMORY;
+    }
+
+    memset(mHandleSlotTable, 0xff, sizeof(int) * tableSize);
+    mHandleSlotMask = tableSize - 1;
+
+    for ( int slot = 0; slot < mBufferCount; slot++ ) {
+        unsigned int idx = hashHandle(mGrallocHandleMap[slot], mHandleSlotMask);
+        while ( -1 != mHandleSlotTable[idx] ) {
+            idx = ( idx + 1 ) & mHandleSlotMask;
+        }
+        mHandleSlotTable[idx] = slot;
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+void ANativeWindowDisplayAdapter::clearHandleSlotTable()
+{
+    if ( NULL != mHandleSlotTable ) {
+        delete [] mHandleSlotTable;
+        mHandleSlotTable = NULL;
+    }
+
+    mHandleSlotMask = 0;
+}
+
+int ANativeWindowDisplayAdapter::getSlotForHandle(const void *handle) const
+{
+    if ( ( NULL == mHandleSlotTable ) || ( NULL == mGrallocHandleMap ) ) {
+        return -1;
+    }
+
+    unsigned int idx = hashHandle(handle, mHandleSlotMask);
+    while ( -1 != mHandleSlotTable[idx] ) {
+        int slot = mHandleSlotTable[idx];
+        if ( handle == mGrallocHandleMap[slot] ) {
+            return slot;
+        }
+        idx = ( idx + 1 ) & mHandleSlotMask;
+    }
+
+    return -1;
 }
 
 void ANativeWindowDisplayAdapter::frameCallbackRelay(CameraFrame* caFrame)
@@ -1259,7 +1410,10 @@ void ANativeWindowDisplayAdapter::frameCallback(CameraFrame* caFrame)
     df.mLength = caFrame->mLength;
     df.mWidth = caFrame->mWidth;
     df.mHeight = caFrame->mHeight;
+    df.mFrameId = caFrame->mFrameId;
     PostFrame(df);
+
+    CameraFrameStats::frameReached(caFrame, CameraFrame::STAGE_DISPLAYED);
 }
 
 
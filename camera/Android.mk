@@ -14,13 +14,17 @@ OMAP4_CAMERA_HAL_SRC := \
 	CameraProperties.cpp \
 	MemoryManager.cpp \
 	Encoder_libjpeg.cpp \
+	ExposureFusion.cpp \
+	FrameMerge.cpp \
+	TemporalDenoise.cpp \
 	SensorListener.cpp  \
 	NV12_resize.c
 
 OMAP4_CAMERA_COMMON_SRC:= \
 	CameraParameters.cpp \
 	TICameraParameters.cpp \
-	CameraHalCommon.cpp
+	CameraHalCommon.cpp \
+	CameraTrace.cpp
 
 OMAP4_CAMERA_OMX_SRC:= \
 	BaseCameraAdapter.cpp \
@@ -65,8 +69,7 @@ LOCAL_C_INCLUDES += \
     frameworks/base/include/media/stagefright \
     frameworks/native/include/media/hardware \
     frameworks/native/include/media/openmax \
-    external/jpeg \
-    external/jhead
+    external/jpeg
 
 LOCAL_SHARED_LIBRARIES:= \
     libui \
@@ -81,8 +84,7 @@ LOCAL_SHARED_LIBRARIES:= \
     libgui \
     libdomx \
     libion_ti \
-    libjpeg \
-    libexif
+    libjpeg
 
 LOCAL_CFLAGS := -fno-short-enums -DCOPY_IMAGE_BUFFER
 
@@ -23,6 +23,9 @@
 #include "CameraHal.h"
 #include "VideoMetadata.h"
 #include "Encoder_libjpeg.h"
+#include "ExposureFusion.h"
+#include "FrameMerge.h"
+#include "TemporalDenoise.h"
 #include <MetadataBufferType.h>
 #include <ui/GraphicBuffer.h>
 #include <ui/GraphicBufferMapper.h>
@@ -33,6 +36,39 @@ namespace android {
 const int AppCallbackNotifier::NOTIFIER_TIMEOUT = -1;
 KeyedVector<void*, sp<Encoder_libjpeg> > gEncoderQueue;
 
+//Encoders waiting for one of the running ones to finish. A waiting
+//encoder keeps its capture buffer, so a burst is throttled on the
+//capture port only once the encoders can't keep up
+static Vector< sp<Encoder_libjpeg> > gPendingEncoders;
+static int gEncodersRunning = 0;
+static Mutex gEncoderLock;
+
+static void AppCallbackNotifierDispatchEncoder(const sp<Encoder_libjpeg> &encoder)
+{
+    Mutex::Autolock lock(gEncoderLock);
+
+    if ( gEncodersRunning < AppCallbackNotifier::MAX_ENCODERS ) {
+        gEncodersRunning++;
+        encoder->run();
+    } else {
+        gPendingEncoders.add(encoder);
+    }
+}
+
+static void AppCallbackNotifierEncoderFinished()
+{
+    Mutex::Autolock lock(gEncoderLock);
+
+    //The finishing encoder's slot goes straight to the oldest waiting one
+    if ( !gPendingEncoders.isEmpty() ) {
+        sp<Encoder_libjpeg> next = gPendingEncoders[0];
+        gPendingEncoders.removeAt(0);
+        next->run();
+    } else if ( 0 < gEncodersRunning ) {
+        gEncodersRunning--;
+    }
+}
+
 void AppCallbackNotifierEncoderCallback(void* main_jpeg,
                                         void* thumb_jpeg,
                                         CameraFrame::FrameType type,
@@ -56,6 +92,8 @@ void AppCallbackNotifierEncoderCallback(void* main_jpeg,
        }
        free(thumb_jpeg);
     }
+
+    AppCallbackNotifierEncoderFinished();
 }
 
 /*--------------------NotificationHandler Class STARTS here-----------------------------*/
@@ -87,9 +125,8 @@ void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, Camer
     if(encoded_mem && encoded_mem->data && (jpeg_size > 0)) {
         if (cookie2) {
             ExifElementsTable* exif = (ExifElementsTable*) cookie2;
-            Section_t* exif_section = NULL;
-
-            exif->insertExifToJpeg((unsigned char*) encoded_mem->data, jpeg_size);
+            unsigned char* jpeg = (unsigned char*) main_param->dst;
+            size_t exif_size = 0;
 
             if(thumb_jpeg) {
                 thumb_param = (Encoder_libjpeg::params *) thumb_jpeg;
@@ -97,13 +134,14 @@ void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, Camer
                                                (int)thumb_param->jpeg_size);
             }
 
-            exif_section = FindSection(M_EXIF);
+            // EXIF goes into the room left ahead of the encoded data,
+            // so the finished image is copied out only once
+            exif_size = exif->insertExifToJpeg(jpeg, jpeg_size,
+                                               jpeg - (unsigned char*) encoded_mem->data);
 
-            if (exif_section) {
-                picture = mRequestMemory(-1, jpeg_size + exif_section->Size, 1, NULL);
-                if (picture && picture->data) {
-                    exif->saveJpeg((unsigned char*) picture->data, jpeg_size + exif_section->Size);
-                }
+            picture = mRequestMemory(-1, jpeg_size + exif_size, 1, NULL);
+            if (picture && picture->data) {
+                memcpy(picture->data, jpeg - exif_size, jpeg_size + exif_size);
             }
             delete exif;
             cookie2 = NULL;
@@ -789,6 +827,7 @@ void AppCallbackNotifier::copyAndSendPreviewFrame(CameraFrame* frame, int32_t ms
     if((mNotifierState == AppCallbackNotifier::NOTIFIER_STARTED) &&
        mCameraHal->msgTypeEnabled(msgType) &&
        (dest != NULL)) {
+        CameraFrameStats::frameReached(frame, CameraFrame::STAGE_PREVIEW_CALLBACK);
         mDataCb(msgType, mPreviewMemory, mPreviewBufCount, NULL, mCallbackCookie);
     }
 
@@ -895,15 +934,33 @@ void AppCallbackNotifier::notifyFrame()
                           (CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG & frame->mQuirks) )
                     {
 
+                    if ( ( CameraFrame::MERGE_EXPOSURE_BRACKET |
+                           CameraFrame::DENOISE_BURST ) & frame->mQuirks )
+                        {
+                        frame = gatherBracketFrame(frame);
+                        if ( NULL == frame )
+                            {
+                            break;
+                            }
+                        }
+
                     int encode_quality = 100, tn_quality = 100;
                     int tn_width, tn_height;
                     unsigned int current_snapshot = 0;
                     Encoder_libjpeg::params *main_jpeg = NULL, *tn_jpeg = NULL;
                     void* exif_data = NULL;
-                    camera_memory_t* raw_picture = mRequestMemory(-1, frame->mLength, 1, NULL);
+                    size_t exif_headroom = 0;
+                    camera_memory_t* raw_picture = NULL;
+
+                    if (CameraFrame::HAS_EXIF_DATA & frame->mQuirks) {
+                        exif_data = frame->mCookie2;
+                        exif_headroom = EXIF_APP1_MAX_SIZE;
+                    }
+
+                    raw_picture = mRequestMemory(-1, frame->mLength + exif_headroom, 1, NULL);
 
                     if(raw_picture) {
-                        buf = raw_picture->data;
+                        buf = (uint8_t*) raw_picture->data + exif_headroom;
                     }
 
                     CameraParameters parameters;
@@ -921,10 +978,6 @@ void AppCallbackNotifier::notifyFrame()
                         tn_quality = 100;
                     }
 
-                    if (CameraFrame::HAS_EXIF_DATA & frame->mQuirks) {
-                        exif_data = frame->mCookie2;
-                    }
-
                     main_jpeg = (Encoder_libjpeg::params*)
                                     malloc(sizeof(Encoder_libjpeg::params));
 
@@ -948,6 +1001,7 @@ void AppCallbackNotifier::notifyFrame()
                         main_jpeg->right_crop = rightCrop;
                         main_jpeg->start_offset = frame->mOffset;
                         main_jpeg->format = CameraParameters::PIXEL_FORMAT_YUV422I;
+                        main_jpeg->jfif = (exif_data == NULL);
                     }
 
                     tn_width = parameters.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH);
@@ -978,6 +1032,7 @@ void AppCallbackNotifier::notifyFrame()
                         tn_jpeg->right_crop = 0;
                         tn_jpeg->start_offset = 0;
                         tn_jpeg->format = CameraParameters::PIXEL_FORMAT_YUV420SP;;
+                        tn_jpeg->jfif = false;
                     }
 
                     sp<Encoder_libjpeg> encoder = new Encoder_libjpeg(main_jpeg,
@@ -987,8 +1042,8 @@ void AppCallbackNotifier::notifyFrame()
                                                       this,
                                                       raw_picture,
                                                       exif_data);
-                    encoder->run();
                     gEncoderQueue.add(frame->mBuffer, encoder);
+                    AppCallbackNotifierDispatchEncoder(encoder);
                     encoder.clear();
                     if (params != NULL)
                       {
@@ -1093,6 +1148,7 @@ void AppCallbackNotifier::notifyFrame()
                             CAMHAL_LOGVB("mDataCbTimestamp : frame->mBuffer=0x%x, videoMetadataBuffer=0x%x, videoMedatadaBufferMemory=0x%x",
                                             frame->mBuffer, videoMetadataBuffer, videoMedatadaBufferMemory);
 
+                            CameraFrameStats::frameReached(frame, CameraFrame::STAGE_VIDEO_CALLBACK);
                             mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME,
                                                 videoMedatadaBufferMemory, 0, mCallbackCookie);
                             }
@@ -1107,6 +1163,7 @@ void AppCallbackNotifier::notifyFrame()
                                 }
 
                             fakebuf->data = frame->mBuffer;
+                            CameraFrameStats::frameReached(frame, CameraFrame::STAGE_VIDEO_CALLBACK);
                             mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME, fakebuf, 0, mCallbackCookie);
                             fakebuf->release(fakebuf);
                             }
@@ -1167,6 +1224,116 @@ exit:
     LOG_FUNCTION_NAME_EXIT;
 }
 
+///Holds the frames of an exposure bracket or a denoise burst until all of
+///them arrived and merges them. Returns the frame carrying the merged image,
+///or NULL while the group is still incomplete.
+CameraFrame *AppCallbackNotifier::gatherBracketFrame(CameraFrame* frame)
+{
+    CameraFrame *bracket[FrameMerge::MAX_FRAMES];
+    uint8_t *frames[FrameMerge::MAX_FRAMES];
+    size_t count, reference;
+    bool denoise;
+    status_t ret;
+
+    LOG_FUNCTION_NAME;
+
+    denoise = ( 0 != ( CameraFrame::DENOISE_BURST & frame->mQuirks ) );
+
+    // Every frame of the group holds a capture buffer until the merge,
+    // longer groups can't be gathered and are encoded one by one
+    if ( ( 2 > frame->mBracketCount ) || ( FrameMerge::MAX_FRAMES < frame->mBracketCount ) ) {
+        CAMHAL_LOGDB("Bracket of %u frames encoded unmerged", frame->mBracketCount);
+        return frame;
+    }
+
+    {
+    Mutex::Autolock lock(mLock);
+
+    // A frame out of sequence means part of the bracket got lost
+    if ( mBracketFrames.size() != frame->mBracketIndex ) {
+        CAMHAL_LOGEB("Bracket frame %u out of sequence, dropping %u gathered",
+                     frame->mBracketIndex, (unsigned int) mBracketFrames.size());
+        releaseBracketFrames();
+        if ( 0 != frame->mBracketIndex ) {
+            return frame;
+        }
+    }
+
+    mBracketFrames.add(frame);
+    if ( mBracketFrames.size() < frame->mBracketCount ) {
+        return NULL;
+    }
+
+    count = mBracketFrames.size();
+    for ( size_t i = 0 ; i < count ; i++ ) {
+        bracket[i] = mBracketFrames[i];
+        frames[i] = (uint8_t*) bracket[i]->mBuffer + bracket[i]->mOffset;
+    }
+    mBracketFrames.clear();
+    } // scope for mutex lock
+
+    // The merged image is written over one of the capture buffers,
+    // which then goes down the regular encode path
+    if ( denoise ) {
+        // The first frame is the one closest to the shutter press
+        reference = 0;
+        ret = TemporalDenoise::merge(frames,
+                                     count,
+                                     frame->mWidth,
+                                     frame->mHeight,
+                                     frame->mAlignment);
+        if ( NO_ERROR != ret ) {
+            CAMHAL_LOGEB("Burst denoise failed %d, encoding the first frame", ret);
+        }
+    } else {
+        ret = ExposureFusion::merge(frames,
+                                    count,
+                                    frame->mWidth,
+                                    frame->mHeight,
+                                    frame->mAlignment,
+                                    reference);
+        if ( NO_ERROR != ret ) {
+            CAMHAL_LOGEB("Bracket merge failed %d, encoding the middle exposure", ret);
+            reference = count / 2;
+        }
+    }
+
+    for ( size_t i = 0 ; i < count ; i++ ) {
+        if ( i == reference ) {
+            continue;
+        }
+
+        if ( CameraFrame::HAS_EXIF_DATA & bracket[i]->mQuirks ) {
+            delete (ExifElementsTable*) bracket[i]->mCookie2;
+        }
+        mFrameProvider->returnFrame(bracket[i]->mBuffer,
+                                    (CameraFrame::FrameType) bracket[i]->mFrameType);
+        delete bracket[i];
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return bracket[reference];
+}
+
+///Returns the frames of an incomplete bracket, called with mLock held
+void AppCallbackNotifier::releaseBracketFrames()
+{
+    CameraFrame *frame;
+
+    for ( size_t i = 0 ; i < mBracketFrames.size() ; i++ ) {
+        frame = mBracketFrames[i];
+        if ( CameraFrame::HAS_EXIF_DATA & frame->mQuirks ) {
+            delete (ExifElementsTable*) frame->mCookie2;
+        }
+        mFrameProvider->returnFrame(frame->mBuffer,
+                                    (CameraFrame::FrameType) frame->mFrameType);
+        delete frame;
+    }
+
+    mBracketFrames.clear();
+}
+
 void AppCallbackNotifier::frameCallbackRelay(CameraFrame* caFrame)
 {
     LOG_FUNCTION_NAME;
@@ -1218,6 +1385,8 @@ void AppCallbackNotifier::flushAndReturnFrames()
         }
     }
 
+    releaseBracketFrames();
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -1816,8 +1985,12 @@ status_t AppCallbackNotifier::stop()
 
     mNotifierState = AppCallbackNotifier::NOTIFIER_STOPPED;
     CAMHAL_LOGDA(" --> AppCallbackNotifier NOTIFIER_STOPPED \n");
+
+    releaseBracketFrames();
     }
 
+    // Encoders still waiting for a slot are canceled too. They run
+    // only to release themselves and don't touch their buffers.
     while(!gEncoderQueue.isEmpty()) {
         sp<Encoder_libjpeg> encoder = gEncoderQueue.valueAt(0);
         camera_memory_t* encoded_mem = NULL;
@@ -24,7 +24,7 @@ namespace android {
 
 /*--------------------Camera Adapter Class STARTS here-----------------------------*/
 
-BaseCameraAdapter::BaseCameraAdapter()
+BaseCameraAdapter::BaseCameraAdapter() : mSensorFps("sensor")
 {
     mReleaseImageBuffersCallback = NULL;
     mEndImageCaptureCallback = NULL;
@@ -32,6 +32,7 @@ BaseCameraAdapter::BaseCameraAdapter()
     mEndCaptureData = NULL;
     mReleaseData = NULL;
     mRecording = false;
+    mShutterTimestamp = 0;
 
     mPreviewBuffers = NULL;
     mPreviewBufferCount = 0;
@@ -51,13 +52,7 @@ BaseCameraAdapter::BaseCameraAdapter()
 
     mAdapterState = INTIALIZED_STATE;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-    mStartFocus.tv_sec = 0;
-    mStartFocus.tv_usec = 0;
-    mStartCapture.tv_sec = 0;
-    mStartCapture.tv_usec = 0;
-#endif
-
+    mNextFrameId = 0;
 }
 
 BaseCameraAdapter::~BaseCameraAdapter()
@@ -327,7 +322,6 @@ void BaseCameraAdapter::returnFrame(void* frameBuf, CameraFrame::FrameType frame
 status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, int value2, int value3)
 {
     status_t ret = NO_ERROR;
-    struct timeval *refTimestamp;
     BuffersDescriptor *desc = NULL;
     CameraFrame *frame = NULL;
 
@@ -555,6 +549,11 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                 ret = setState(operation);
                 }
 
+            if ( ret == NO_ERROR )
+                {
+                mSensorFps.reset();
+                }
+
             if ( ret == NO_ERROR )
                 {
                 ret = startPreview();
@@ -583,6 +582,11 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                 ret = setState(operation);
                 }
 
+            if ( ret == NO_ERROR )
+                {
+                mSensorFps.log();
+                }
+
             if ( ret == NO_ERROR )
                 {
                 ret = stopPreview();
@@ -686,16 +690,6 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
         case CameraAdapter::CAMERA_START_IMAGE_CAPTURE:
             {
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-            refTimestamp = ( struct timeval * ) value1;
-            if ( NULL != refTimestamp )
-                {
-                memcpy( &mStartCapture, refTimestamp, sizeof( struct timeval ));
-                }
-
-#endif
-
             if ( ret == NO_ERROR )
                 {
                 ret = setState(operation);
@@ -703,6 +697,15 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
 
             if ( ret == NO_ERROR )
                 {
+                if ( 0 != value1 )
+                    {
+                    mShutterTimestamp = *( ( nsecs_t * ) value1 );
+                    }
+                else
+                    {
+                    mShutterTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+                    }
+
                 ret = takePicture();
                 }
 
@@ -748,16 +751,6 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
         case CameraAdapter::CAMERA_START_BRACKET_CAPTURE:
             {
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-            refTimestamp = ( struct timeval * ) value2;
-            if ( NULL != refTimestamp )
-                {
-                memcpy( &mStartCapture, refTimestamp, sizeof( struct timeval ));
-                }
-
-#endif
-
             if ( ret == NO_ERROR )
                 {
                 ret = setState(operation);
@@ -809,16 +802,6 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
 
         case CameraAdapter::CAMERA_PERFORM_AUTOFOCUS:
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-            refTimestamp = ( struct timeval * ) value1;
-            if ( NULL != refTimestamp )
-                {
-                memcpy( &mStartFocus, refTimestamp, sizeof( struct timeval ));
-                }
-
-#endif
-
             if ( ret == NO_ERROR )
                 {
                 ret = setState(operation);
@@ -975,6 +958,38 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
            ret = switchToExecuting();
            break;
 
+         case CameraAdapter::CAMERA_PREPARE_PREVIEW_RECONFIGURE:
+
+             ret = prepareReconfigure();
+
+             break;
+
+         case CameraAdapter::CAMERA_QUERY_PREVIEW_BUFFER_COUNT:
+
+             if ( 0 != value1 )
+                 {
+                 ret = getPreviewBufferCount(*( ( unsigned int * ) value1 ));
+                 }
+             else
+                 {
+                 ret = -EINVAL;
+                 }
+
+             break;
+
+         case CameraAdapter::CAMERA_QUERY_CAPTURE_FRAME_COUNT:
+
+             if ( 0 != value1 )
+                 {
+                 ret = getCaptureFrameCount(*( ( unsigned int * ) value1 ));
+                 }
+             else
+                 {
+                 ret = -EINVAL;
+                 }
+
+             break;
+
         default:
             CAMHAL_LOGEB("Command 0x%x unsupported!", operation);
             break;
@@ -997,14 +1012,10 @@ status_t BaseCameraAdapter::notifyFocusSubscribers(CameraHalEvent::FocusStatus s
         return NO_INIT;
     }
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-     if (status == CameraHalEvent::FOCUS_STATUS_PENDING) {
-        gettimeofday(&mStartFocus, NULL);
-     } else {
-        //dump the AF latency
-        CameraHal::PPM("Focus finished in: ", &mStartFocus);
+    // FOCUS_START is recorded by CameraHal::autoFocus
+    if (status != CameraHalEvent::FOCUS_STATUS_PENDING) {
+        CAMHAL_TRACE_EVENT(FOCUS_DONE, 0, status, 0);
     }
-#endif
 
     focusEvent.mEventData = new CameraHalEvent::CameraHalEventData();
     if ( NULL == focusEvent.mEventData.get() ) {
@@ -1148,15 +1159,16 @@ status_t BaseCameraAdapter::sendFrameToSubscribers(CameraFrame *frame)
         return -EINVAL;
         }
 
+    frame->mFrameId = mNextFrameId++;
+    CameraFrameStats::frameReached(frame, CameraFrame::STAGE_DISPATCHED);
+
     for( mask = 1; mask < CameraFrame::ALL_FRAMES; mask <<= 1){
       if( mask & frame->mFrameMask ){
         switch( mask ){
 
         case CameraFrame::IMAGE_FRAME:
           {
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-            CameraHal::PPM("Shot to Jpeg: ", &mStartCapture);
-#endif
+            CAMHAL_TRACE_EVENT(CAPTURE_JPEG, frame->mFrameId, 0, 0);
             ret = __sendFrameToSubscribers(frame, &mImageSubscribers, CameraFrame::IMAGE_FRAME);
           }
           break;
@@ -1243,6 +1255,8 @@ status_t BaseCameraAdapter::__sendFrameToSubscribers(CameraFrame* frame,
                      ( uint32_t ) frame->mBuffer,
                      refCount);
 
+        CameraFrameStats::frameDispatched(frame->mBuffer, frameType);
+
         for ( unsigned int i = 0 ; i < refCount; i++ ) {
             frame->mCookie = ( void * ) subscribers->keyAt(i);
             callback = (frame_callback) subscribers->valueAt(i);
@@ -1665,6 +1679,39 @@ status_t BaseCameraAdapter::switchToExecuting()
   return ret;
 }
 
+status_t BaseCameraAdapter::prepareReconfigure()
+{
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+status_t BaseCameraAdapter::getPreviewBufferCount(unsigned int &count)
+{
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+status_t BaseCameraAdapter::getCaptureFrameCount(unsigned int &count)
+{
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
 status_t BaseCameraAdapter::setState(CameraCommands operation)
 {
     status_t ret = NO_ERROR;
@@ -2314,6 +2361,11 @@ status_t BaseCameraAdapter::getNextState(AdapterState &state)
     return ret;
 }
 
+status_t BaseCameraAdapter::dump(int fd)
+{
+    return mSensorFps.dump(fd);
+}
+
 void BaseCameraAdapter::onOrientationEvent(uint32_t orientation, uint32_t tilt)
 {
     LOG_FUNCTION_NAME;
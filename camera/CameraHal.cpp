@@ -43,21 +43,15 @@ extern "C" CameraAdapter* CameraAdapter_Factory(size_t);
 ////       Currently, they are hard-coded
 
 const int CameraHal::NO_BUFFERS_PREVIEW = MAX_CAMERA_BUFFERS;
-const int CameraHal::NO_BUFFERS_IMAGE_CAPTURE = 2;
+//Burst capture keeps every software encoder busy and still has
+//buffers left on the capture port
+const int CameraHal::NO_BUFFERS_IMAGE_CAPTURE = AppCallbackNotifier::MAX_ENCODERS + 2;
 
 const uint32_t MessageNotifier::EVENT_BIT_FIELD_POSITION = 0;
 const uint32_t MessageNotifier::FRAME_BIT_FIELD_POSITION = 0;
 
 /******************************************************************************/
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-struct timeval CameraHal::mStartPreview;
-struct timeval CameraHal::mStartFocus;
-struct timeval CameraHal::mStartCapture;
-
-#endif
-
 static void orientation_cb(uint32_t orientation, uint32_t tilt, void* cookie) {
     CameraHal *camera = NULL;
 
@@ -158,6 +152,8 @@ void CameraHal::enableMsgType(int32_t msgType)
     ///Configure app callback notifier with the message callback required
     mAppCallbackNotifier->enableMsgType (msgType);
 
+    updateDisplayCpuAccess();
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -185,6 +181,8 @@ void CameraHal::disableMsgType(int32_t msgType)
     ///Configure app callback notifier
     mAppCallbackNotifier->disableMsgType (msgType);
 
+    updateDisplayCpuAccess();
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -259,6 +257,9 @@ int CameraHal::setParameters(const CameraParameters& params)
     {
         Mutex::Autolock lock(mLock);
 
+        // Invalidates the flattened copy returned by getParameters()
+        mParametersGeneration++;
+
         ///Ensure that preview is not enabled when the below parameters are changed.
         if(!previewEnabled())
             {
@@ -266,7 +267,7 @@ int CameraHal::setParameters(const CameraParameters& params)
             CAMHAL_LOGDB("PreviewFormat %s", params.getPreviewFormat());
 
             if ((valstr = params.getPreviewFormat()) != NULL) {
-                if ( isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FORMATS))) {
+                if ( isParameterValid(valstr, mSupportedPreviewFormats)) {
                     mParameters.setPreviewFormat(valstr);
                 } else {
                     CAMHAL_LOGEB("Invalid preview format.Supported: %s",  mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FORMATS));
@@ -311,7 +312,7 @@ int CameraHal::setParameters(const CameraParameters& params)
                 }
 
             if ((valstr = params.get(TICameraParameters::KEY_IPP)) != NULL) {
-                if (isParameterValid(valstr,mCameraProperties->get(CameraProperties::SUPPORTED_IPP_MODES))) {
+                if (isParameterValid(valstr,mSupportedIPPModes)) {
                     CAMHAL_LOGDB("IPP mode set %s", valstr);
                     mParameters.set(TICameraParameters::KEY_IPP, valstr);
                 } else {
@@ -358,7 +359,7 @@ int CameraHal::setParameters(const CameraParameters& params)
 
             if(orientation ==90 || orientation ==270)
            {
-              if ( !isResolutionValid(h,w, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIZES)))
+              if ( !isResolutionValid(h,w, mSupportedPreviewSizes))
                {
                 CAMHAL_LOGEB("Invalid preview resolution %d x %d", w, h);
                 return BAD_VALUE;
@@ -372,7 +373,7 @@ int CameraHal::setParameters(const CameraParameters& params)
            }
            else
            {
-            if ( !isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIZES)))
+            if ( !isResolutionValid(w, h, mSupportedPreviewSizes))
                 {
                 CAMHAL_LOGEB("Invalid preview resolution %d x %d", w, h);
                 return BAD_VALUE;
@@ -386,7 +387,7 @@ int CameraHal::setParameters(const CameraParameters& params)
 
 #else
 
-        if ( !isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIZES))) {
+        if ( !isResolutionValid(w, h, mSupportedPreviewSizes)) {
             CAMHAL_LOGEB("Invalid preview resolution %d x %d", w, h);
             return BAD_VALUE;
         } else {
@@ -456,7 +457,7 @@ int CameraHal::setParameters(const CameraParameters& params)
             }
 
         if ((valstr = params.get(CameraParameters::KEY_FOCUS_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_FOCUS_MODES))) {
+            if (isParameterValid(valstr, mSupportedFocusModes)) {
                 CAMHAL_LOGDB("Focus mode set %s", valstr);
 
                 // we need to take a decision on the capture mode based on whether CAF picture or
@@ -476,7 +477,7 @@ int CameraHal::setParameters(const CameraParameters& params)
 
         ///Below parameters can be changed when the preview is running
         if ( (valstr = params.getPictureFormat()) != NULL ) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_FORMATS))) {
+            if (isParameterValid(valstr, mSupportedPictureFormats)) {
                 mParameters.setPictureFormat(valstr);
             } else {
                 CAMHAL_LOGEB("ERROR: Invalid picture format: %s",valstr);
@@ -485,7 +486,7 @@ int CameraHal::setParameters(const CameraParameters& params)
         }
 
         params.getPictureSize(&w, &h);
-        if ( isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SIZES))) {
+        if ( isResolutionValid(w, h, mSupportedPictureSizes)) {
             mParameters.setPictureSize(w, h);
         } else {
             CAMHAL_LOGEB("ERROR: Invalid picture resolution %dx%d", w, h);
@@ -520,9 +521,9 @@ int CameraHal::setParameters(const CameraParameters& params)
 
         //Perform parameter validation
         if(!isParameterValid(valstr
-                        , mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_SUPPORTED))
+                        , mSupportedFramerateRanges)
                         || !isParameterValid(framerate,
-                                      mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FRAME_RATES)))
+                                      mSupportedFramerates))
         {
             CAMHAL_LOGEA("Invalid frame rate range or frame rate");
             return BAD_VALUE;
@@ -629,7 +630,7 @@ int CameraHal::setParameters(const CameraParameters& params)
             }
 
         if ((valstr = params.get(TICameraParameters::KEY_EXPOSURE_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_EXPOSURE_MODES))) {
+            if (isParameterValid(valstr, mSupportedExposureModes)) {
                 CAMHAL_LOGDB("Exposure set = %s", valstr);
                 mParameters.set(TICameraParameters::KEY_EXPOSURE_MODE, valstr);
             } else {
@@ -641,7 +642,7 @@ int CameraHal::setParameters(const CameraParameters& params)
 #endif
 
         if ((valstr = params.get(CameraParameters::KEY_WHITE_BALANCE)) != NULL) {
-           if ( isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_WHITE_BALANCE))) {
+           if ( isParameterValid(valstr, mSupportedWhiteBalance)) {
                CAMHAL_LOGDB("White balance set %s", valstr);
                mParameters.set(CameraParameters::KEY_WHITE_BALANCE, valstr);
             } else {
@@ -695,7 +696,7 @@ int CameraHal::setParameters(const CameraParameters& params)
 #endif
 
         if ((valstr = params.get(CameraParameters::KEY_ANTIBANDING)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_ANTIBANDING))) {
+            if (isParameterValid(valstr, mSupportedAntibanding)) {
                 CAMHAL_LOGDB("Antibanding set %s", valstr);
                 mParameters.set(CameraParameters::KEY_ANTIBANDING, valstr);
              } else {
@@ -707,7 +708,7 @@ int CameraHal::setParameters(const CameraParameters& params)
 #ifdef OMAP_ENHANCEMENT
 
         if ((valstr = params.get(TICameraParameters::KEY_ISO)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_ISO_VALUES))) {
+            if (isParameterValid(valstr, mSupportedISOValues)) {
                 CAMHAL_LOGDB("ISO set %s", valstr);
                 mParameters.set(TICameraParameters::KEY_ISO, valstr);
             } else {
@@ -755,7 +756,7 @@ int CameraHal::setParameters(const CameraParameters& params)
             }
 
         if ((valstr = params.get(CameraParameters::KEY_SCENE_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_SCENE_MODES))) {
+            if (isParameterValid(valstr, mSupportedSceneModes)) {
                 CAMHAL_LOGDB("Scene mode set %s", valstr);
                 doesSetParameterNeedUpdate(valstr,
                                            mParameters.get(CameraParameters::KEY_SCENE_MODE),
@@ -768,7 +769,7 @@ int CameraHal::setParameters(const CameraParameters& params)
         }
 
         if ((valstr = params.get(CameraParameters::KEY_FLASH_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_FLASH_MODES))) {
+            if (isParameterValid(valstr, mSupportedFlashModes)) {
                 CAMHAL_LOGDB("Flash mode set %s", valstr);
                 mParameters.set(CameraParameters::KEY_FLASH_MODE, valstr);
             } else {
@@ -778,7 +779,7 @@ int CameraHal::setParameters(const CameraParameters& params)
         }
 
         if ((valstr = params.get(CameraParameters::KEY_EFFECT)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_EFFECTS))) {
+            if (isParameterValid(valstr, mSupportedEffects)) {
                 CAMHAL_LOGDB("Effect set %s", valstr);
                 mParameters.set(CameraParameters::KEY_EFFECT, valstr);
              } else {
@@ -910,6 +911,26 @@ int CameraHal::setParameters(const CameraParameters& params)
             mParameters.remove(TICameraParameters::KEY_EXP_BRACKETING_RANGE);
             }
 
+        if( (valstr = params.get(TICameraParameters::KEY_EXP_BRACKETING_MERGE)) != NULL )
+            {
+            CAMHAL_LOGDB("Exposure Bracketing merge set %s", valstr);
+            mParameters.set(TICameraParameters::KEY_EXP_BRACKETING_MERGE, valstr);
+            }
+        else
+            {
+            mParameters.remove(TICameraParameters::KEY_EXP_BRACKETING_MERGE);
+            }
+
+        if( (valstr = params.get(TICameraParameters::KEY_TEMPORAL_NR_FRAMES)) != NULL )
+            {
+            CAMHAL_LOGDB("Temporal noise reduction frames set %s", valstr);
+            mParameters.set(TICameraParameters::KEY_TEMPORAL_NR_FRAMES, valstr);
+            }
+        else
+            {
+            mParameters.remove(TICameraParameters::KEY_TEMPORAL_NR_FRAMES);
+            }
+
 #endif
 
         valstr = params.get(CameraParameters::KEY_ZOOM);
@@ -954,6 +975,7 @@ int CameraHal::setParameters(const CameraParameters& params)
         // enabled or doesSetParameterNeedUpdate says so. Initial setParameters to camera adapter,
         // will be called in startPreview()
         // TODO(XXX): Need to identify other parameters that need update from camera adapter
+        // The adapter diffs the parameters per key itself, see CameraParameterChanges
         if ( (NULL != mCameraAdapter) && (mPreviewEnabled || updateRequired) ) {
             ret |= mCameraAdapter->setParameters(mParameters);
         }
@@ -1396,7 +1418,7 @@ status_t CameraHal::freeVideoBufs(void *bufs)
   LOG_FUNCTION_NAME;
 
   buffer_handle_t *pBuf = (buffer_handle_t*)bufs;
-  int count = atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
+  int count = mPreviewBufCount;
   if(pBuf == NULL)
     {
       CAMHAL_LOGEA("NULL pointer passed to freeVideoBuffer");
@@ -1435,9 +1457,7 @@ status_t CameraHal::startPreview()
     unsigned int required_buffer_count;
     unsigned int max_queueble_buffers;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-        gettimeofday(&mStartPreview, NULL);
-#endif
+    CAMHAL_TRACE_EVENT(PREVIEW_START, 0, mCameraIndex, 0);
 
     LOG_FUNCTION_NAME;
 
@@ -1447,6 +1467,8 @@ status_t CameraHal::startPreview()
       return ALREADY_EXISTS;
     }
 
+    CameraFrameStats::reset();
+
     if ( NULL != mCameraAdapter ) {
       ret = mCameraAdapter->setParameters(mParameters);
     }
@@ -1464,6 +1486,7 @@ status_t CameraHal::startPreview()
       //Update the padded width and height - required for VNF and VSTAB
       mParameters.set(TICameraParameters::KEY_PADDED_WIDTH, mPreviewWidth);
       mParameters.set(TICameraParameters::KEY_PADDED_HEIGHT, mPreviewHeight);
+      mParametersGeneration++;
 
     }
 
@@ -1505,6 +1528,18 @@ status_t CameraHal::startPreview()
 
     required_buffer_count = atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
 
+    ///The adapter may adjust the buffer count based on the pipeline occupancy
+    ///measured during the previous preview sessions
+    ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_QUERY_PREVIEW_BUFFER_COUNT,
+                                      ( int ) &required_buffer_count);
+    if ( NO_ERROR != ret )
+        {
+        CAMHAL_LOGEB("Error: CAMERA_QUERY_PREVIEW_BUFFER_COUNT %d", ret);
+        goto error;
+        }
+
+    mPreviewBufCount = required_buffer_count;
+
     ///Allocate the preview buffers
     ret = allocPreviewBufs(mPreviewWidth, mPreviewHeight, mParameters.getPreviewFormat(), required_buffer_count, max_queueble_buffers);
 
@@ -1620,15 +1655,7 @@ status_t CameraHal::startPreview()
         }
 #endif //if 0
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-        ret = mDisplayAdapter->enableDisplay(width, height, &mStartPreview, isS3d ? &s3dParams : NULL);
-
-#else
-
-        ret = mDisplayAdapter->enableDisplay(width, height, NULL, isS3d ? &s3dParams : NULL);
-
-#endif
+        ret = mDisplayAdapter->enableDisplay(width, height, isS3d ? &s3dParams : NULL);
 
         if ( ret != NO_ERROR )
             {
@@ -1738,6 +1765,9 @@ status_t CameraHal::setPreviewWindow(struct preview_stream_ops *window)
         // Set it as the error handler for the DisplayAdapter
         mDisplayAdapter->setErrorHandler(mAppCallbackNotifier.get());
 
+        // Preview callbacks might have been enabled before the display adapter existed
+        updateDisplayCpuAccess();
+
         // Update the display adapter with the new window that is passed from CameraService
         ret  = mDisplayAdapter->setPreviewWindow(window);
         if(ret!=NO_ERROR)
@@ -1803,6 +1833,19 @@ void CameraHal::stopPreview()
     // to ImageCapture, CAPTURE_MODE is not left to VIDEO_MODE.
     CAMHAL_LOGDA("Resetting Capture-Mode to default");
     mParameters.set(TICameraParameters::KEY_CAP_MODE, "");
+    mParametersGeneration++;
+
+    CameraFrameStats::log();
+
+#if CAMHAL_TRACE
+
+    char tracePath[PROPERTY_VALUE_MAX];
+    if ( 0 < property_get(CAMHAL_TRACE_FILE_PROPERTY, tracePath, NULL) )
+        {
+        CameraTrace::dump(tracePath);
+        }
+
+#endif
 
     LOG_FUNCTION_NAME_EXIT;
 }
@@ -1843,12 +1886,7 @@ status_t CameraHal::startRecording( )
 
     LOG_FUNCTION_NAME;
 
-
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-            gettimeofday(&mStartPreview, NULL);
-
-#endif
+    CAMHAL_TRACE_EVENT(PREVIEW_START, 0, mCameraIndex, 0);
 
     if(!previewEnabled())
         {
@@ -1858,6 +1896,7 @@ status_t CameraHal::startRecording( )
     // set internal recording hint in case camera adapter needs to make some
     // decisions....(will only be sent to camera adapter if camera restart is required)
     mParameters.set(TICameraParameters::KEY_RECORDING_HINT, CameraParameters::TRUE);
+    mParametersGeneration++;
 
     // if application starts recording in continuous focus picture mode...
     // then we need to force default capture mode (as opposed to video mode)
@@ -1879,7 +1918,7 @@ status_t CameraHal::startRecording( )
 
     if ( NO_ERROR == ret )
       {
-        int count = atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
+        int count = mPreviewBufCount;
         mParameters.getPreviewSize(&w, &h);
         CAMHAL_LOGDB("%s Video Width=%d Height=%d", __FUNCTION__, mVideoWidth, mVideoHeight);
 
@@ -1890,6 +1929,7 @@ status_t CameraHal::startRecording( )
               {
                 CAMHAL_LOGEB("allocImageBufs returned error 0x%x", ret);
                 mParameters.remove(TICameraParameters::KEY_RECORDING_HINT);
+                mParametersGeneration++;
                 return ret;
               }
 
@@ -1919,6 +1959,7 @@ status_t CameraHal::startRecording( )
     if ( NO_ERROR == ret )
         {
         mRecordingEnabled = true;
+        updateDisplayCpuAccess();
         }
 
     LOG_FUNCTION_NAME_EXIT;
@@ -1947,6 +1988,8 @@ bool CameraHal::setVideoModeParameters(const CameraParameters& params)
 
     LOG_FUNCTION_NAME;
 
+    mParametersGeneration++;
+
     // Set CAPTURE_MODE to VIDEO_MODE, if not set already and Restart Preview
     valstr = mParameters.get(TICameraParameters::KEY_CAP_MODE);
     if ( (valstr == NULL) ||
@@ -2036,6 +2079,7 @@ bool CameraHal::resetVideoModeParameters()
     if ((valstr != NULL) && (strcmp(valstr, TICameraParameters::VIDEO_MODE) == 0)) {
         CAMHAL_LOGDA("Reset Capture-Mode to default");
         mParameters.set(TICameraParameters::KEY_CAP_MODE, "");
+        mParametersGeneration++;
         restartPreviewRequired = true;
     }
 
@@ -2075,11 +2119,20 @@ status_t CameraHal::restartPreview()
         tmpvalstr[sizeof(tmpvalstr)-1] = 0;
         }
 
+    // Hand the new configuration to the adapter before stopping, so it can
+    // tell whether the sensor has to go through a full state cycle
+    {
+        Mutex::Autolock lock(mLock);
+        mCameraAdapter->setParameters(mParameters);
+    }
+    mCameraAdapter->sendCommand(CameraAdapter::CAMERA_PREPARE_PREVIEW_RECONFIGURE);
+
     forceStopPreview();
 
     {
         Mutex::Autolock lock(mLock);
         mParameters.set(TICameraParameters::KEY_CAP_MODE, tmpvalstr);
+        mParametersGeneration++;
         mCameraAdapter->setParameters(mParameters);
     }
 
@@ -2120,6 +2173,7 @@ void CameraHal::stopRecording()
     mCameraAdapter->sendCommand(CameraAdapter::CAMERA_STOP_VIDEO);
 
     mRecordingEnabled = false;
+    updateDisplayCpuAccess();
 
     if ( mAppCallbackNotifier->getUesVideoBuffers() ){
       freeVideoBufs(mVideoBufs);
@@ -2133,6 +2187,7 @@ void CameraHal::stopRecording()
     // reset internal recording hint in case camera adapter needs to make some
     // decisions....(will only be sent to camera adapter if camera restart is required)
     mParameters.remove(TICameraParameters::KEY_RECORDING_HINT);
+    mParametersGeneration++;
 
     LOG_FUNCTION_NAME_EXIT;
 }
@@ -2195,11 +2250,7 @@ status_t CameraHal::autoFocus()
 {
     status_t ret = NO_ERROR;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    gettimeofday(&mStartFocus, NULL);
-
-#endif
+    CAMHAL_TRACE_EVENT(FOCUS_START, 0, mCameraIndex, 0);
 
     LOG_FUNCTION_NAME;
 
@@ -2226,17 +2277,8 @@ status_t CameraHal::autoFocus()
             goto EXIT;
         }
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //pass the autoFocus timestamp along with the command to camera adapter
-    ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_PERFORM_AUTOFOCUS, ( int ) &mStartFocus);
-
-#else
-
     ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_PERFORM_AUTOFOCUS);
 
-#endif
-
 EXIT:
     LOG_FUNCTION_NAME_EXIT;
 
@@ -2344,11 +2386,7 @@ status_t CameraHal::startImageBracketing()
         CameraFrame frame;
         CameraAdapter::BuffersDescriptor desc;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-        gettimeofday(&mStartCapture, NULL);
-
-#endif
+        CAMHAL_TRACE_EVENT(CAPTURE_START, 0, mCameraIndex, 0);
 
         LOG_FUNCTION_NAME;
 
@@ -2419,18 +2457,7 @@ status_t CameraHal::startImageBracketing()
 
             if ( NO_ERROR == ret )
                 {
-
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-                 //pass capture timestamp along with the camera adapter command
-                ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_BRACKET_CAPTURE,  ( mBracketRangePositive + 1 ),  (int) &mStartCapture);
-
-#else
-
                 ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_BRACKET_CAPTURE, ( mBracketRangePositive + 1 ));
-
-#endif
-
                 }
             }
 
@@ -2473,14 +2500,12 @@ status_t CameraHal::takePicture( )
     int burst;
     const char *valstr = NULL;
     unsigned int bufferCount = 1;
+    unsigned int captureFrames = 1;
+    nsecs_t shutterTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
 
     Mutex::Autolock lock(mLock);
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    gettimeofday(&mStartCapture, NULL);
-
-#endif
+    CAMHAL_TRACE_EVENT(CAPTURE_START, 0, mCameraIndex, 0);
 
     LOG_FUNCTION_NAME;
 
@@ -2516,8 +2541,20 @@ status_t CameraHal::takePicture( )
             burst = mParameters.getInt(TICameraParameters::KEY_BURST);
             }
 
+         //Temporal noise reduction captures and holds a short burst too,
+         //the adapter knows whether it enabled it for this configuration
+         if ( ( NO_ERROR == ret ) && ( NULL != mCameraAdapter ) )
+            {
+            ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_QUERY_CAPTURE_FRAME_COUNT,
+                                              ( int ) &captureFrames);
+            if ( NO_ERROR != ret )
+                {
+                CAMHAL_LOGEB("CAMERA_QUERY_CAPTURE_FRAME_COUNT returned error 0x%x", ret);
+                }
+            }
+
          //Allocate all buffers only in burst capture case
-         if ( burst > 1 )
+         if ( ( burst > 1 ) || ( captureFrames > 1 ) )
              {
              bufferCount = CameraHal::NO_BUFFERS_IMAGE_CAPTURE;
              if ( NULL != mAppCallbackNotifier.get() )
@@ -2547,10 +2584,6 @@ status_t CameraHal::takePicture( )
                     mAppCallbackNotifier->disableMsgType (CAMERA_MSG_PREVIEW_FRAME);
                 }
             }
-
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-            mDisplayAdapter->setSnapshotTimeRef(&mStartCapture);
-#endif
         }
 
         // if we taking video snapshot...
@@ -2605,20 +2638,12 @@ status_t CameraHal::takePicture( )
             }
         }
 
+    //The shutter time lets ZSL capture pick the frame exposed when
+    //the picture was requested rather than after the buffer setup
     if ( ( NO_ERROR == ret ) && ( NULL != mCameraAdapter ) )
         {
-
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-         //pass capture timestamp along with the camera adapter command
-        ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE,  (int) &mStartCapture);
-
-#else
-
-        ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE);
-
-#endif
-
+        ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE,
+                                          ( int ) &shutterTimestamp);
         }
 
     return ret;
@@ -2662,31 +2687,50 @@ char* CameraHal::getParameters()
 
     if( NULL != mCameraAdapter )
     {
-        mCameraAdapter->getParameters(mParameters);
+        CameraParameters adapterParams;
+
+        // The adapter only reports a handful of live values, merge them
+        // only when they changed or mParameters may have overwritten them
+        mCameraAdapter->getParameters(adapterParams);
+        params_str8 = adapterParams.flatten();
+        if ( ( params_str8 != mAdapterReportedParams ) ||
+             ( mParametersGeneration != mFlattenedParametersGeneration ) )
+        {
+            mergeParameters(mParameters, params_str8);
+            mAdapterReportedParams = params_str8;
+            mParametersGeneration++;
+        }
     }
 
-    CameraParameters mParams = mParameters;
+    if ( mParametersGeneration != mFlattenedParametersGeneration )
+    {
+        CameraParameters mParams = mParameters;
 
-    // Handle RECORDING_HINT to Set/Reset Video Mode Parameters
-    valstr = mParameters.get(CameraParameters::KEY_RECORDING_HINT);
-    if(valstr != NULL)
-      {
-        if(strcmp(valstr, CameraParameters::TRUE) == 0)
+        // Handle RECORDING_HINT to Set/Reset Video Mode Parameters
+        valstr = mParameters.get(CameraParameters::KEY_RECORDING_HINT);
+        if(valstr != NULL)
           {
-            //HACK FOR MMS MODE
-            resetPreviewRes(&mParams, mVideoWidth, mVideoHeight);
+            if(strcmp(valstr, CameraParameters::TRUE) == 0)
+              {
+                //HACK FOR MMS MODE
+                resetPreviewRes(&mParams, mVideoWidth, mVideoHeight);
+              }
           }
-      }
 
-    // do not send internal parameters to upper layers
-    mParams.remove(TICameraParameters::KEY_RECORDING_HINT);
-    mParams.remove(TICameraParameters::KEY_AUTO_FOCUS_LOCK);
+        // do not send internal parameters to upper layers
+        mParams.remove(TICameraParameters::KEY_RECORDING_HINT);
+        mParams.remove(TICameraParameters::KEY_AUTO_FOCUS_LOCK);
 
-    params_str8 = mParams.flatten();
+        mFlattenedParameters = mParams.flatten();
+        mFlattenedParametersGeneration = mParametersGeneration;
+    }
 
     // camera service frees this string...
-    params_string = (char*) malloc(sizeof(char) * (params_str8.length()+1));
-    strcpy(params_string, params_str8.string());
+    params_string = (char*) malloc(sizeof(char) * (mFlattenedParameters.length()+1));
+    if ( NULL != params_string )
+    {
+        memcpy(params_string, mFlattenedParameters.string(), mFlattenedParameters.length()+1);
+    }
 
     LOG_FUNCTION_NAME_EXIT;
 
@@ -2695,6 +2739,34 @@ char* CameraHal::getParameters()
     return params_string;
 }
 
+void CameraHal::mergeParameters(CameraParameters &params, const String8 &flattened)
+{
+    const char *key = flattened.string();
+    const char *value, *next;
+
+    // Same "key=value;key=value" layout CameraParameters::unflatten() parses,
+    // but existing keys that aren't in the flattened string are kept
+    while ( '\0' != *key )
+    {
+        value = strchr(key, '=');
+        if ( NULL == value )
+        {
+            break;
+        }
+        value++;
+
+        next = strchr(value, ';');
+        if ( NULL == next )
+        {
+            params.set(String8(key, value - key - 1).string(), value);
+            break;
+        }
+
+        params.set(String8(key, value - key - 1).string(), String8(value, next - value).string());
+        key = next + 1;
+    }
+}
+
 void CameraHal::putParameters(char *parms)
 {
     free(parms);
@@ -2813,8 +2885,30 @@ void CameraHal::release()
 status_t  CameraHal::dump(int fd) const
 {
     LOG_FUNCTION_NAME;
+
+    if ( NULL != mCameraAdapter )
+        {
+        mCameraAdapter->dump(fd);
+        }
+
+    if ( NULL != mDisplayAdapter.get() )
+        {
+        mDisplayAdapter->dump(fd);
+        }
+
+    CameraFrameStats::dump(fd);
+
+#if CAMHAL_TRACE
+
+    return CameraTrace::dump(fd);
+
+#else
+
     ///Implement this method when the h/w dump function is supported on Ducati side
     return NO_ERROR;
+
+#endif
+
 }
 
 /*-------------Camera Hal Interface Method definitions ENDS here--------------------*/
@@ -2883,14 +2977,9 @@ CameraHal::CameraHal(int cameraId)
     mSensorListener = NULL;
     mVideoWidth = 0;
     mVideoHeight = 0;
-
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //Initialize the CameraHAL constructor timestamp, which is used in the
-    // PPM() method as time reference if the user does not supply one.
-    gettimeofday(&ppm_start, NULL);
-
-#endif
+    mPreviewBufCount = 0;
+    mParametersGeneration = 1;
+    mFlattenedParametersGeneration = 0;
 
     mCameraIndex = cameraId;
 
@@ -3043,6 +3132,8 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
     ///Initialize default parameters
     initDefaultParameters();
 
+    initSupportedValues();
+
 
     if ( setParameters(mParameters) != NO_ERROR )
         {
@@ -3076,126 +3167,109 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
 
 }
 
-bool CameraHal::isResolutionValid(unsigned int width, unsigned int height, const char *supportedResolutions)
+bool CameraHal::isResolutionValid(unsigned int width, unsigned int height, const CameraSupportedValues &supportedResolutions)
 {
-    bool ret = true;
-    status_t status = NO_ERROR;
-    char tmpBuffer[PARAM_BUFFER + 1];
-    char *pos = NULL;
+    bool ret;
 
     LOG_FUNCTION_NAME;
 
-    if ( NULL == supportedResolutions )
-        {
-        CAMHAL_LOGEA("Invalid supported resolutions string");
-        ret = false;
-        goto exit;
-        }
-
-    status = snprintf(tmpBuffer, PARAM_BUFFER, "%dx%d", width, height);
-    if ( 0 > status )
-        {
-        CAMHAL_LOGEA("Error encountered while generating validation string");
-        ret = false;
-        goto exit;
-        }
-
-    pos = strstr(supportedResolutions, tmpBuffer);
-    if ( NULL == pos )
+    if ( supportedResolutions.isEmpty() )
         {
+        CAMHAL_LOGEA("Invalid supported resolutions");
         ret = false;
         }
     else
         {
-        ret = true;
+        ret = supportedResolutions.containsResolution(width, height);
         }
 
-exit:
-
     LOG_FUNCTION_NAME_EXIT;
 
     return ret;
 }
 
-bool CameraHal::isParameterValid(const char *param, const char *supportedParams)
+bool CameraHal::isParameterValid(const char *param, const CameraSupportedValues &supportedParams)
 {
-    bool ret = true;
-    char *pos = NULL;
+    bool ret;
 
     LOG_FUNCTION_NAME;
 
-    if ( NULL == supportedParams )
+    if ( supportedParams.isEmpty() )
         {
-        CAMHAL_LOGEA("Invalid supported parameters string");
+        CAMHAL_LOGEA("Invalid supported parameters");
         ret = false;
-        goto exit;
         }
-
-    if ( NULL == param )
+    else if ( NULL == param )
         {
         CAMHAL_LOGEA("Invalid parameter string");
         ret = false;
-        goto exit;
-        }
-
-    pos = strstr(supportedParams, param);
-    if ( NULL == pos )
-        {
-        ret = false;
         }
     else
         {
-        ret = true;
+        ret = supportedParams.contains(param);
         }
 
-exit:
-
     LOG_FUNCTION_NAME_EXIT;
 
     return ret;
 }
 
-bool CameraHal::isParameterValid(int param, const char *supportedParams)
+bool CameraHal::isParameterValid(int param, const CameraSupportedValues &supportedParams)
 {
-    bool ret = true;
-    char *pos = NULL;
-    status_t status;
-    char tmpBuffer[PARAM_BUFFER + 1];
+    bool ret;
 
     LOG_FUNCTION_NAME;
 
-    if ( NULL == supportedParams )
-        {
-        CAMHAL_LOGEA("Invalid supported parameters string");
-        ret = false;
-        goto exit;
-        }
-
-    status = snprintf(tmpBuffer, PARAM_BUFFER, "%d", param);
-    if ( 0 > status )
-        {
-        CAMHAL_LOGEA("Error encountered while generating validation string");
-        ret = false;
-        goto exit;
-        }
-
-    pos = strstr(supportedParams, tmpBuffer);
-    if ( NULL == pos )
+    if ( supportedParams.isEmpty() )
         {
+        CAMHAL_LOGEA("Invalid supported parameters");
         ret = false;
         }
     else
         {
-        ret = true;
+        ret = supportedParams.contains(param);
         }
 
-exit:
-
     LOG_FUNCTION_NAME_EXIT;
 
     return ret;
 }
 
+void CameraHal::initSupportedValues()
+{
+    LOG_FUNCTION_NAME;
+
+    ///The supported values don't change for the lifetime of the camera
+    ///instance, so the capability strings get tokenized only once here
+    mSupportedPreviewFormats.parse(mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FORMATS));
+    mSupportedIPPModes.parse(mCameraProperties->get(CameraProperties::SUPPORTED_IPP_MODES));
+    mSupportedPreviewSizes.parse(mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIZES));
+    mSupportedFocusModes.parse(mCameraProperties->get(CameraProperties::SUPPORTED_FOCUS_MODES));
+    mSupportedPictureFormats.parse(mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_FORMATS));
+    mSupportedPictureSizes.parse(mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SIZES));
+    mSupportedFramerateRanges.parse(mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_SUPPORTED));
+    mSupportedFramerates.parse(mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FRAME_RATES));
+    mSupportedExposureModes.parse(mCameraProperties->get(CameraProperties::SUPPORTED_EXPOSURE_MODES));
+    mSupportedWhiteBalance.parse(mCameraProperties->get(CameraProperties::SUPPORTED_WHITE_BALANCE));
+    mSupportedAntibanding.parse(mCameraProperties->get(CameraProperties::SUPPORTED_ANTIBANDING));
+    mSupportedISOValues.parse(mCameraProperties->get(CameraProperties::SUPPORTED_ISO_VALUES));
+    mSupportedSceneModes.parse(mCameraProperties->get(CameraProperties::SUPPORTED_SCENE_MODES));
+    mSupportedFlashModes.parse(mCameraProperties->get(CameraProperties::SUPPORTED_FLASH_MODES));
+    mSupportedEffects.parse(mCameraProperties->get(CameraProperties::SUPPORTED_EFFECTS));
+
+    //The default range is sent back with every setParameters call,
+    //the camera can't be configured at all if it doesn't validate
+    if ( !isParameterValid(mCameraProperties->get(CameraProperties::FRAMERATE_RANGE),
+                           mSupportedFramerateRanges) )
+        {
+        CAMHAL_LOGEB("Default frame rate range %s not in supported ranges %s",
+                     mCameraProperties->get(CameraProperties::FRAMERATE_RANGE),
+                     mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_SUPPORTED));
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
 status_t CameraHal::doesSetParameterNeedUpdate(const char* new_param, const char* old_param, bool& update) {
     if (!new_param || !old_param) {
         return -EINVAL;
@@ -3549,9 +3623,42 @@ void CameraHal::setPreferredPreviewRes(int width, int height)
     mParameters.setPreviewSize(704,576);
   }
 
+  mParametersGeneration++;
+
   LOG_FUNCTION_NAME_EXIT;
 }
 
+/**
+   @brief Updates the display adapter with the current CPU usage of preview buffers
+
+   Preview buffers are locked through gralloc for every frame only while some
+   CPU consumer reads them: preview/postview callbacks or the software video
+   scaler used when video and preview resolutions differ.
+
+   @param none
+   @return none
+
+ */
+void CameraHal::updateDisplayCpuAccess()
+{
+    bool cpuAccess;
+
+    LOG_FUNCTION_NAME;
+
+    if ( NULL == mDisplayAdapter.get() )
+        {
+        LOG_FUNCTION_NAME_EXIT;
+        return;
+        }
+
+    cpuAccess = ( mMsgEnabled & ( CAMERA_MSG_PREVIEW_FRAME | CAMERA_MSG_POSTVIEW_FRAME ) ) ||
+                ( mRecordingEnabled && mAppCallbackNotifier->getUesVideoBuffers() );
+
+    mDisplayAdapter->setCpuAccess(cpuAccess);
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
 void CameraHal::resetPreviewRes(CameraParameters *mParams, int width, int height)
 {
   LOG_FUNCTION_NAME;
@@ -24,6 +24,8 @@
 #define LOG_TAG "CameraHAL"
 
 
+#include <math.h>
+
 #include "CameraHal.h"
 
 namespace android {
@@ -62,6 +64,16 @@ int FrameProvider::disableFrameNotification(int32_t frameTypes)
 int FrameProvider::returnFrame(void *frameBuf, CameraFrame::FrameType frameType)
 {
     status_t ret = NO_ERROR;
+    CameraFrameStats::Consumer consumer = mConsumer;
+
+    //Recording frames are handed back by the video encoder, not by the application callbacks
+    if ( ( CameraFrameStats::CONSUMER_APP_CALLBACKS == consumer ) &&
+         ( CameraFrame::VIDEO_FRAME_SYNC == frameType ) )
+        {
+        consumer = CameraFrameStats::CONSUMER_VIDEO_ENCODER;
+        }
+
+    CameraFrameStats::frameReturned(frameBuf, frameType, consumer);
 
     mFrameNotifier->returnFrame(frameBuf, frameType);
 
@@ -359,4 +371,574 @@ bool CameraArea::compare(const sp<CameraArea> &area) {
 
 /*--------------------CameraArea Class ENDS here-----------------------------*/
 
+/*--------------------CameraSupportedValues Class STARTS here-----------------------------*/
+
+void CameraSupportedValues::clear()
+{
+    mValues.clear();
+    mIntValues.clear();
+    mResolutions.clear();
+}
+
+status_t CameraSupportedValues::parse(const char *supported)
+{
+    const char *start, *pos;
+    int depth = 0;
+    char *end;
+    unsigned int width, height;
+    long intVal;
+
+    LOG_FUNCTION_NAME;
+
+    clear();
+
+    if ( NULL == supported )
+        {
+        CAMHAL_LOGEA("Invalid supported values string");
+        LOG_FUNCTION_NAME_EXIT;
+        return -EINVAL;
+        }
+
+    start = pos = supported;
+    while ( true )
+        {
+        if ( '(' == *pos )
+            {
+            depth++;
+            }
+        else if ( ( ')' == *pos ) && ( 0 < depth ) )
+            {
+            depth--;
+            }
+        else if ( ( ( ',' == *pos ) && ( 0 == depth ) ) || ( '\0' == *pos ) )
+            {
+            if ( pos > start )
+                {
+                const char *tokenStart = start;
+                size_t tokenLength = pos - start;
+
+                //"(min,max)" ranges are matched against "min,max" values
+                if ( ( 2 <= tokenLength ) &&
+                     ( '(' == tokenStart[0] ) &&
+                     ( ')' == tokenStart[tokenLength - 1] ) )
+                    {
+                    tokenStart++;
+                    tokenLength -= 2;
+                    }
+
+                String8 token(tokenStart, tokenLength);
+                mValues.add(token);
+
+                intVal = strtol(token.string(), &end, 10);
+                if ( ( end != token.string() ) && ( '\0' == *end ) )
+                    {
+                    mIntValues.add(( int ) intVal);
+                    }
+
+                if ( 2 == sscanf(token.string(), "%ux%u", &width, &height) )
+                    {
+                    mResolutions.add(packResolution(width, height));
+                    }
+                }
+
+            if ( '\0' == *pos )
+                {
+                break;
+                }
+
+            start = pos + 1;
+            }
+
+        pos++;
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+bool CameraSupportedValues::contains(const char *value) const
+{
+    if ( NULL == value )
+        {
+        return false;
+        }
+
+    return ( 0 <= mValues.indexOf(String8(value)) );
+}
+
+bool CameraSupportedValues::contains(int value) const
+{
+    return ( 0 <= mIntValues.indexOf(value) );
+}
+
+bool CameraSupportedValues::containsResolution(unsigned int width, unsigned int height) const
+{
+    return ( 0 <= mResolutions.indexOf(packResolution(width, height)) );
+}
+
+/*--------------------CameraSupportedValues Class ENDS here-----------------------------*/
+
+/*--------------------CameraParameterChanges Class STARTS here-----------------------------*/
+
+bool CameraParameterChanges::changed(const char *key) const
+{
+    const char *valstr, *oldstr;
+
+    if ( mAll )
+        {
+        return true;
+        }
+
+    valstr = mParams.get(key);
+    oldstr = mOldParams.get(key);
+
+    if ( ( NULL == valstr ) || ( NULL == oldstr ) )
+        {
+        return ( valstr != oldstr );
+        }
+
+    return ( 0 != strcmp(valstr, oldstr) );
+}
+
+/*--------------------CameraParameterChanges Class ENDS here-----------------------------*/
+
+/*--------------------CameraHistogram Class STARTS here-----------------------------*/
+
+static inline unsigned int histogramBucket(uint32_t us)
+{
+    unsigned int msb;
+
+    if ( 8 > us )
+        {
+        return us;
+        }
+
+    msb = 31 - __builtin_clz(us);
+
+    return ( msb - 2 ) * 8 + ( ( us >> ( msb - 3 ) ) & 0x7 );
+}
+
+static inline uint32_t histogramBucketMiddle(unsigned int bucket)
+{
+    unsigned int shift;
+
+    if ( 8 > bucket )
+        {
+        return bucket;
+        }
+
+    shift = bucket / 8 - 1;
+
+    return ( ( 8 + ( bucket % 8 ) ) << shift ) + ( ( 1 << shift ) / 2 );
+}
+
+void CameraHistogram::reset()
+{
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mMax = 0;
+}
+
+void CameraHistogram::add(nsecs_t value)
+{
+    nsecs_t us = ns2us(value);
+
+    if ( 0 > us )
+        {
+        return;
+        }
+
+    if ( 0xFFFFFFFF < us )
+        {
+        us = 0xFFFFFFFF;
+        }
+
+    mBuckets[histogramBucket(( uint32_t ) us)]++;
+    mCount++;
+    if ( value > mMax )
+        {
+        mMax = value;
+        }
+}
+
+nsecs_t CameraHistogram::percentile(unsigned int pct) const
+{
+    uint32_t target, sum = 0;
+    nsecs_t value;
+
+    if ( 0 == mCount )
+        {
+        return 0;
+        }
+
+    target = ( mCount * pct + 99 ) / 100;
+    for ( unsigned int i = 0 ; i < BUCKET_COUNT ; i++ )
+        {
+        sum += mBuckets[i];
+        if ( sum >= target )
+            {
+            value = us2ns(histogramBucketMiddle(i));
+            return ( value < mMax ) ? value : mMax;
+            }
+        }
+
+    return mMax;
+}
+
+/*--------------------CameraHistogram Class ENDS here-----------------------------*/
+
+/*--------------------CameraFrameStats Class STARTS here-----------------------------*/
+
+static const char *gFrameStageNames[CameraFrame::STAGE_MAX] =
+{
+    "filled",
+    "dispatch",
+    "display",
+    "preview callback",
+    "video callback",
+};
+
+static const char *gFrameConsumerNames[CameraFrameStats::CONSUMER_MAX] =
+{
+    "display",
+    "video encoder",
+    "app callbacks",
+};
+
+Mutex CameraFrameStats::sLock;
+CameraHistogram CameraFrameStats::sLatency[CameraFrame::STAGE_MAX];
+CameraHistogram CameraFrameStats::sHoldTime[CameraFrameStats::CONSUMER_MAX];
+KeyedVector<uint64_t, nsecs_t> CameraFrameStats::sDispatchTimes;
+
+void CameraFrameStats::frameReached(CameraFrame *frame, CameraFrame::FrameStage stage)
+{
+    CameraFrame::FrameStage from;
+    nsecs_t now;
+
+    if ( ( NULL == frame ) || ( CameraFrame::STAGE_MAX <= stage ) )
+        {
+        return;
+        }
+
+    now = systemTime(SYSTEM_TIME_MONOTONIC);
+    frame->mStamps[stage] = now;
+
+    if ( CameraFrame::STAGE_FILLED == stage )
+        {
+        return;
+        }
+
+    //Consumers are measured from the dispatch, the dispatch from the fill
+    from = ( CameraFrame::STAGE_DISPATCHED == stage ) ? CameraFrame::STAGE_FILLED : CameraFrame::STAGE_DISPATCHED;
+    if ( 0 == frame->mStamps[from] )
+        {
+        return;
+        }
+
+    Mutex::Autolock lock(sLock);
+    sLatency[stage].add(now - frame->mStamps[from]);
+}
+
+void CameraFrameStats::frameDispatched(void *frameBuf, int frameType)
+{
+    uint64_t key = ( ( uint64_t ) ( uint32_t ) frameBuf << 32 ) | ( uint32_t ) frameType;
+
+    Mutex::Autolock lock(sLock);
+    sDispatchTimes.replaceValueFor(key, systemTime(SYSTEM_TIME_MONOTONIC));
+}
+
+void CameraFrameStats::frameReturned(void *frameBuf, int frameType, Consumer consumer)
+{
+    uint64_t key = ( ( uint64_t ) ( uint32_t ) frameBuf << 32 ) | ( uint32_t ) frameType;
+    ssize_t index;
+
+    if ( CONSUMER_MAX <= consumer )
+        {
+        return;
+        }
+
+    Mutex::Autolock lock(sLock);
+    index = sDispatchTimes.indexOfKey(key);
+    if ( 0 <= index )
+        {
+        sHoldTime[consumer].add(systemTime(SYSTEM_TIME_MONOTONIC) - sDispatchTimes.valueAt(index));
+        }
+}
+
+void CameraFrameStats::reset()
+{
+    Mutex::Autolock lock(sLock);
+
+    for ( unsigned int i = 0 ; i < CameraFrame::STAGE_MAX ; i++ )
+        {
+        sLatency[i].reset();
+        }
+
+    for ( unsigned int i = 0 ; i < CONSUMER_MAX ; i++ )
+        {
+        sHoldTime[i].reset();
+        }
+
+    sDispatchTimes.clear();
+}
+
+int CameraFrameStats::format(char *buffer, size_t size, const char *name, const CameraHistogram &histogram)
+{
+    return snprintf(buffer, size,
+                    "%-16s n=%u p50=%.2fms p95=%.2fms p99=%.2fms max=%.2fms",
+                    name,
+                    histogram.count(),
+                    ns2us(histogram.percentile(50)) / 1000.0,
+                    ns2us(histogram.percentile(95)) / 1000.0,
+                    ns2us(histogram.percentile(99)) / 1000.0,
+                    ns2us(histogram.max()) / 1000.0);
+}
+
+void CameraFrameStats::log()
+{
+    char buffer[128];
+
+    Mutex::Autolock lock(sLock);
+
+    for ( unsigned int i = CameraFrame::STAGE_DISPATCHED ; i < CameraFrame::STAGE_MAX ; i++ )
+        {
+        if ( 0 < sLatency[i].count() )
+            {
+            format(buffer, sizeof(buffer), gFrameStageNames[i], sLatency[i]);
+            CAMHAL_LOGI("Frame latency %s", buffer);
+            }
+        }
+
+    for ( unsigned int i = 0 ; i < CONSUMER_MAX ; i++ )
+        {
+        if ( 0 < sHoldTime[i].count() )
+            {
+            format(buffer, sizeof(buffer), gFrameConsumerNames[i], sHoldTime[i]);
+            CAMHAL_LOGI("Buffer hold %s", buffer);
+            }
+        }
+}
+
+status_t CameraFrameStats::dump(int fd)
+{
+    char buffer[128];
+    int len;
+
+    if ( 0 > fd )
+        {
+        return -EINVAL;
+        }
+
+    Mutex::Autolock lock(sLock);
+
+    len = snprintf(buffer, sizeof(buffer), "Frame latency per stage:\n");
+    write(fd, buffer, len);
+    for ( unsigned int i = CameraFrame::STAGE_DISPATCHED ; i < CameraFrame::STAGE_MAX ; i++ )
+        {
+        len = format(buffer, sizeof(buffer), gFrameStageNames[i], sLatency[i]);
+        write(fd, buffer, len);
+        write(fd, "\n", 1);
+        }
+
+    len = snprintf(buffer, sizeof(buffer), "Buffer hold time per consumer:\n");
+    write(fd, buffer, len);
+    for ( unsigned int i = 0 ; i < CONSUMER_MAX ; i++ )
+        {
+        len = format(buffer, sizeof(buffer), gFrameConsumerNames[i], sHoldTime[i]);
+        write(fd, buffer, len);
+        write(fd, "\n", 1);
+        }
+
+    return NO_ERROR;
+}
+
+/*--------------------CameraFrameStats Class ENDS here-----------------------------*/
+
+/*--------------------CameraFpsStats Class STARTS here-----------------------------*/
+
+CameraFpsStats::CameraFpsStats(const char *name) :
+    mName(name),
+    mMinFps(0),
+    mMaxFps(0),
+    mReportPeriod(0)
+{
+    reset();
+}
+
+void CameraFpsStats::reset()
+{
+    Mutex::Autolock lock(mLock);
+
+    mIntervals.reset();
+    mFrames = 0;
+    mDropped = 0;
+    mFirstTimestamp = 0;
+    mLastTimestamp = 0;
+    mLastInterval = 0;
+    mLastReport = 0;
+    mJitter = 0;
+    mIntervalMean = 0;
+    mIntervalM2 = 0;
+}
+
+void CameraFpsStats::setExpectedRange(unsigned int minFps, unsigned int maxFps)
+{
+    Mutex::Autolock lock(mLock);
+
+    mMinFps = minFps;
+    mMaxFps = maxFps;
+}
+
+void CameraFpsStats::setReportPeriod(nsecs_t period)
+{
+    Mutex::Autolock lock(mLock);
+
+    mReportPeriod = period;
+}
+
+void CameraFpsStats::frame(nsecs_t timestamp)
+{
+    char buffer[256];
+    nsecs_t interval, slowest;
+    double delta;
+
+    Mutex::Autolock lock(mLock);
+
+    mFrames++;
+    if ( 1 == mFrames )
+        {
+        mFirstTimestamp = timestamp;
+        mLastTimestamp = timestamp;
+        mLastReport = timestamp;
+        return;
+        }
+
+    interval = timestamp - mLastTimestamp;
+    mLastTimestamp = timestamp;
+    if ( 0 >= interval )
+        {
+        return;
+        }
+
+    mIntervals.add(interval);
+
+    delta = ( double ) interval - mIntervalMean;
+    mIntervalMean += delta / ( mFrames - 1 );
+    mIntervalM2 += delta * ( ( double ) interval - mIntervalMean );
+
+    if ( 0 != mLastInterval )
+        {
+        delta = ( double ) ( interval - mLastInterval );
+        mJitter += ( ( ( 0 > delta ) ? -delta : delta ) - mJitter ) / 16;
+        }
+    mLastInterval = interval;
+
+    //Anything late by more than half a frame at the slowest configured
+    //rate means the sensor missed some frames
+    if ( 0 != mMinFps )
+        {
+        slowest = s2ns(1) / mMinFps;
+        if ( interval > ( slowest + slowest / 2 ) )
+            {
+            mDropped += ( interval + slowest / 2 ) / slowest - 1;
+            }
+        }
+
+    if ( ( 0 != mReportPeriod ) && ( ( timestamp - mLastReport ) >= mReportPeriod ) )
+        {
+        format(buffer, sizeof(buffer));
+        CAMHAL_LOGI("%s", buffer);
+        mLastReport = timestamp;
+        }
+}
+
+float CameraFpsStats::getFps() const
+{
+    Mutex::Autolock lock(mLock);
+
+    if ( ( 2 > mFrames ) || ( mLastTimestamp <= mFirstTimestamp ) )
+        {
+        return 0.0f;
+        }
+
+    return ( ( mFrames - 1 ) * float(s2ns(1)) ) / ( mLastTimestamp - mFirstTimestamp );
+}
+
+int CameraFpsStats::format(char *buffer, size_t size) const
+{
+    float average = 0.0f, current = 0.0f;
+    double deviation = 0;
+
+    if ( ( 1 < mFrames ) && ( mLastTimestamp > mFirstTimestamp ) )
+        {
+        average = ( ( mFrames - 1 ) * float(s2ns(1)) ) / ( mLastTimestamp - mFirstTimestamp );
+        }
+
+    if ( 0 != mLastInterval )
+        {
+        current = float(s2ns(1)) / mLastInterval;
+        }
+
+    if ( 2 < mFrames )
+        {
+        deviation = sqrt(mIntervalM2 / ( mFrames - 2 ));
+        }
+
+    return snprintf(buffer, size,
+                    "%s: %u frames, %.2f fps (current %.2f), interval p50=%.2fms p95=%.2fms "
+                    "p99=%.2fms max=%.2fms stddev=%.2fms jitter=%.2fms, dropped %u (range %u-%u fps)",
+                    mName,
+                    mFrames,
+                    average,
+                    current,
+                    ns2us(mIntervals.percentile(50)) / 1000.0,
+                    ns2us(mIntervals.percentile(95)) / 1000.0,
+                    ns2us(mIntervals.percentile(99)) / 1000.0,
+                    ns2us(mIntervals.max()) / 1000.0,
+                    deviation / 1000000.0,
+                    mJitter / 1000000.0,
+                    mDropped,
+                    mMinFps,
+                    mMaxFps);
+}
+
+void CameraFpsStats::log() const
+{
+    char buffer[256];
+
+    Mutex::Autolock lock(mLock);
+
+    if ( 0 < mFrames )
+        {
+        format(buffer, sizeof(buffer));
+        CAMHAL_LOGI("%s", buffer);
+        }
+}
+
+status_t CameraFpsStats::dump(int fd) const
+{
+    char buffer[256];
+    int len;
+
+    if ( 0 > fd )
+        {
+        return -EINVAL;
+        }
+
+    Mutex::Autolock lock(mLock);
+
+    len = format(buffer, sizeof(buffer));
+    if ( ( int ) sizeof(buffer) <= len )
+        {
+        len = sizeof(buffer) - 1;
+        }
+    write(fd, buffer, len);
+    write(fd, "\n", 1);
+
+    return NO_ERROR;
+}
+
+/*--------------------CameraFpsStats Class ENDS here-----------------------------*/
+
 };
@@ -171,6 +171,11 @@ void CameraProperties::Properties::dump()
     }
 }
 
+size_t CameraProperties::Properties::size() const
+{
+    return mProperties->size();
+}
+
 const char* CameraProperties::Properties::keyAt(unsigned int index)
 {
     if(index < mProperties->size())
@@ -23,6 +23,12 @@
 
 //#include "CameraHal.h"
 #include <utils/threads.h>
+#include <cutils/properties.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "DebugUtils.h"
 #include "CameraProperties.h"
@@ -30,6 +36,8 @@
 #define CAMERA_ROOT         "CameraRoot"
 #define CAMERA_INSTANCE     "CameraInstance"
 
+#define CAPS_CACHE_MAGIC    0x50414343 //"CCAP"
+
 namespace android {
 
 // lower entries have higher priority
@@ -96,6 +104,12 @@ status_t CameraProperties::loadProperties()
 
     status_t ret = NO_ERROR;
 
+    if ( NO_ERROR == loadCachedProperties() ) {
+        ALOGV("Camera capabilities loaded from %s", CAMERA_CAPS_CACHE_FILE);
+        LOG_FUNCTION_NAME_EXIT;
+        return NO_ERROR;
+    }
+
     // adapter updates capabilities and we update camera count
     mCamerasSupported = CameraAdapter_Capabilities(mCameraProps, mCamerasSupported, MAX_CAMERAS_SUPPORTED);
 
@@ -112,6 +126,10 @@ status_t CameraProperties::loadProperties()
             mCameraProps[i].set(CAMERA_SENSOR_INDEX, i);
             mCameraProps[i].dump();
         }
+
+        if ( 0 < mCamerasSupported ) {
+            storeCachedProperties();
+        }
     }
 
     ALOGV("mCamerasSupported = %d", mCamerasSupported);
@@ -119,6 +137,237 @@ status_t CameraProperties::loadProperties()
     return ret;
 }
 
+///Identifies the remote core firmware image and the system build the
+///capabilities were queried with. System images ship with fixed file
+///times, so an update replacing the HAL or a firmware of the same size
+///is only told apart by the build fingerprint.
+status_t CameraProperties::getFirmwareId(uint32_t &size, uint32_t &mtime, char *fingerprint)
+{
+    struct stat fwStat;
+
+    if ( 0 != stat(CAMERA_FIRMWARE_FILE, &fwStat) ) {
+        ALOGV("Unable to stat %s: %s", CAMERA_FIRMWARE_FILE, strerror(errno));
+        return NAME_NOT_FOUND;
+    }
+
+    if ( 0 >= property_get("ro.build.fingerprint", fingerprint, NULL) ) {
+        ALOGV("No build fingerprint, not caching camera capabilities");
+        return NAME_NOT_FOUND;
+    }
+
+    size = ( uint32_t ) fwStat.st_size;
+    mtime = ( uint32_t ) fwStat.st_mtime;
+
+    return NO_ERROR;
+}
+
+static bool readCacheWord(const uint8_t *&pos, const uint8_t *end, uint32_t &word)
+{
+    if ( ( end - pos ) < ( ssize_t ) sizeof(word) ) {
+        return false;
+    }
+
+    memcpy(&word, pos, sizeof(word));
+    pos += sizeof(word);
+
+    return true;
+}
+
+static bool readCacheString(const uint8_t *&pos, const uint8_t *end, const char *&str)
+{
+    uint32_t length;
+
+    //Strings are stored with their length followed by the NULL terminated data
+    if ( !readCacheWord(pos, end, length) ||
+         ( ( uint32_t ) ( end - pos ) <= length ) ||
+         ( '\0' != pos[length] ) ) {
+        return false;
+    }
+
+    str = ( const char * ) pos;
+    pos += length + 1;
+
+    return true;
+}
+
+static bool writeCacheWord(FILE *file, uint32_t word)
+{
+    return ( 1 == fwrite(&word, sizeof(word), 1, file) );
+}
+
+static bool writeCacheString(FILE *file, const char *str)
+{
+    uint32_t length = strlen(str);
+
+    return writeCacheWord(file, length) &&
+           ( 1 == fwrite(str, length + 1, 1, file) );
+}
+
+///Loads the capabilities stored by storeCachedProperties(), provided they
+///were generated for the firmware image currently installed
+status_t CameraProperties::loadCachedProperties()
+{
+    status_t ret = NO_ERROR;
+    struct stat cacheStat;
+    uint32_t fwSize, fwMtime, word, cameraCount, entryCount, touched = 0;
+    char fingerprint[PROPERTY_VALUE_MAX];
+    const uint8_t *data = NULL, *pos, *end;
+    const char *key, *value, *str, *name;
+    int fd;
+
+    LOG_FUNCTION_NAME;
+
+    if ( NO_ERROR != getFirmwareId(fwSize, fwMtime, fingerprint) ) {
+        LOG_FUNCTION_NAME_EXIT;
+        return NAME_NOT_FOUND;
+    }
+
+    fd = open(CAMERA_CAPS_CACHE_FILE, O_RDONLY);
+    if ( 0 > fd ) {
+        LOG_FUNCTION_NAME_EXIT;
+        return NAME_NOT_FOUND;
+    }
+
+    if ( ( 0 != fstat(fd, &cacheStat) ) || ( 0 >= cacheStat.st_size ) ) {
+        close(fd);
+        LOG_FUNCTION_NAME_EXIT;
+        return NAME_NOT_FOUND;
+    }
+
+    data = ( const uint8_t * ) mmap(NULL, cacheStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( MAP_FAILED == data ) {
+        ALOGE("Unable to map %s: %s", CAMERA_CAPS_CACHE_FILE, strerror(errno));
+        LOG_FUNCTION_NAME_EXIT;
+        return NO_MEMORY;
+    }
+
+    pos = data;
+    end = data + cacheStat.st_size;
+
+    if ( !readCacheWord(pos, end, word) || ( CAPS_CACHE_MAGIC != word ) ||
+         !readCacheWord(pos, end, word) || ( CAMERA_CAPS_CACHE_VERSION != word ) ||
+         !readCacheWord(pos, end, word) || ( fwSize != word ) ||
+         !readCacheWord(pos, end, word) || ( fwMtime != word ) ||
+         !readCacheString(pos, end, str) || ( 0 != strcmp(fingerprint, str) ) ||
+         !readCacheWord(pos, end, cameraCount) ||
+         ( 0 == cameraCount ) || ( MAX_CAMERAS_SUPPORTED < cameraCount ) ) {
+        ALOGV("Camera capabilities cache is stale");
+        ret = BAD_VALUE;
+    }
+
+    for ( uint32_t i = 0 ; ( NO_ERROR == ret ) && ( i < cameraCount ) ; i++ ) {
+        //Records are keyed by sensor index and must be stored in order,
+        //each one led by the name of the sensor it describes
+        if ( !readCacheWord(pos, end, word) || ( i != word ) ||
+             !readCacheString(pos, end, name) || ( '\0' == name[0] ) ||
+             !readCacheWord(pos, end, entryCount) ) {
+            ret = BAD_VALUE;
+            break;
+        }
+
+        touched = i + 1;
+        for ( uint32_t j = 0 ; j < entryCount ; j++ ) {
+            if ( !readCacheString(pos, end, key) ||
+                 !readCacheString(pos, end, value) ) {
+                ret = BAD_VALUE;
+                break;
+            }
+
+            mCameraProps[i].set(key, value);
+        }
+
+        //The record has to describe the sensor its header names
+        if ( ( NO_ERROR == ret ) &&
+             ( ( 0 != strcmp(name, mCameraProps[i].get(CameraProperties::CAMERA_NAME)) ) ||
+               ( ( int ) i != atoi(mCameraProps[i].get(CameraProperties::CAMERA_SENSOR_INDEX)) ) ) ) {
+            ret = BAD_VALUE;
+        }
+    }
+
+    munmap(( void * ) data, cacheStat.st_size);
+
+    if ( NO_ERROR == ret ) {
+        mCamerasSupported = cameraCount;
+    } else {
+        //Records read before the bad one must not leak into the
+        //capabilities queried instead
+        for ( uint32_t i = 0 ; i < touched ; i++ ) {
+            mCameraProps[i].reset();
+        }
+        ALOGE("Ignoring invalid camera capabilities cache");
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+status_t CameraProperties::storeCachedProperties()
+{
+    static bool cacheDirReported = false;
+    char tmpPath[PATH_MAX];
+    char fingerprint[PROPERTY_VALUE_MAX];
+    uint32_t fwSize, fwMtime;
+    bool success;
+    FILE *file;
+
+    LOG_FUNCTION_NAME;
+
+    if ( NO_ERROR != getFirmwareId(fwSize, fwMtime, fingerprint) ) {
+        LOG_FUNCTION_NAME_EXIT;
+        return NAME_NOT_FOUND;
+    }
+
+    //Write to a temporary file first, so that a reader never sees
+    //a partially written cache
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", CAMERA_CAPS_CACHE_FILE);
+    file = fopen(tmpPath, "wb");
+    if ( NULL == file ) {
+        //Not an error, builds without a writable cache directory
+        //just query the capabilities on every start
+        if ( !cacheDirReported ) {
+            ALOGD("Not caching camera capabilities, %s: %s", tmpPath, strerror(errno));
+            cacheDirReported = true;
+        }
+        LOG_FUNCTION_NAME_EXIT;
+        return UNKNOWN_ERROR;
+    }
+
+    success = writeCacheWord(file, CAPS_CACHE_MAGIC) &&
+              writeCacheWord(file, CAMERA_CAPS_CACHE_VERSION) &&
+              writeCacheWord(file, fwSize) &&
+              writeCacheWord(file, fwMtime) &&
+              writeCacheString(file, fingerprint) &&
+              writeCacheWord(file, mCamerasSupported);
+
+    for ( uint32_t i = 0 ; success && ( i < mCamerasSupported ) ; i++ ) {
+        success = writeCacheWord(file, i) &&
+                  writeCacheString(file, mCameraProps[i].get(CameraProperties::CAMERA_NAME)) &&
+                  writeCacheWord(file, mCameraProps[i].size());
+
+        for ( unsigned int j = 0 ; success && ( j < mCameraProps[i].size() ) ; j++ ) {
+            success = writeCacheString(file, mCameraProps[i].keyAt(j)) &&
+                      writeCacheString(file, mCameraProps[i].valueAt(j));
+        }
+    }
+
+    if ( 0 != fclose(file) ) {
+        success = false;
+    }
+
+    if ( !success || ( 0 != rename(tmpPath, CAMERA_CAPS_CACHE_FILE) ) ) {
+        ALOGE("Unable to store camera capabilities cache: %s", strerror(errno));
+        unlink(tmpPath);
+        LOG_FUNCTION_NAME_EXIT;
+        return UNKNOWN_ERROR;
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
 // Returns the number of Cameras found
 int CameraProperties::camerasSupported()
 {
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraTrace.cpp
+*
+* Per-thread binary trace rings and their Chrome trace JSON export.
+*
+*/
+
+#define LOG_TAG "CameraHAL"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include "CameraTrace.h"
+
+namespace android {
+
+///Chrome trace description of each event. Start/end pairs share a name and
+///an id, so that they show up as one async slice spanning threads.
+struct CameraTraceEventInfo
+{
+    const char *name;
+    char phase;
+    int id;
+};
+
+static const CameraTraceEventInfo gTraceEvents[CameraTrace::EVENT_MAX] =
+{
+    { "preview startup", 'b', 1 },  // PREVIEW_START
+    { "preview startup", 'e', 1 },  // PREVIEW_FIRST_FRAME
+    { "focus", 'b', 2 },            // FOCUS_START
+    { "focus", 'e', 2 },            // FOCUS_DONE
+    { "shot to jpeg", 'b', 3 },     // CAPTURE_START
+    { "snapshot", 'i', 0 },         // CAPTURE_SNAPSHOT
+    { "shot to shot", 'i', 0 },     // CAPTURE_PREVIEW_RESUMED
+    { "shot to jpeg", 'e', 3 },     // CAPTURE_JPEG
+};
+
+pthread_once_t CameraTrace::sKeyOnce = PTHREAD_ONCE_INIT;
+pthread_key_t CameraTrace::sRingKey;
+Mutex CameraTrace::sRingsLock;
+CameraTrace::Ring *CameraTrace::sRings = NULL;
+
+void CameraTrace::createKey()
+{
+    pthread_key_create(&sRingKey, releaseRing);
+}
+
+void CameraTrace::releaseRing(void *ring)
+{
+    Mutex::Autolock lock(sRingsLock);
+
+    //Keep the records around for dumping, the ring is only
+    //handed over to the next thread which needs one
+    ( ( Ring * ) ring )->mInUse = false;
+}
+
+CameraTrace::Ring *CameraTrace::getRing()
+{
+    Ring *ring;
+
+    pthread_once(&sKeyOnce, createKey);
+
+    ring = ( Ring * ) pthread_getspecific(sRingKey);
+    if ( NULL != ring )
+        {
+        return ring;
+        }
+
+    Mutex::Autolock lock(sRingsLock);
+
+    for ( ring = sRings ; NULL != ring ; ring = ring->mNext )
+        {
+        if ( !ring->mInUse )
+            {
+            break;
+            }
+        }
+
+    if ( NULL == ring )
+        {
+        ring = new Ring;
+        if ( NULL == ring )
+            {
+            return NULL;
+            }
+
+        ring->mHead = 0;
+        ring->mNext = sRings;
+        sRings = ring;
+        }
+
+    //A recycled ring keeps counting from its head, so the records of
+    //the thread which owned it before stay until they get overwritten
+    ring->mTid = gettid();
+    ring->mInUse = true;
+    pthread_setspecific(sRingKey, ring);
+
+    return ring;
+}
+
+void CameraTrace::record(Event event, uint32_t frameId, uint32_t arg0, uint32_t arg1)
+{
+    Ring *ring = getRing();
+    Record *rec;
+    uint32_t head;
+
+    if ( NULL == ring )
+        {
+        return;
+        }
+
+    head = ring->mHead;
+    rec = &ring->mRecords[head % RING_SIZE];
+    rec->mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    rec->mTid = ring->mTid;
+    rec->mEvent = event;
+    rec->mFrameId = frameId;
+    rec->mArg0 = arg0;
+    rec->mArg1 = arg1;
+
+    //Make the record visible before it gets published
+    __sync_synchronize();
+    ring->mHead = head + 1;
+}
+
+status_t CameraTrace::dump(int fd)
+{
+    char buffer[256];
+    const CameraTraceEventInfo *info;
+    const Record *rec;
+    uint32_t head, first;
+    bool separator = false;
+    int len;
+
+    if ( 0 > fd )
+        {
+        return -EINVAL;
+        }
+
+    len = snprintf(buffer, sizeof(buffer), "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    write(fd, buffer, len);
+
+    Mutex::Autolock lock(sRingsLock);
+
+    for ( Ring *ring = sRings ; NULL != ring ; ring = ring->mNext )
+        {
+        //Writers don't stop while the ring is walked, a record being
+        //overwritten at the same time can come out torn
+        head = ring->mHead;
+        first = ( head > RING_SIZE ) ? ( head - RING_SIZE ) : 0;
+
+        for ( uint32_t i = first ; i < head ; i++ )
+            {
+            rec = &ring->mRecords[i % RING_SIZE];
+            if ( EVENT_MAX <= rec->mEvent )
+                {
+                continue;
+                }
+
+            info = &gTraceEvents[rec->mEvent];
+            len = snprintf(buffer, sizeof(buffer),
+                           "%s{\"name\":\"%s\",\"cat\":\"camera\",\"ph\":\"%c\",\"id\":%d,"
+                           "\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d,\"s\":\"p\","
+                           "\"args\":{\"frame\":%u,\"arg0\":%u,\"arg1\":%u}}",
+                           separator ? ",\n" : "",
+                           info->name,
+                           info->phase,
+                           info->id,
+                           ( long long ) ( rec->mTimestamp / 1000 ),
+                           ( long long ) ( rec->mTimestamp % 1000 ),
+                           getpid(),
+                           rec->mTid,
+                           rec->mFrameId,
+                           rec->mArg0,
+                           rec->mArg1);
+            write(fd, buffer, len);
+            separator = true;
+            }
+        }
+
+    len = snprintf(buffer, sizeof(buffer), "\n]}\n");
+    write(fd, buffer, len);
+
+    return NO_ERROR;
+}
+
+status_t CameraTrace::dump(const char *path)
+{
+    status_t ret;
+    int fd;
+
+    if ( NULL == path )
+        {
+        return -EINVAL;
+        }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if ( 0 > fd )
+        {
+        ALOGE("Unable to open trace file %s: %s", path, strerror(errno));
+        return -errno;
+        }
+
+    ret = dump(fd);
+    close(fd);
+
+    return ret;
+}
+
+};
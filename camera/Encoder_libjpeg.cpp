@@ -59,6 +59,79 @@ static integer_string_pair degress_to_exif_lut [] = {
     {180, "3"},
     {270, "8"},
 };
+
+// TIFF field types
+enum {
+    EXIF_FORMAT_BYTE = 1,
+    EXIF_FORMAT_ASCII = 2,
+    EXIF_FORMAT_SHORT = 3,
+    EXIF_FORMAT_LONG = 4,
+    EXIF_FORMAT_RATIONAL = 5,
+    EXIF_FORMAT_UNDEFINED = 7,
+    EXIF_FORMAT_SRATIONAL = 10,
+};
+
+// tags the table writes on its own
+enum {
+    EXIF_TAG_COMPRESSION = 0x0103,
+    EXIF_TAG_DATETIME = 0x0132,
+    EXIF_TAG_THUMBNAIL_OFFSET = 0x0201,
+    EXIF_TAG_THUMBNAIL_LENGTH = 0x0202,
+    EXIF_TAG_EXIF_IFD = 0x8769,
+    EXIF_TAG_GPS_IFD = 0x8825,
+    EXIF_TAG_EXIF_VERSION = 0x9000,
+    EXIF_TAG_DATETIME_ORIGINAL = 0x9003,
+};
+
+#define EXIF_IFD_ENTRY_SIZE 12
+#define EXIF_COMPRESSION_JPEG 6
+
+static const unsigned char exif_header[] = { 'E', 'x', 'i', 'f', 0x0, 0x0 };
+static const unsigned char exif_version[] = { '0', '2', '2', '0' };
+
+struct exif_tag_info {
+    const char* name;
+    unsigned short tag;
+    unsigned short format;
+    unsigned int ifd;
+};
+
+// ifd: 0 - primary image, 1 - exif private, 2 - gps
+static const exif_tag_info exif_tag_lut [] = {
+    {TAG_MAKE,                  0x010F, EXIF_FORMAT_ASCII,     0},
+    {TAG_MODEL,                 0x0110, EXIF_FORMAT_ASCII,     0},
+    {TAG_ORIENTATION,           0x0112, EXIF_FORMAT_SHORT,     0},
+    {TAG_DATETIME,              EXIF_TAG_DATETIME, EXIF_FORMAT_ASCII, 0},
+    {TAG_EXPOSURETIME,          0x829A, EXIF_FORMAT_RATIONAL,  1},
+    {TAG_FNUMBER,               0x829D, EXIF_FORMAT_RATIONAL,  1},
+    {TAG_EXPOSURE_PROGRAM,      0x8822, EXIF_FORMAT_SHORT,     1},
+    {TAG_ISO_EQUIVALENT,        0x8827, EXIF_FORMAT_SHORT,     1},
+    {TAG_CPRS_BITS_PER_PIXEL,   0x9102, EXIF_FORMAT_RATIONAL,  1},
+    {TAG_SHUTTERSPEED,          0x9201, EXIF_FORMAT_SRATIONAL, 1},
+    {TAG_APERTURE,              0x9202, EXIF_FORMAT_RATIONAL,  1},
+    {TAG_METERING_MODE,         0x9207, EXIF_FORMAT_SHORT,     1},
+    {TAG_LIGHT_SOURCE,          0x9208, EXIF_FORMAT_SHORT,     1},
+    {TAG_FLASH,                 0x9209, EXIF_FORMAT_SHORT,     1},
+    {TAG_FOCALLENGTH,           0x920A, EXIF_FORMAT_RATIONAL,  1},
+    {TAG_COLOR_SPACE,           0xA001, EXIF_FORMAT_SHORT,     1},
+    {TAG_IMAGE_WIDTH,           0xA002, EXIF_FORMAT_LONG,      1},
+    {TAG_IMAGE_LENGTH,          0xA003, EXIF_FORMAT_LONG,      1},
+    {TAG_SENSING_METHOD,        0xA217, EXIF_FORMAT_SHORT,     1},
+    {TAG_CUSTOM_RENDERED,       0xA401, EXIF_FORMAT_SHORT,     1},
+    {TAG_WHITEBALANCE,          0xA403, EXIF_FORMAT_SHORT,     1},
+    {TAG_DIGITALZOOMRATIO,      0xA404, EXIF_FORMAT_RATIONAL,  1},
+    {TAG_GPS_VERSION_ID,        0x0000, EXIF_FORMAT_BYTE,      2},
+    {TAG_GPS_LAT_REF,           0x0001, EXIF_FORMAT_ASCII,     2},
+    {TAG_GPS_LAT,               0x0002, EXIF_FORMAT_RATIONAL,  2},
+    {TAG_GPS_LONG_REF,          0x0003, EXIF_FORMAT_ASCII,     2},
+    {TAG_GPS_LONG,              0x0004, EXIF_FORMAT_RATIONAL,  2},
+    {TAG_GPS_ALT_REF,           0x0005, EXIF_FORMAT_BYTE,      2},
+    {TAG_GPS_ALT,               0x0006, EXIF_FORMAT_RATIONAL,  2},
+    {TAG_GPS_TIMESTAMP,         0x0007, EXIF_FORMAT_RATIONAL,  2},
+    {TAG_GPS_MAP_DATUM,         0x0012, EXIF_FORMAT_ASCII,     2},
+    {TAG_GPS_PROCESSING_METHOD, 0x001B, EXIF_FORMAT_UNDEFINED, 2},
+    {TAG_GPS_DATESTAMP,         0x001D, EXIF_FORMAT_ASCII,     2},
+};
 struct libjpeg_destination_mgr : jpeg_destination_mgr {
     libjpeg_destination_mgr(uint8_t* input, int size);
 
@@ -199,6 +272,66 @@ static void resize_nv12(Encoder_libjpeg::params* params, uint8_t* dst_buffer) {
     VT_resizeFrame_Video_opt2_lp(&i_img_ptr, &o_img_ptr, NULL, 0);
 }
 
+// TIFF data is written little endian, JPEG segment lengths big endian
+static void put16(unsigned char* dst, unsigned int value) {
+    dst[0] = value & 0xFF;
+    dst[1] = (value >> 8) & 0xFF;
+}
+
+static void put32(unsigned char* dst, unsigned int value) {
+    dst[0] = value & 0xFF;
+    dst[1] = (value >> 8) & 0xFF;
+    dst[2] = (value >> 16) & 0xFF;
+    dst[3] = (value >> 24) & 0xFF;
+}
+
+static unsigned int exifFormatSize(unsigned int format) {
+    switch (format) {
+        case EXIF_FORMAT_SHORT:
+            return 2;
+        case EXIF_FORMAT_LONG:
+            return 4;
+        case EXIF_FORMAT_RATIONAL:
+        case EXIF_FORMAT_SRATIONAL:
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+// converts a comma separated list of integers or "num/den" rationals
+// into 'count' TIFF components
+static void exifParseNumbers(unsigned int format, const char* value,
+                             unsigned char* dst, unsigned int count) {
+    char* end = NULL;
+    long num, den;
+
+    for (unsigned int i = 0; i < count; i++) {
+        num = strtol(value, &end, 10);
+        value = end;
+
+        if ((format == EXIF_FORMAT_RATIONAL) || (format == EXIF_FORMAT_SRATIONAL)) {
+            den = 1;
+            if (*value == '/') {
+                den = strtol(value + 1, &end, 10);
+                value = end;
+            }
+            put32(dst, num);
+            put32(dst + 4, den);
+        } else if (format == EXIF_FORMAT_LONG) {
+            put32(dst, num);
+        } else if (format == EXIF_FORMAT_SHORT) {
+            put16(dst, num);
+        } else {
+            dst[0] = num & 0xFF;
+        }
+        dst += exifFormatSize(format);
+
+        while (*value && (*value != ',')) value++;
+        if (*value == ',') value++;
+    }
+}
+
 /* public static functions */
 const char* ExifElementsTable::degreesToExifOrientation(unsigned int degrees) {
     for (unsigned int i = 0; i < ARRAY_SIZE(degress_to_exif_lut); i++) {
@@ -261,52 +394,252 @@ bool ExifElementsTable::isAsciiTag(const char* tag) {
     return (strcmp(tag, TAG_GPS_PROCESSING_METHOD) == 0);
 }
 
-void ExifElementsTable::insertExifToJpeg(unsigned char* jpeg, size_t jpeg_size) {
-    ReadMode_t read_mode = (ReadMode_t)(READ_METADATA | READ_IMAGE);
-
-    ResetJpgfile();
-    if (ReadJpegSectionsFromBuffer(jpeg, jpeg_size, read_mode)) {
-        jpeg_opened = true;
-        create_EXIF(table, exif_tag_count, gps_tag_count, has_datetime_tag);
+status_t ExifElementsTable::insertExifThumbnailImage(const char* thumb, int len) {
+    if (!thumb || (len <= 0)) {
+        return -EINVAL;
     }
+
+    // only referenced, the buffer has to outlive insertExifToJpeg()
+    thumbnail = (const unsigned char*) thumb;
+    thumbnail_size = len;
+
+    return NO_ERROR;
 }
 
-status_t ExifElementsTable::insertExifThumbnailImage(const char* thumb, int len) {
-    status_t ret = NO_ERROR;
+/**
+ * Writes SOI and an APP1 segment built from the table into the 'headroom'
+ * bytes in front of 'jpeg', reusing the rest of the encoded stream in place.
+ * Returns the number of bytes the image now starts ahead of 'jpeg', 0 when
+ * the stream was left untouched.
+ */
+size_t ExifElementsTable::insertExifToJpeg(unsigned char* jpeg, size_t jpeg_size, size_t headroom) {
+    ExifElement* ifds[IFD_MAX][MAX_EXIF_TAGS_SUPPORTED + 2];
+    unsigned int counts[IFD_MAX];
+    unsigned int offsets[IFD_MAX];
+    unsigned int sizes[IFD_MAX];
+    ExifElement links[7];
+    unsigned char values[5][4];
+    unsigned int nlinks = 0;
+    ExifElement* datetime = NULL;
+    unsigned int tiff_size, thumb_offset = 0;
+    size_t app1_size;
+    unsigned char* app1;
+    unsigned char* tiff;
+
+    if (!jpeg || (jpeg_size < 4) || (jpeg[0] != 0xFF) || (jpeg[1] != 0xD8)) {
+        CAMHAL_LOGEA("Not a jpeg stream, EXIF not inserted");
+        return 0;
+    }
 
-    if ((len > 0) && jpeg_opened) {
-        ret = ReplaceThumbnailFromBuffer(thumb, len);
-        CAMHAL_LOGDB("insertExifThumbnailImage. ReplaceThumbnail(). ret=%d", ret);
+    memset(counts, 0, sizeof(counts));
+    memset(links, 0, sizeof(links));
+
+    for (unsigned int i = 0; i < position; i++) {
+        if (table[i].data) {
+            ifds[table[i].ifd][counts[table[i].ifd]++] = &table[i];
+            if (table[i].tag == EXIF_TAG_DATETIME) {
+                datetime = &table[i];
+            }
+        }
     }
 
-    return ret;
+    // entries which don't come from the caller
+    links[nlinks].tag = EXIF_TAG_EXIF_VERSION;
+    links[nlinks].format = EXIF_FORMAT_UNDEFINED;
+    links[nlinks].ifd = IFD_EXIF;
+    links[nlinks].count = sizeof(exif_version);
+    links[nlinks].size = sizeof(exif_version);
+    links[nlinks].data = (unsigned char*) exif_version;
+    nlinks++;
+
+    if (datetime) {
+        links[nlinks] = *datetime;
+        links[nlinks].tag = EXIF_TAG_DATETIME_ORIGINAL;
+        links[nlinks].ifd = IFD_EXIF;
+        nlinks++;
+    }
+
+    links[nlinks].tag = EXIF_TAG_EXIF_IFD;
+    links[nlinks].ifd = IFD_0;
+    links[nlinks].data = values[0];
+    nlinks++;
+
+    if (counts[IFD_GPS]) {
+        links[nlinks].tag = EXIF_TAG_GPS_IFD;
+        links[nlinks].ifd = IFD_0;
+        links[nlinks].data = values[1];
+        nlinks++;
+    }
+
+    if (thumbnail) {
+        links[nlinks].tag = EXIF_TAG_COMPRESSION;
+        links[nlinks].format = EXIF_FORMAT_SHORT;
+        links[nlinks].ifd = IFD_1;
+        links[nlinks].count = 1;
+        links[nlinks].size = 2;
+        links[nlinks].data = values[2];
+        put16(values[2], EXIF_COMPRESSION_JPEG);
+        nlinks++;
+
+        links[nlinks].tag = EXIF_TAG_THUMBNAIL_OFFSET;
+        links[nlinks].ifd = IFD_1;
+        links[nlinks].data = values[3];
+        nlinks++;
+
+        links[nlinks].tag = EXIF_TAG_THUMBNAIL_LENGTH;
+        links[nlinks].ifd = IFD_1;
+        links[nlinks].data = values[4];
+        nlinks++;
+    }
+
+    for (unsigned int i = 0; i < nlinks; i++) {
+        if (!links[i].format) {
+            links[i].format = EXIF_FORMAT_LONG;
+            links[i].count = 1;
+            links[i].size = 4;
+        }
+        ifds[links[i].ifd][counts[links[i].ifd]++] = &links[i];
+    }
+
+    // directory entries have to be sorted by tag
+    for (unsigned int ifd = 0; ifd < IFD_MAX; ifd++) {
+        for (unsigned int i = 1; i < counts[ifd]; i++) {
+            ExifElement* entry = ifds[ifd][i];
+            unsigned int j = i;
+            while ((j > 0) && (ifds[ifd][j - 1]->tag > entry->tag)) {
+                ifds[ifd][j] = ifds[ifd][j - 1];
+                j--;
+            }
+            ifds[ifd][j] = entry;
+        }
+    }
+
+    // TIFF header, then the directories back to back
+    tiff_size = 8;
+    for (unsigned int ifd = 0; ifd < IFD_MAX; ifd++) {
+        sizes[ifd] = counts[ifd] ? ifdSize(ifds[ifd], counts[ifd]) : 0;
+        offsets[ifd] = tiff_size;
+        tiff_size += sizes[ifd];
+    }
+
+    if (thumbnail) {
+        thumb_offset = tiff_size;
+        tiff_size += thumbnail_size;
+
+        if ((sizeof(exif_header) + tiff_size + 2) > 0xFFFF) {
+            // too big for the segment, drop the thumbnail directory instead
+            CAMHAL_LOGEB("Thumbnail of %u bytes doesn't fit in APP1, skipping it",
+                         (unsigned int) thumbnail_size);
+            tiff_size = offsets[IFD_1];
+            sizes[IFD_1] = 0;
+            counts[IFD_1] = 0;
+        }
+    }
+
+    app1_size = 4 + sizeof(exif_header) + tiff_size;
+    if (app1_size > headroom) {
+        CAMHAL_LOGEB("No room for %u bytes of EXIF ahead of the jpeg", (unsigned int) app1_size);
+        return 0;
+    }
+
+    put32(values[0], offsets[IFD_EXIF]);
+    put32(values[1], offsets[IFD_GPS]);
+    put32(values[3], thumb_offset);
+    put32(values[4], thumbnail_size);
+
+    // the original SOI gets overwritten by the tail of the segment,
+    // the entropy coded data stays where the encoder put it
+    app1 = jpeg + 2 - app1_size;
+    app1[-2] = 0xFF;
+    app1[-1] = 0xD8;
+    app1[0] = 0xFF;
+    app1[1] = 0xE1;
+    app1[2] = ((app1_size - 2) >> 8) & 0xFF;
+    app1[3] = (app1_size - 2) & 0xFF;
+    memcpy(app1 + 4, exif_header, sizeof(exif_header));
+
+    tiff = app1 + 4 + sizeof(exif_header);
+    tiff[0] = 'I';
+    tiff[1] = 'I';
+    put16(tiff + 2, 42);
+    put32(tiff + 4, offsets[IFD_0]);
+
+    writeIfd(tiff, offsets[IFD_0], ifds[IFD_0], counts[IFD_0], counts[IFD_1] ? offsets[IFD_1] : 0);
+    writeIfd(tiff, offsets[IFD_EXIF], ifds[IFD_EXIF], counts[IFD_EXIF], 0);
+    if (counts[IFD_GPS]) {
+        writeIfd(tiff, offsets[IFD_GPS], ifds[IFD_GPS], counts[IFD_GPS], 0);
+    }
+    if (counts[IFD_1]) {
+        writeIfd(tiff, offsets[IFD_1], ifds[IFD_1], counts[IFD_1], 0);
+        memcpy(tiff + thumb_offset, thumbnail, thumbnail_size);
+    }
+
+    return app1_size;
 }
 
-void ExifElementsTable::saveJpeg(unsigned char* jpeg, size_t jpeg_size) {
-    if (jpeg_opened) {
-       WriteJpegToBuffer(jpeg, jpeg_size);
-       DiscardData();
-       jpeg_opened = false;
+/* private static functions */
+unsigned int ExifElementsTable::ifdSize(ExifElement** entries, unsigned int count) {
+    unsigned int size = 2 + count * EXIF_IFD_ENTRY_SIZE + 4;
+
+    // values which don't fit in the entry go after the directory, word aligned
+    for (unsigned int i = 0; i < count; i++) {
+        if (entries[i]->size > 4) {
+            size += (entries[i]->size + 1) & ~1;
+        }
     }
+
+    return size;
 }
 
-/* public functions */
-ExifElementsTable::~ExifElementsTable() {
-    int num_elements = gps_tag_count + exif_tag_count;
+unsigned int ExifElementsTable::writeIfd(unsigned char* tiff, unsigned int offset,
+                                         ExifElement** entries, unsigned int count,
+                                         unsigned int next) {
+    unsigned char* dir = tiff + offset;
+    unsigned int data_offset = offset + 2 + count * EXIF_IFD_ENTRY_SIZE + 4;
+
+    put16(dir, count);
+    dir += 2;
+
+    for (unsigned int i = 0; i < count; i++) {
+        ExifElement* entry = entries[i];
 
-    for (int i = 0; i < num_elements; i++) {
-        if (table[i].Value) {
-            free(table[i].Value);
+        put16(dir, entry->tag);
+        put16(dir + 2, entry->format);
+        put32(dir + 4, entry->count);
+
+        if (entry->size <= 4) {
+            memset(dir + 8, 0, 4);
+            memcpy(dir + 8, entry->data, entry->size);
+        } else {
+            put32(dir + 8, data_offset);
+            memcpy(tiff + data_offset, entry->data, entry->size);
+            if (entry->size & 1) {
+                tiff[data_offset + entry->size] = 0;
+            }
+            data_offset += (entry->size + 1) & ~1;
         }
+
+        dir += EXIF_IFD_ENTRY_SIZE;
     }
 
-    if (jpeg_opened) {
-        DiscardData();
+    put32(dir, next);
+
+    return data_offset;
+}
+
+/* public functions */
+ExifElementsTable::~ExifElementsTable() {
+    for (unsigned int i = 0; i < position; i++) {
+        if (table[i].data) {
+            free(table[i].data);
+        }
     }
 }
 
 status_t ExifElementsTable::insertElement(const char* tag, const char* value) {
+    const exif_tag_info* info = NULL;
     unsigned int value_length = 0;
+    unsigned int count = 1;
     status_t ret = NO_ERROR;
 
     if (!value || !tag) {
@@ -318,32 +651,48 @@ status_t ExifElementsTable::insertElement(const char* tag, const char* value) {
         return NO_MEMORY;
     }
 
+    for (unsigned int i = 0; i < ARRAY_SIZE(exif_tag_lut); i++) {
+        if (strcmp(tag, exif_tag_lut[i].name) == 0) {
+            info = &exif_tag_lut[i];
+            break;
+        }
+    }
+
+    if (!info) {
+        CAMHAL_LOGEB("Unsupported EXIF tag %s", tag);
+        return -EINVAL;
+    }
+
     if (isAsciiTag(tag)) {
         value_length = sizeof(ExifAsciiPrefix) + strlen(value + sizeof(ExifAsciiPrefix));
     } else {
         value_length = strlen(value);
     }
 
-    if (IsGpsTag(tag)) {
-        table[position].GpsTag = TRUE;
-        table[position].Tag = GpsTagNameToValue(tag);
-        gps_tag_count++;
+    if (info->format == EXIF_FORMAT_ASCII) {
+        // keeps the terminating null
+        count = value_length + 1;
+    } else if (info->format == EXIF_FORMAT_UNDEFINED) {
+        count = value_length;
     } else {
-        table[position].GpsTag = FALSE;
-        table[position].Tag = TagNameToValue(tag);
-        exif_tag_count++;
-
-        if (strcmp(tag, TAG_DATETIME) == 0) {
-            has_datetime_tag = true;
+        for (const char* c = value; *c; c++) {
+            if (*c == ',') count++;
         }
     }
 
-    table[position].DataLength = 0;
-    table[position].Value = (char*) malloc(sizeof(char) * (value_length + 1));
+    table[position].tag = info->tag;
+    table[position].format = info->format;
+    table[position].ifd = info->ifd;
+    table[position].count = count;
+    table[position].size = count * exifFormatSize(info->format);
+    table[position].data = (unsigned char*) malloc(table[position].size);
 
-    if (table[position].Value) {
-        memcpy(table[position].Value, value, value_length + 1);
-        table[position].DataLength = value_length + 1;
+    if (table[position].data) {
+        if ((info->format == EXIF_FORMAT_ASCII) || (info->format == EXIF_FORMAT_UNDEFINED)) {
+            memcpy(table[position].data, value, table[position].size);
+        } else {
+            exifParseNumbers(info->format, value, table[position].data, count);
+        }
     }
 
     position++;
@@ -379,8 +728,8 @@ size_t Encoder_libjpeg::encode(params* input) {
 
     libjpeg_destination_mgr dest_mgr(input->dst, input->dst_size);
 
-    // param check...
-    if ((in_width < 2) || (out_width < 2) || (in_height < 2) || (out_height < 2) ||
+    // param check, an encoder canceled before it ran leaves dst alone
+    if (mCancelEncoding || (in_width < 2) || (out_width < 2) || (in_height < 2) || (out_height < 2) ||
          (src == NULL) || (input->dst == NULL) || (input->quality < 1) || (input->src_size < 1) ||
          (input->dst_size < 1) || (input->format == NULL)) {
         goto exit;
@@ -424,6 +773,8 @@ size_t Encoder_libjpeg::encode(params* input) {
 
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, input->quality, TRUE);
+    // EXIF images carry APP1 right after SOI in place of JFIF APP0
+    cinfo.write_JFIF_header = input->jfif ? TRUE : FALSE;
     cinfo.dct_method = JDCT_IFAST;
 
     jpeg_start_compress(&cinfo, TRUE);
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ExposureFusion.cpp
+*
+* Alignment and per pixel blending of exposure bracketed YUV422I frames.
+*
+*/
+
+#define LOG_TAG "CameraHAL"
+
+#include "CameraHal.h"
+#include "ExposureFusion.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace android {
+
+pthread_once_t ExposureFusion::sWeightsOnce = PTHREAD_ONCE_INIT;
+uint16_t ExposureFusion::sWeights[256];
+
+void ExposureFusion::createWeights()
+{
+    //Gaussian around mid grey, sigma of 0.2 of the range. The weights
+    //never reach zero, so a pixel clipped in every frame still resolves.
+    for ( int i = 0 ; i < 256 ; i++ )
+        {
+        double d = ( i - 128 ) / ( 0.2 * 255.0 );
+        sWeights[i] = ( uint16_t ) ( 1 + 1023.0 * exp(-0.5 * d * d) );
+        }
+}
+
+int ExposureFusion::median(const uint8_t *frame, int width, int height, int stride)
+{
+    unsigned int hist[256];
+    unsigned int total = 0, acc = 0;
+    const uint8_t *row;
+
+    memset(hist, 0, sizeof(hist));
+
+    for ( int y = 0 ; y < height ; y += STATS_STEP )
+        {
+        row = frame + y * stride;
+        for ( int x = 0 ; x < width ; x += STATS_STEP )
+            {
+            hist[row[2 * x + 1]]++;
+            total++;
+            }
+        }
+
+    for ( int i = 0 ; i < 256 ; i++ )
+        {
+        acc += hist[i];
+        if ( ( acc * 2 ) >= total )
+            {
+            return i;
+            }
+        }
+
+    return 128;
+}
+
+void *ExposureFusion::blendBand(void *arg)
+{
+    Band *band = ( Band * ) arg;
+    const uint8_t *rows[FrameMerge::MAX_FRAMES];
+    const uint8_t *p;
+    uint8_t *out;
+    int half = band->mWidth / 2;
+    int sx, sy;
+    unsigned int w0, w1, wc;
+    unsigned int sumW0, sumW1, sumWc;
+    unsigned int sumU, sumY0, sumV, sumY1;
+
+    for ( int y = band->mFirstRow ; y < band->mLastRow ; y++ )
+        {
+        for ( size_t k = 0 ; k < band->mCount ; k++ )
+            {
+            sy = y + band->mDy[k];
+            sy = ( sy < 0 ) ? 0 : ( ( sy >= band->mHeight ) ? ( band->mHeight - 1 ) : sy );
+            rows[k] = band->mFrames[k] + sy * band->mStride;
+            }
+
+        //The reference isn't shifted, every output pixel only depends
+        //on the same pixel of the reference and it can be overwritten
+        out = band->mFrames[band->mReference] + y * band->mStride;
+
+        for ( int x = 0 ; x < half ; x++ )
+            {
+            sumW0 = sumW1 = sumWc = 0;
+            sumU = sumY0 = sumV = sumY1 = 0;
+
+            for ( size_t k = 0 ; k < band->mCount ; k++ )
+                {
+                sx = x + band->mDx[k] / 2;
+                sx = ( sx < 0 ) ? 0 : ( ( sx >= half ) ? ( half - 1 ) : sx );
+                p = rows[k] + 4 * sx;
+
+                //UYVY, both lumas get their own weight and the shared
+                //chroma the mean of the two
+                w0 = sWeights[p[1]];
+                w1 = sWeights[p[3]];
+                wc = ( w0 + w1 ) >> 1;
+
+                sumU += wc * p[0];
+                sumY0 += w0 * p[1];
+                sumV += wc * p[2];
+                sumY1 += w1 * p[3];
+                sumW0 += w0;
+                sumW1 += w1;
+                sumWc += wc;
+                }
+
+            out[4 * x + 0] = ( uint8_t ) ( ( sumU + ( sumWc >> 1 ) ) / sumWc );
+            out[4 * x + 1] = ( uint8_t ) ( ( sumY0 + ( sumW0 >> 1 ) ) / sumW0 );
+            out[4 * x + 2] = ( uint8_t ) ( ( sumV + ( sumWc >> 1 ) ) / sumWc );
+            out[4 * x + 3] = ( uint8_t ) ( ( sumY1 + ( sumW1 >> 1 ) ) / sumW1 );
+            }
+        }
+
+    return NULL;
+}
+
+status_t ExposureFusion::merge(uint8_t **frames,
+                               size_t count,
+                               int width,
+                               int height,
+                               int stride,
+                               size_t &reference)
+{
+    int medians[FrameMerge::MAX_FRAMES];
+    int dx[FrameMerge::MAX_FRAMES], dy[FrameMerge::MAX_FRAMES];
+    Band band;
+    status_t ret;
+
+    LOG_FUNCTION_NAME;
+
+    if ( ( NULL == frames ) || ( 2 > count ) || ( FrameMerge::MAX_FRAMES < count ) )
+        {
+        CAMHAL_LOGEB("Invalid bracket of %u frames", ( unsigned int ) count);
+        return -EINVAL;
+        }
+
+    if ( ( width < ( 4 * STATS_STEP ) ) || ( height < ( 4 * STATS_STEP ) ) ||
+         ( stride < ( 2 * width ) ) )
+        {
+        CAMHAL_LOGEB("Invalid frame geometry %dx%d stride %d", width, height, stride);
+        return -EINVAL;
+        }
+
+    for ( size_t k = 0 ; k < count ; k++ )
+        {
+        if ( NULL == frames[k] )
+            {
+            CAMHAL_LOGEB("Bracket frame %u missing", ( unsigned int ) k);
+            return -EINVAL;
+            }
+        }
+
+    pthread_once(&sWeightsOnce, createWeights);
+
+    //The frame closest to mid grey is the least clipped, it is kept as
+    //the geometric reference and receives the result
+    reference = 0;
+    for ( size_t k = 0 ; k < count ; k++ )
+        {
+        medians[k] = median(frames[k], width, height, stride);
+        if ( abs(medians[k] - 128) < abs(medians[reference] - 128) )
+            {
+            reference = k;
+            }
+        }
+
+    //Thresholding at the median makes differently exposed frames
+    //comparable
+    ret = FrameMerge::align(frames, count, reference, width, height, stride,
+                            STATS_STEP, MAX_SHIFT, medians, dx, dy);
+    if ( NO_ERROR != ret )
+        {
+        return ret;
+        }
+
+    band.mFrames = frames;
+    band.mCount = count;
+    band.mReference = reference;
+    band.mDx = dx;
+    band.mDy = dy;
+    band.mWidth = width;
+    band.mHeight = height;
+    band.mStride = stride;
+    FrameMerge::runBands(band, 1, blendBand);
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+};
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameMerge.cpp
+*
+* Global alignment and band parallel execution of multi-frame merges.
+*
+*/
+
+#define LOG_TAG "CameraHAL"
+
+#include "CameraHal.h"
+#include "FrameMerge.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace android {
+
+void FrameMerge::project(const uint8_t *frame,
+                         int width,
+                         int height,
+                         int stride,
+                         int step,
+                         int threshold,
+                         int *rows,
+                         int *cols)
+{
+    int dw = width / step;
+    int dh = height / step;
+    const uint8_t *row;
+    int val;
+
+    //Projections are matched instead of the images to keep the search
+    //linear in the image size
+    memset(rows, 0, dh * sizeof(int));
+    memset(cols, 0, dw * sizeof(int));
+
+    for ( int i = 0 ; i < dh ; i++ )
+        {
+        row = frame + i * step * stride;
+        for ( int j = 0 ; j < dw ; j++ )
+            {
+            val = row[2 * j * step + 1];
+            if ( 0 <= threshold )
+                {
+                val = ( val > threshold ) ? 1 : 0;
+                }
+            rows[i] += val;
+            cols[j] += val;
+            }
+        }
+}
+
+int FrameMerge::bestShift(const int *ref, const int *cur, int len, int range)
+{
+    uint64_t cost, bestCost = ( uint64_t ) -1;
+    int best = 0;
+    int first, last;
+
+    //Keep at least half of the samples overlapping
+    if ( range > ( len / 4 ) )
+        {
+        range = len / 4;
+        }
+
+    for ( int s = -range ; s <= range ; s++ )
+        {
+        first = ( s < 0 ) ? -s : 0;
+        last = ( s > 0 ) ? ( len - s ) : len;
+
+        cost = 0;
+        for ( int i = first ; i < last ; i++ )
+            {
+            cost += abs(ref[i] - cur[i + s]);
+            }
+
+        //Normalize, larger shifts compare fewer samples
+        cost = ( cost << 8 ) / ( last - first );
+        if ( ( cost < bestCost ) ||
+             ( ( cost == bestCost ) && ( abs(s) < abs(best) ) ) )
+            {
+            bestCost = cost;
+            best = s;
+            }
+        }
+
+    return best;
+}
+
+status_t FrameMerge::align(uint8_t **frames,
+                           size_t count,
+                           size_t reference,
+                           int width,
+                           int height,
+                           int stride,
+                           int step,
+                           int range,
+                           const int *thresholds,
+                           int *dx,
+                           int *dy)
+{
+    int *refRows, *refCols, *curRows, *curCols;
+    int dw = width / step;
+    int dh = height / step;
+
+    refRows = ( int * ) malloc(2 * ( dw + dh ) * sizeof(int));
+    if ( NULL == refRows )
+        {
+        CAMHAL_LOGEA("Unable to allocate alignment projections");
+        return NO_MEMORY;
+        }
+    refCols = refRows + dh;
+    curRows = refCols + dw;
+    curCols = curRows + dh;
+
+    project(frames[reference], width, height, stride, step,
+            thresholds ? thresholds[reference] : -1, refRows, refCols);
+
+    for ( size_t k = 0 ; k < count ; k++ )
+        {
+        dx[k] = dy[k] = 0;
+        if ( k == reference )
+            {
+            continue;
+            }
+
+        project(frames[k], width, height, stride, step,
+                thresholds ? thresholds[k] : -1, curRows, curCols);
+        //Multiples of step keep the shift on whole UYVY macropixels
+        dx[k] = bestShift(refCols, curCols, dw, range / step) * step;
+        dy[k] = bestShift(refRows, curRows, dh, range / step) * step;
+
+        CAMHAL_LOGDB("Frame %u shift %d,%d", ( unsigned int ) k, dx[k], dy[k]);
+        }
+
+    free(refRows);
+
+    return NO_ERROR;
+}
+
+void FrameMerge::runBands(const Band &merge, int rowAlign, BandKernel kernel)
+{
+    Band bands[THREADS];
+    pthread_t threads[THREADS];
+    bool started[THREADS];
+    int bandRows;
+
+    bandRows = ( merge.mHeight + THREADS - 1 ) / THREADS;
+    bandRows = ( ( bandRows + rowAlign - 1 ) / rowAlign ) * rowAlign;
+    for ( int i = 0 ; i < THREADS ; i++ )
+        {
+        bands[i] = merge;
+        bands[i].mFirstRow = ( ( i * bandRows ) < merge.mHeight ) ? ( i * bandRows ) : merge.mHeight;
+        bands[i].mLastRow = ( ( ( i + 1 ) * bandRows ) < merge.mHeight ) ? ( ( i + 1 ) * bandRows ) : merge.mHeight;
+        started[i] = false;
+        }
+
+    //The first band runs on the calling thread. A band whose thread
+    //can't be created falls back to it as well.
+    for ( int i = 1 ; i < THREADS ; i++ )
+        {
+        started[i] = ( 0 == pthread_create(&threads[i], NULL, kernel, &bands[i]) );
+        }
+
+    for ( int i = 0 ; i < THREADS ; i++ )
+        {
+        if ( !started[i] )
+            {
+            kernel(&bands[i]);
+            }
+        }
+
+    for ( int i = 1 ; i < THREADS ; i++ )
+        {
+        if ( started[i] )
+            {
+            pthread_join(threads[i], NULL);
+            }
+        }
+}
+
+};
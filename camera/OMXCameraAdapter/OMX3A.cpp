@@ -30,6 +30,7 @@
 #include "ErrorUtils.h"
 
 #include <cutils/properties.h>
+#include <pthread.h>
 
 #undef TRUE
 #undef FALSE
@@ -39,29 +40,186 @@
 #define METERING_AREAS_RANGE 0xFF
 
 namespace android {
+///Hashed views of the HAL<->OMX translation tables. They get built once on
+///first use, afterwards a translation costs a hash and a single compare.
+#define LUT_INDEX_SLOTS 64 //power of two, over twice the largest table
+#define LUT_INDEX_EMPTY -1
+
+struct LUTIndex
+{
+    const userToOMX_LUT *table;
+    int halToOMX[LUT_INDEX_SLOTS];
+    int OMXtoHal[LUT_INDEX_SLOTS];
+};
+
+struct SceneModesIndex
+{
+    const CameraToSensorModesLUTEntry *camera;
+    int scenes[LUT_INDEX_SLOTS];
+};
+
+static pthread_once_t gLUTIndexOnce = PTHREAD_ONCE_INIT;
+static LUTIndex gLUTIndex[LUTIdMax];
+static int gSceneCameraIndex[LUT_INDEX_SLOTS];
+static SceneModesIndex gSceneModesIndex[ARRAY_SIZE(CameraToSensorModesLUT)];
+
+static unsigned int hashString(const char *str)
+{
+    unsigned int hash = 2166136261U;
+
+    while ( *str )
+        {
+        hash ^= ( unsigned char ) *str++;
+        hash *= 16777619U;
+        }
+
+    return hash & ( LUT_INDEX_SLOTS - 1 );
+}
+
+static unsigned int hashInt(int value)
+{
+    unsigned int hash = ( unsigned int ) value;
+
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bU;
+    hash ^= hash >> 16;
+
+    return hash & ( LUT_INDEX_SLOTS - 1 );
+}
+
+static inline unsigned int nextSlot(unsigned int slot)
+{
+    return ( slot + 1 ) & ( LUT_INDEX_SLOTS - 1 );
+}
+
+//Tables map some values more than once, the first entry wins just
+//like it did with the linear scans
+static void buildLUTIndex(const LUTtype &LUT)
+{
+    LUTIndex *index = &gLUTIndex[LUT.id];
+    unsigned int slot;
+
+    index->table = LUT.Table;
+    for ( int i = 0 ; i < LUT_INDEX_SLOTS ; i++ )
+        {
+        index->halToOMX[i] = LUT_INDEX_EMPTY;
+        index->OMXtoHal[i] = LUT_INDEX_EMPTY;
+        }
+
+    for ( int i = 0 ; i < LUT.size ; i++ )
+        {
+        slot = hashString(LUT.Table[i].userDefinition);
+        while ( ( LUT_INDEX_EMPTY != index->halToOMX[slot] ) &&
+                ( 0 != strcmp(LUT.Table[index->halToOMX[slot]].userDefinition,
+                              LUT.Table[i].userDefinition) ) )
+            {
+            slot = nextSlot(slot);
+            }
+        if ( LUT_INDEX_EMPTY == index->halToOMX[slot] )
+            {
+            index->halToOMX[slot] = i;
+            }
+
+        slot = hashInt(LUT.Table[i].omxDefinition);
+        while ( ( LUT_INDEX_EMPTY != index->OMXtoHal[slot] ) &&
+                ( LUT.Table[index->OMXtoHal[slot]].omxDefinition != LUT.Table[i].omxDefinition ) )
+            {
+            slot = nextSlot(slot);
+            }
+        if ( LUT_INDEX_EMPTY == index->OMXtoHal[slot] )
+            {
+            index->OMXtoHal[slot] = i;
+            }
+        }
+}
+
+static void buildSceneModesIndex()
+{
+    const CameraToSensorModesLUTEntry *camera;
+    SceneModesIndex *index;
+    unsigned int slot;
+
+    for ( int i = 0 ; i < LUT_INDEX_SLOTS ; i++ )
+        {
+        gSceneCameraIndex[i] = LUT_INDEX_EMPTY;
+        }
+
+    for ( unsigned int i = 0 ; i < ARRAY_SIZE(CameraToSensorModesLUT) ; i++ )
+        {
+        camera = &CameraToSensorModesLUT[i];
+
+        slot = hashString(camera->name);
+        while ( LUT_INDEX_EMPTY != gSceneCameraIndex[slot] )
+            {
+            slot = nextSlot(slot);
+            }
+        gSceneCameraIndex[slot] = i;
+
+        index = &gSceneModesIndex[i];
+        index->camera = camera;
+        for ( int j = 0 ; j < LUT_INDEX_SLOTS ; j++ )
+            {
+            index->scenes[j] = LUT_INDEX_EMPTY;
+            }
+
+        for ( unsigned int j = 0 ; j < camera->size ; j++ )
+            {
+            slot = hashInt(camera->Table[j].scene);
+            while ( ( LUT_INDEX_EMPTY != index->scenes[slot] ) &&
+                    ( camera->Table[index->scenes[slot]].scene != camera->Table[j].scene ) )
+                {
+                slot = nextSlot(slot);
+                }
+            if ( LUT_INDEX_EMPTY == index->scenes[slot] )
+                {
+                index->scenes[slot] = j;
+                }
+            }
+        }
+}
+
+static void buildLUTIndices()
+{
+    buildLUTIndex(ExpLUT);
+    buildLUTIndex(WBalLUT);
+    buildLUTIndex(FlickerLUT);
+    buildLUTIndex(SceneLUT);
+    buildLUTIndex(FlashLUT);
+    buildLUTIndex(EffLUT);
+    buildLUTIndex(FocusLUT);
+    buildLUTIndex(IsoLUT);
+    buildSceneModesIndex();
+}
+
 const SceneModesEntry* OMXCameraAdapter::getSceneModeEntry(const char* name,
                                                                   OMX_SCENEMODETYPE scene) {
-    const SceneModesEntry* cameraLUT = NULL;
+    const SceneModesIndex *index = NULL;
     const SceneModesEntry* entry = NULL;
-    unsigned int numEntries = 0;
+    unsigned int slot;
+    int i;
+
+    if (!name) {
+        return NULL;
+    }
+
+    pthread_once(&gLUTIndexOnce, buildLUTIndices);
 
     // 1. Find camera's scene mode LUT
-    for (unsigned int i = 0; i < ARRAY_SIZE(CameraToSensorModesLUT); i++) {
+    for (slot = hashString(name); LUT_INDEX_EMPTY != (i = gSceneCameraIndex[slot]); slot = nextSlot(slot)) {
         if (strcmp(CameraToSensorModesLUT[i].name, name) == 0) {
-            cameraLUT = CameraToSensorModesLUT[i].Table;
-            numEntries = CameraToSensorModesLUT[i].size;
+            index = &gSceneModesIndex[i];
             break;
         }
     }
 
     // 2. Find scene mode entry in table
-    if (!cameraLUT) {
+    if (!index) {
         goto EXIT;
     }
 
-    for (unsigned int i = 0; i < numEntries; i++) {
-        if(cameraLUT[i].scene == scene) {
-            entry = cameraLUT + i;
+    for (slot = hashInt(scene); LUT_INDEX_EMPTY != (i = index->scenes[slot]); slot = nextSlot(slot)) {
+        if (index->camera->Table[i].scene == scene) {
+            entry = index->camera->Table + i;
             break;
         }
     }
@@ -70,6 +228,7 @@ const SceneModesEntry* OMXCameraAdapter::getSceneModeEntry(const char* name,
 }
 
 status_t OMXCameraAdapter::setParameters3A(const CameraParameters &params,
+                                           const CameraParameterChanges &changes,
                                            BaseCameraAdapter::AdapterState state)
 {
     status_t ret = NO_ERROR;
@@ -98,6 +257,7 @@ status_t OMXCameraAdapter::setParameters3A(const CameraParameters &params,
                 // for feedback params to work properly since they need to be read
                 // by application in subsequent getParameters()
                 ret |= setScene(mParameters3A);
+                clearApplied3Asettings();
                 // re-apply EV compensation after setting scene mode since it probably reset it
                 if(mParameters3A.EVCompensation) {
                    setEVCompensation(mParameters3A);
@@ -340,7 +500,7 @@ status_t OMXCameraAdapter::setParameters3A(const CameraParameters &params,
     }
 
     str = params.get(CameraParameters::KEY_METERING_AREAS);
-    if ( (str != NULL) ) {
+    if ( (str != NULL) && changes.changed(CameraParameters::KEY_METERING_AREAS) ) {
         size_t MAX_METERING_AREAS;
         Vector< sp<CameraArea> > tempAreas;
 
@@ -377,21 +537,35 @@ status_t OMXCameraAdapter::setParameters3A(const CameraParameters &params,
 
 int OMXCameraAdapter::getLUTvalue_HALtoOMX(const char * HalValue, LUTtype LUT)
 {
-    int LUTsize = LUT.size;
-    if( HalValue )
-        for(int i = 0; i < LUTsize; i++)
-            if( 0 == strcmp(LUT.Table[i].userDefinition, HalValue) )
-                return LUT.Table[i].omxDefinition;
+    const LUTIndex *index = &gLUTIndex[LUT.id];
+    int i;
+
+    if( !HalValue )
+        return -ENOENT;
+
+    pthread_once(&gLUTIndexOnce, buildLUTIndices);
+
+    for( unsigned int slot = hashString(HalValue);
+         LUT_INDEX_EMPTY != ( i = index->halToOMX[slot] );
+         slot = nextSlot(slot) )
+        if( 0 == strcmp(index->table[i].userDefinition, HalValue) )
+            return index->table[i].omxDefinition;
 
     return -ENOENT;
 }
 
 const char* OMXCameraAdapter::getLUTvalue_OMXtoHAL(int OMXValue, LUTtype LUT)
 {
-    int LUTsize = LUT.size;
-    for(int i = 0; i < LUTsize; i++)
-        if( LUT.Table[i].omxDefinition == OMXValue )
-            return LUT.Table[i].userDefinition;
+    const LUTIndex *index = &gLUTIndex[LUT.id];
+    int i;
+
+    pthread_once(&gLUTIndexOnce, buildLUTIndices);
+
+    for( unsigned int slot = hashInt(OMXValue);
+         LUT_INDEX_EMPTY != ( i = index->OMXtoHal[slot] );
+         slot = nextSlot(slot) )
+        if( index->table[i].omxDefinition == OMXValue )
+            return index->table[i].userDefinition;
 
     return NULL;
 }
@@ -1487,110 +1661,237 @@ status_t OMXCameraAdapter::set3ALock(OMX_BOOL toggleExp, OMX_BOOL toggleWb, OMX_
 status_t OMXCameraAdapter::setMeteringAreas(Gen3A_settings& Gen3A)
 {
   status_t ret = NO_ERROR;
-  OMX_ERRORTYPE eError = OMX_ErrorNone;
-
-  OMX_ALGOAREASTYPE **meteringAreas;
-  OMX_TI_CONFIG_SHAREDBUFFER sharedBuffer;
-  MemoryManager memMgr;
-  int areasSize = 0;
 
   LOG_FUNCTION_NAME
 
   Mutex::Autolock lock(mMeteringAreasLock);
 
+  ret = setAlgoAreas(OMX_AlgoAreaExposure, mMeteringAreas, METERING_AREAS_RANGE);
+
+  LOG_FUNCTION_NAME_EXIT
+
+  return ret;
+}
+
+//Sends the areas of one purpose to the component. The caller holds
+//m3ASettingsUpdateLock and the lock protecting areas. The shared
+//buffer keeps the areas last sent, so unchanged ones cost no RPC.
+status_t OMXCameraAdapter::setAlgoAreas(OMX_ALGOAREAPURPOSE purpose,
+                                        const Vector< sp<CameraArea> > &areas,
+                                        unsigned int range)
+{
+  status_t ret = NO_ERROR;
+  OMX_ERRORTYPE eError = OMX_ErrorNone;
+  OMX_TI_CONFIG_SHAREDBUFFER sharedBuffer;
+  OMXCameraPortParameters *mPreviewData = NULL;
+  OMX_ALGOAREASTYPE *algoAreas;
+  OMX_ALGOAREA area;
+  size_t top, left, width, height;
+  unsigned int numAreas, setting;
+  bool changed;
+
+  LOG_FUNCTION_NAME
+
   if ( OMX_StateInvalid == mComponentState )
     {
       CAMHAL_LOGEA("OMX component is in invalid state");
       return NO_INIT;
     }
 
-  areasSize = ((sizeof(OMX_ALGOAREASTYPE)+4095)/4096)*4096;
-  meteringAreas = (OMX_ALGOAREASTYPE**) memMgr.allocateBuffer(0, 0, NULL, areasSize, 1);
+  if ( NULL == mAlgoAreas )
+      {
+      mAlgoAreasSize = ((sizeof(OMX_ALGOAREASTYPE)+4095)/4096)*4096;
+      mAlgoAreas = (OMX_ALGOAREASTYPE**) mAlgoAreasMemMgr.allocateBuffer(0, 0, NULL,
+                                                                          mAlgoAreasSize,
+                                                                          OMX_AlgoAreaExposure + 1);
+      if ( NULL == mAlgoAreas )
+          {
+          CAMHAL_LOGEA("Error allocating buffers for algo areas");
+          return -ENOMEM;
+          }
+
+      for ( int i = OMX_AlgoAreaFocus; i <= OMX_AlgoAreaExposure; i++ )
+          {
+          OMX_INIT_STRUCT_PTR (mAlgoAreas[i], OMX_ALGOAREASTYPE);
+          mAlgoAreas[i]->nPortIndex = OMX_ALL;
+          mAlgoAreas[i]->nAlgoAreaPurpose = ( OMX_ALGOAREAPURPOSE ) i;
+          }
+      }
 
-  OMXCameraPortParameters * mPreviewData = NULL;
   mPreviewData = &mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mPrevPortIndex];
+  algoAreas = mAlgoAreas[purpose];
+  setting = ( OMX_AlgoAreaFocus == purpose ) ? SetFocusAreas : SetMeteringAreas;
 
-  if (!meteringAreas)
+  numAreas = areas.size();
+  if ( MAX_ALGOAREAS < numAreas )
       {
-      CAMHAL_LOGEB("Error allocating buffer for metering areas %d", eError);
-      return -ENOMEM;
+      numAreas = MAX_ALGOAREAS;
       }
 
-  OMX_INIT_STRUCT_PTR (meteringAreas[0], OMX_ALGOAREASTYPE);
+  // If the focus area is the special case of (0, 0, 0, 0, 0), then
+  // the algorithm needs nNumAreas to be set to 0,
+  // in order to automatically choose the best fitting areas.
+  if ( ( OMX_AlgoAreaFocus == purpose ) &&
+       ( 0 < numAreas ) &&
+       areas.itemAt(0)->isZeroArea() )
+      {
+      numAreas = 0;
+      }
 
-  meteringAreas[0]->nPortIndex = OMX_ALL;
-  meteringAreas[0]->nNumAreas = mMeteringAreas.size();
-  meteringAreas[0]->nAlgoAreaPurpose = OMX_AlgoAreaExposure;
+  changed = ( algoAreas->nNumAreas != numAreas );
+  algoAreas->nNumAreas = numAreas;
 
-  for ( unsigned int n = 0; n < mMeteringAreas.size(); n++)
+  for ( unsigned int n = 0; n < numAreas; n++)
       {
       // transform the coordinates to 3A-type coordinates
-      mMeteringAreas.itemAt(n)->transfrom((size_t)mPreviewData->mWidth,
-                                      (size_t)mPreviewData->mHeight,
-                                      (size_t&)meteringAreas[0]->tAlgoAreas[n].nTop,
-                                      (size_t&)meteringAreas[0]->tAlgoAreas[n].nLeft,
-                                      (size_t&)meteringAreas[0]->tAlgoAreas[n].nWidth,
-                                      (size_t&)meteringAreas[0]->tAlgoAreas[n].nHeight);
-
-      meteringAreas[0]->tAlgoAreas[n].nLeft =
-              ( meteringAreas[0]->tAlgoAreas[n].nLeft * METERING_AREAS_RANGE ) / mPreviewData->mWidth;
-      meteringAreas[0]->tAlgoAreas[n].nTop =
-              ( meteringAreas[0]->tAlgoAreas[n].nTop* METERING_AREAS_RANGE ) / mPreviewData->mHeight;
-      meteringAreas[0]->tAlgoAreas[n].nWidth =
-              ( meteringAreas[0]->tAlgoAreas[n].nWidth * METERING_AREAS_RANGE ) / mPreviewData->mWidth;
-      meteringAreas[0]->tAlgoAreas[n].nHeight =
-              ( meteringAreas[0]->tAlgoAreas[n].nHeight * METERING_AREAS_RANGE ) / mPreviewData->mHeight;
-
-      meteringAreas[0]->tAlgoAreas[n].nPriority = mMeteringAreas.itemAt(n)->getWeight();
-
-      CAMHAL_LOGDB("Metering area %d : top = %d left = %d width = %d height = %d prio = %d",
-              n, (int)meteringAreas[0]->tAlgoAreas[n].nTop, (int)meteringAreas[0]->tAlgoAreas[n].nLeft,
-              (int)meteringAreas[0]->tAlgoAreas[n].nWidth, (int)meteringAreas[0]->tAlgoAreas[n].nHeight,
-              (int)meteringAreas[0]->tAlgoAreas[n].nPriority);
+      areas.itemAt(n)->transfrom((size_t)mPreviewData->mWidth,
+                                 (size_t)mPreviewData->mHeight,
+                                 top,
+                                 left,
+                                 width,
+                                 height);
+
+      area.nLeft = ( left * range ) / mPreviewData->mWidth;
+      area.nTop = ( top * range ) / mPreviewData->mHeight;
+      area.nWidth = ( width * range ) / mPreviewData->mWidth;
+      area.nHeight = ( height * range ) / mPreviewData->mHeight;
+      area.nPriority = areas.itemAt(n)->getWeight();
+
+      if ( 0 != memcmp(&algoAreas->tAlgoAreas[n], &area, sizeof(OMX_ALGOAREA)) )
+          {
+          algoAreas->tAlgoAreas[n] = area;
+          changed = true;
+          }
 
+      CAMHAL_LOGDB("Algo area %d/%d : top = %d left = %d width = %d height = %d prio = %d",
+              purpose, n, (int)area.nTop, (int)area.nLeft,
+              (int)area.nWidth, (int)area.nHeight, (int)area.nPriority);
+      }
+
+  // The component restarts the algorithm on every update,
+  // so only resend areas it doesn't run with already
+  if ( !changed && ( 0 <= mApplied3Asettings.indexOfKey(setting) ) )
+      {
+      CAMHAL_LOGDB("Algo areas %d unchanged, skipping", purpose);
+      mParamRPCsAvoided++;
+      LOG_FUNCTION_NAME_EXIT
+      return NO_ERROR;
       }
 
   OMX_INIT_STRUCT_PTR (&sharedBuffer, OMX_TI_CONFIG_SHAREDBUFFER);
 
   sharedBuffer.nPortIndex = OMX_ALL;
-  sharedBuffer.nSharedBuffSize = areasSize;
-  sharedBuffer.pSharedBuff = (OMX_U8 *) meteringAreas[0];
-
-  if ( NULL == sharedBuffer.pSharedBuff )
-      {
-      CAMHAL_LOGEA("No resources to allocate OMX shared buffer");
-      ret = -ENOMEM;
-      goto EXIT;
-      }
+  sharedBuffer.nSharedBuffSize = mAlgoAreasSize;
+  sharedBuffer.pSharedBuff = (OMX_U8 *) algoAreas;
 
-      eError =  OMX_SetConfig(mCameraAdapterParameters.mHandleComp,
-                                (OMX_INDEXTYPE) OMX_TI_IndexConfigAlgoAreas, &sharedBuffer);
+  eError =  OMX_SetConfig(mCameraAdapterParameters.mHandleComp,
+                            (OMX_INDEXTYPE) OMX_TI_IndexConfigAlgoAreas, &sharedBuffer);
 
   if ( OMX_ErrorNone != eError )
       {
-      CAMHAL_LOGEB("Error while setting Focus Areas configuration 0x%x", eError);
+      CAMHAL_LOGEB("Error while setting algo areas %d configuration 0x%x", purpose, eError);
+      mApplied3Asettings.removeItem(setting);
       ret = -EINVAL;
       }
   else
       {
-      CAMHAL_LOGDA("Metering Areas SetConfig successfull.");
+      CAMHAL_LOGDB("Algo areas %d SetConfig successfull.", purpose);
+      mApplied3Asettings.replaceValueFor(setting, numAreas);
       }
 
- EXIT:
-  if (NULL != meteringAreas)
-      {
-      memMgr.freeBuffer((void*) meteringAreas);
-      meteringAreas = NULL;
-      }
+  LOG_FUNCTION_NAME_EXIT
 
   return ret;
 }
 
-status_t OMXCameraAdapter::apply3Asettings( Gen3A_settings& Gen3A )
+//Returns the value a cacheable 3A setting would program into the component.
+//Focus and metering areas are compared by setAlgoAreas instead and the 3A
+//locks get toggled by the focus logic as well, so those are always applied.
+static bool get3AsettingValue(unsigned int setting, const Gen3A_settings &Gen3A, int &value)
+{
+    switch ( setting )
+        {
+        case SetEVCompensation:
+            value = Gen3A.EVCompensation;
+            break;
+        case SetWhiteBallance:
+            value = Gen3A.WhiteBallance;
+            break;
+        case SetFlicker:
+            value = Gen3A.Flicker;
+            break;
+        case SetBrightness:
+            value = ( int ) Gen3A.Brightness;
+            break;
+        case SetContrast:
+            value = Gen3A.Contrast;
+            break;
+        case SetSharpness:
+            value = Gen3A.Sharpness;
+            break;
+        case SetSaturation:
+            value = Gen3A.Saturation;
+            break;
+        case SetISO:
+            value = Gen3A.ISO;
+            break;
+        case SetEffect:
+            value = Gen3A.Effect;
+            break;
+        case SetExpMode:
+            value = Gen3A.Exposure;
+            break;
+        case SetFlash:
+            value = Gen3A.FlashMode;
+            break;
+        default:
+            return false;
+        }
+
+    return true;
+}
+
+void OMXCameraAdapter::invalidate3Asettings()
+{
+    Mutex::Autolock lock(m3ASettingsUpdateLock);
+
+    clearApplied3Asettings();
+}
+
+//Called with m3ASettingsUpdateLock held
+void OMXCameraAdapter::clearApplied3Asettings()
+{
+    mApplied3Asettings.clear();
+    mCurrentISOValid = false;
+
+    //The areas only get sent when pending, queue the ones set so far
+    //again so that the component doesn't keep running without them
+    {
+    Mutex::Autolock lock(mFocusAreasLock);
+    if ( !mFocusAreas.isEmpty() )
+        {
+        mPending3Asettings |= SetFocusAreas;
+        }
+    }
+
+    {
+    Mutex::Autolock lock(mMeteringAreasLock);
+    if ( !mMeteringAreas.isEmpty() )
+        {
+        mPending3Asettings |= SetMeteringAreas;
+        }
+    }
+}
+
+status_t OMXCameraAdapter::apply3Asettings( Gen3A_settings& Gen3A, unsigned int maxSettings )
 {
     status_t ret = NO_ERROR;
+    status_t stat;
     unsigned int currSett; // 32 bit
-    int portIndex;
+    unsigned int applied = 0;
+    bool areasApplied = false;
+    ssize_t idx;
+    int value;
 
     LOG_FUNCTION_NAME;
 
@@ -1608,6 +1909,8 @@ status_t OMXCameraAdapter::apply3Asettings( Gen3A_settings& Gen3A )
     if (SetSceneMode & mPending3Asettings) {
         mPending3Asettings &= ~SetSceneMode;
         ret |= setScene(Gen3A);
+        // the scene reprograms most of 3A behind our back
+        clearApplied3Asettings();
         // re-apply EV compensation after setting scene mode since it probably reset it
         if(Gen3A.EVCompensation) {
             setEVCompensation(Gen3A);
@@ -1616,7 +1919,8 @@ status_t OMXCameraAdapter::apply3Asettings( Gen3A_settings& Gen3A )
     } else if (OMX_Manual != Gen3A.SceneMode) {
         // only certain settings are allowed when scene mode is set
         mPending3Asettings &= (SetEVCompensation | SetFocus | SetWBLock |
-                               SetExpLock | SetWhiteBallance | SetFlash);
+                               SetExpLock | SetWhiteBallance | SetFlash |
+                               SetFocusAreas);
         if ( mPending3Asettings == 0 ) return NO_ERROR;
     }
 
@@ -1624,105 +1928,159 @@ status_t OMXCameraAdapter::apply3Asettings( Gen3A_settings& Gen3A )
         {
         if( currSett & mPending3Asettings )
             {
+            //Skip the RPC when the component already runs with this value
+            if ( get3AsettingValue(currSett, Gen3A, value) )
+                {
+                idx = mApplied3Asettings.indexOfKey(currSett);
+                if ( ( 0 <= idx ) && ( mApplied3Asettings.valueAt(idx) == value ) )
+                    {
+                    mPending3Asettings &= ~currSett;
+                    mParamRPCsAvoided++;
+                    continue;
+                    }
+                }
+
+            if ( ( 0 < maxSettings ) && ( applied >= maxSettings ) )
+                {
+                CAMHAL_LOGDB("Deferring 3A settings 0x%x to the next frame", mPending3Asettings);
+                break;
+                }
+
+            //Area updates restart the algorithms, a frame gets one at most.
+            //Areas changing meanwhile are coalesced into the pending one.
+            if ( ( 0 < maxSettings ) && areasApplied &&
+                 ( ( SetFocusAreas | SetMeteringAreas ) & currSett ) )
+                {
+                continue;
+                }
+
             switch( currSett )
                 {
                 case SetEVCompensation:
                     {
-                    ret |= setEVCompensation(Gen3A);
+                    stat = setEVCompensation(Gen3A);
                     break;
                     }
 
                 case SetWhiteBallance:
                     {
-                    ret |= setWBMode(Gen3A);
+                    stat = setWBMode(Gen3A);
                     break;
                     }
 
                 case SetFlicker:
                     {
-                    ret |= setFlicker(Gen3A);
+                    stat = setFlicker(Gen3A);
                     break;
                     }
 
                 case SetBrightness:
                     {
-                    ret |= setBrightness(Gen3A);
+                    stat = setBrightness(Gen3A);
                     break;
                     }
 
                 case SetContrast:
                     {
-                    ret |= setContrast(Gen3A);
+                    stat = setContrast(Gen3A);
                     break;
                     }
 
                 case SetSharpness:
                     {
-                    ret |= setSharpness(Gen3A);
+                    stat = setSharpness(Gen3A);
                     break;
                     }
 
                 case SetSaturation:
                     {
-                    ret |= setSaturation(Gen3A);
+                    stat = setSaturation(Gen3A);
                     break;
                     }
 
                 case SetISO:
                     {
-                    ret |= setISO(Gen3A);
+                    stat = setISO(Gen3A);
                     break;
                     }
 
                 case SetEffect:
                     {
-                    ret |= setEffect(Gen3A);
+                    stat = setEffect(Gen3A);
                     break;
                     }
 
                 case SetFocus:
                     {
-                    ret |= setFocusMode(Gen3A);
+                    stat = setFocusMode(Gen3A);
                     break;
                     }
 
                 case SetExpMode:
                     {
-                    ret |= setExposureMode(Gen3A);
+                    stat = setExposureMode(Gen3A);
                     break;
                     }
 
                 case SetFlash:
                     {
-                    ret |= setFlashMode(Gen3A);
+                    stat = setFlashMode(Gen3A);
                     break;
                     }
 
                 case SetExpLock:
                   {
-                    ret |= setExposureLock(Gen3A);
+                    stat = setExposureLock(Gen3A);
                     break;
                   }
 
                 case SetWBLock:
                   {
-                    ret |= setWhiteBalanceLock(Gen3A);
+                    stat = setWhiteBalanceLock(Gen3A);
                     break;
                   }
                 case SetMeteringAreas:
                   {
-                    ret |= setMeteringAreas(Gen3A);
+                    stat = setMeteringAreas(Gen3A);
+                    areasApplied = true;
+                  }
+                  break;
+                case SetFocusAreas:
+                  {
+                    stat = setTouchFocus();
+                    areasApplied = true;
                   }
                   break;
                 default:
                     CAMHAL_LOGEB("this setting (0x%x) is still not supported in CameraAdapter ",
                                  currSett);
+                    stat = NO_ERROR;
                     break;
                 }
+
+                if ( get3AsettingValue(currSett, Gen3A, value) )
+                    {
+                    if ( NO_ERROR == stat )
+                        {
+                        mApplied3Asettings.replaceValueFor(currSett, value);
+                        }
+                    else
+                        {
+                        mApplied3Asettings.removeItem(currSett);
+                        }
+                    }
+
+                ret |= stat;
+                applied++;
                 mPending3Asettings &= ~currSett;
             }
         }
 
+        if ( 0 < applied )
+            {
+            mCurrentISOValid = false;
+            }
+
         LOG_FUNCTION_NAME_EXIT;
 
         return ret;
@@ -34,6 +34,7 @@
 namespace android {
 
 status_t OMXCameraAdapter::setParametersAlgo(const CameraParameters &params,
+                                             const CameraParameterChanges &changes,
                                              BaseCameraAdapter::AdapterState state)
 {
     status_t ret = NO_ERROR;
@@ -251,7 +252,13 @@ status_t OMXCameraAdapter::setParametersAlgo(const CameraParameters &params,
 
     //Set Auto Convergence Mode
     valstr = params.get((const char *) TICameraParameters::KEY_AUTOCONVERGENCE);
-    if ( valstr != NULL )
+    if ( ( valstr != NULL ) &&
+         !changes.changed(TICameraParameters::KEY_AUTOCONVERGENCE) &&
+         !changes.changed(TICameraParameters::KEY_MANUALCONVERGENCE_VALUES) )
+        {
+        mParamRPCsAvoided++;
+        }
+    else if ( valstr != NULL )
         {
         // Set ManualConvergence default value
         OMX_S32 manualconvergence = -30;
@@ -672,6 +679,7 @@ status_t OMXCameraAdapter::setCaptureMode(OMXCameraAdapter::CaptureMode mode)
                 }
             else
                 {
+                mZslHistoryLen = zslHistoryLen.nHistoryLen;
                 CAMHAL_LOGDA("ZSL History len configured successfully");
                 }
             }
@@ -1171,6 +1179,7 @@ status_t OMXCameraAdapter::setVFramerate(OMX_U32 minFrameRate, OMX_U32 maxFrameR
             CAMHAL_LOGDB("VFR Configured Successfully [%d:%d]",
                         ( unsigned int ) minFrameRate,
                         ( unsigned int ) maxFrameRate);
+            mSensorFps.setExpectedRange(minFrameRate, maxFrameRate);
         }
     }
 
@@ -28,8 +28,8 @@
 #include <signal.h>
 #include <math.h>
 
+#include <cutils/atomic.h>
 #include <cutils/properties.h>
-#define UNLIKELY( exp ) (__builtin_expect( (exp) != 0, false ))
 static int mDebugFps = 0;
 static int mDebugFcs = 0;
 
@@ -44,9 +44,6 @@ namespace android {
 ///Maintain a separate tag for OMXCameraAdapter logs to isolate issues OMX specific
 #define LOG_TAG "CameraHAL"
 
-//frames skipped before recalculating the framerate
-#define FPS_PERIOD 30
-
 Mutex gAdapterLock;
 /*--------------------Camera Adapter Class STARTS here-----------------------------*/
 
@@ -71,6 +68,7 @@ status_t OMXCameraAdapter::initialize(CameraProperties::Properties* caps)
     mLocalVersionParam.s.nStep =  0x0;
 
     mPending3Asettings = 0;//E3AsettingsAll;
+    invalidate3Asettings();
     mPendingCaptureSettings = 0;
 
     if ( 0 != mInitSem.Count() )
@@ -169,6 +167,7 @@ status_t OMXCameraAdapter::initialize(CameraProperties::Properties* caps)
     mBracketingRange = 1;
     mLastBracetingBufferIdx = 0;
     mOMXStateSwitch = false;
+    mPreviewReconfigure = false;
 
     mCaptureSignalled = false;
     mCaptureConfigured = false;
@@ -185,13 +184,20 @@ status_t OMXCameraAdapter::initialize(CameraProperties::Properties* caps)
     mPictureQuality = 100;
     mCurrentZoomIdx = 0;
     mTargetZoomIdx = 0;
-    mPreviousZoomIndx = 0;
+    mPreviousZoomFactor = ZOOM_STEPS[0];
+    mZoomPosition = 0;
+    mZoomRampStart = 0;
+    mZoomRampStartTime = 0;
+    mZoomRampDuration = 0;
     mReturnZoomStatus = false;
     mZoomInc = 1;
     mZoomParameterIdx = 0;
     mExposureBracketingValidEntries = 0;
+    mExposureBracketMerge = false;
+    mTemporalNRFrames = 0;
     mSensorOverclock = false;
     mIternalRecordingHint = false;
+    mZslHistoryLen = 1;
 
     mDeviceOrientation = 0;
     mCapabilities = caps;
@@ -255,18 +261,32 @@ status_t OMXCameraAdapter::initialize(CameraProperties::Properties* caps)
         }
     }
 
-    //Remove any unhandled events
-    if (!mEventSignalQ.isEmpty()) {
-        for (unsigned int i = 0 ;i < mEventSignalQ.size(); i++ ) {
-            TIUTILS::Message *msg = mEventSignalQ.itemAt(i);
-            //remove from queue and free msg
-            if ( NULL != msg ) {
-                free(msg);
-            }
+    // initialize face detection handling thread
+    if(mFaceDetectionHandler.get() == NULL)
+        mFaceDetectionHandler = new FaceDetectionHandler(this);
+
+    if ( NULL == mFaceDetectionHandler.get() )
+    {
+        CAMHAL_LOGEA("Couldn't create face detection handler");
+        return NO_MEMORY;
+    }
+
+    ret = mFaceDetectionHandler->run("FaceDetectionThread", PRIORITY_DISPLAY);
+    if ( ret != NO_ERROR )
+    {
+        if( ret == INVALID_OPERATION){
+            CAMHAL_LOGDA("face detection handler thread already runnning!!");
+            ret = NO_ERROR;
+        }else
+        {
+            CAMHAL_LOGEA("Couldn't run face detection handler thread");
+            return ret;
         }
-        mEventSignalQ.clear();
     }
 
+    //Remove any unhandled events
+    flushEventWaiters(false);
+
     OMX_INIT_STRUCT_PTR (&mRegionPriority, OMX_TI_CONFIG_3A_REGION_PRIORITY);
     OMX_INIT_STRUCT_PTR (&mFacePriority, OMX_TI_CONFIG_3A_FACE_PRIORITY);
     mRegionPriority.nPortIndex = OMX_ALL;
@@ -276,11 +296,18 @@ status_t OMXCameraAdapter::initialize(CameraProperties::Properties* caps)
     //and will not conditionally apply based on current values.
     mFirstTimeInit = true;
 
+    mParamRPCsAvoided = 0;
+    mCurrentISO = 0;
+    mCurrentISOValid = false;
+    mCurrentISORead = false;
+    mCurrentISOFrames = 0;
+
     memset(mExposureBracketingValues, 0, EXP_BRACKET_RANGE*sizeof(int));
     mMeasurementEnabled = false;
     mFaceDetectionRunning = false;
     mFaceDetectionPaused = false;
     mFDSwitchAlgoPriority = false;
+    mFaceNumLastNotified = -1;
 
     memset(&mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mImagePortIndex], 0, sizeof(OMXCameraPortParameters));
     memset(&mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mPrevPortIndex], 0, sizeof(OMXCameraPortParameters));
@@ -394,7 +421,11 @@ status_t OMXCameraAdapter::fillThisBuffer(void* frameBuf, CameraFrame::FrameType
                     CAMHAL_LOGEB("OMX_FillThisBuffer 0x%x", eError);
                     goto EXIT;
                     }
-                mFramesWithDucati++;
+                //Only the preview port is balanced by the FBD
+                if ( port == &mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mPrevPortIndex] )
+                    {
+                    android_atomic_inc(&mFramesWithDucati);
+                    }
                 break;
                 }
             }
@@ -426,9 +457,15 @@ status_t OMXCameraAdapter::setParameters(const CameraParameters &params)
     const char *oldstr = NULL;
     int w, h;
     OMX_COLOR_FORMATTYPE pixFormat;
+    bool vfrUpdated = false;
+    uint32_t rpcsAvoided = mParamRPCsAvoided;
     BaseCameraAdapter::AdapterState state;
     BaseCameraAdapter::getState(state);
 
+    ///Keys that differ from the last applied parameters, everything
+    ///is considered changed on the first call after (re)initialization
+    CameraParameterChanges changes(params, mParams, mFirstTimeInit);
+
     ///@todo Include more camera parameters
     if ( (valstr = params.getPreviewFormat()) != NULL )
         {
@@ -483,13 +520,22 @@ status_t OMXCameraAdapter::setParameters(const CameraParameters &params)
             cap->mMinFrameRate = minFramerate;
             cap->mMaxFrameRate = maxFramerate;
             setVFramerate(cap->mMinFrameRate, cap->mMaxFrameRate);
+            vfrUpdated = true;
             }
         }
 
     // TODO(XXX): Limiting 1080p to (24,24) or (15,15) for now. Need to remove later.
     if ((w >= 1920) && (h >= 1080)) {
-        cap->mMaxFrameRate = cap->mMinFrameRate;
-        setVFramerate(cap->mMinFrameRate, cap->mMaxFrameRate);
+        // Already applied by a previous call unless something it depends on changed
+        if ( !vfrUpdated &&
+             ( cap->mMaxFrameRate == cap->mMinFrameRate ) &&
+             !changes.changed(CameraParameters::KEY_PREVIEW_SIZE) &&
+             !changes.changed(CameraParameters::KEY_PREVIEW_FRAME_RATE) ) {
+            mParamRPCsAvoided++;
+        } else {
+            cap->mMaxFrameRate = cap->mMinFrameRate;
+            setVFramerate(cap->mMinFrameRate, cap->mMaxFrameRate);
+        }
     }
 
     if ( 0 < frameRate )
@@ -571,17 +617,24 @@ status_t OMXCameraAdapter::setParameters(const CameraParameters &params)
 
     ret |= setParametersCapture(params, state);
 
-    ret |= setParameters3A(params, state);
+    ret |= setParameters3A(params, changes, state);
 
-    ret |= setParametersAlgo(params, state);
+    ret |= setParametersAlgo(params, changes, state);
 
-    ret |= setParametersFocus(params, state);
+    ret |= setParametersFocus(params, changes, state);
 
     ret |= setParametersFD(params, state);
 
     ret |= setParametersZoom(params, state);
 
-    ret |= setParametersEXIF(params, state);
+    ret |= setParametersEXIF(params, changes, state);
+
+    if ( rpcsAvoided != mParamRPCsAvoided )
+        {
+        CAMHAL_LOGDB("Skipped %u unchanged settings, %u in total",
+                     mParamRPCsAvoided - rpcsAvoided,
+                     mParamRPCsAvoided);
+        }
 
     mParams = params;
     mFirstTimeInit = false;
@@ -638,6 +691,7 @@ void OMXCameraAdapter::getParameters(CameraParameters& params)
     BaseCameraAdapter::AdapterState state;
     BaseCameraAdapter::getState(state);
     const char *valstr = NULL;
+    bool refreshISO;
     LOG_FUNCTION_NAME;
 
     if( mParameters3A.SceneMode != OMX_Manual ) {
@@ -691,19 +745,40 @@ void OMXCameraAdapter::getParameters(CameraParameters& params)
 
 #ifdef OMAP_ENHANCEMENT
 
-    OMX_INIT_STRUCT_PTR (&exp, OMX_CONFIG_EXPOSUREVALUETYPE);
-    exp.nPortIndex = OMX_ALL;
+    //A new value on every call would defeat the cached parameters in
+    //CameraHal, so the component is only asked when ISO may have moved.
+    //Auto exposure moves it without any 3A setting changing, the preview
+    //callback invalidates the value every few frames for that.
+    {
+    Mutex::Autolock lock(m3ASettingsUpdateLock);
+    refreshISO = !mCurrentISOValid;
+    mCurrentISOValid = true;
+    }
 
-    eError = OMX_GetConfig(mCameraAdapterParameters.mHandleComp,
-                           OMX_IndexConfigCommonExposureValue,
-                           &exp);
-    if ( OMX_ErrorNone == eError )
+    if ( refreshISO )
         {
-        params.set(TICameraParameters::KEY_CURRENT_ISO, exp.nSensitivity);
+        OMX_INIT_STRUCT_PTR (&exp, OMX_CONFIG_EXPOSUREVALUETYPE);
+        exp.nPortIndex = OMX_ALL;
+
+        eError = OMX_GetConfig(mCameraAdapterParameters.mHandleComp,
+                               OMX_IndexConfigCommonExposureValue,
+                               &exp);
+        if ( OMX_ErrorNone == eError )
+            {
+            mCurrentISO = exp.nSensitivity;
+            mCurrentISORead = true;
+            }
+        else
+            {
+            CAMHAL_LOGEB("OMX error 0x%x, while retrieving current ISO value", eError);
+            Mutex::Autolock lock(m3ASettingsUpdateLock);
+            mCurrentISOValid = false;
+            }
         }
-    else
+
+    if ( mCurrentISORead )
         {
-        CAMHAL_LOGEB("OMX error 0x%x, while retrieving current ISO value", eError);
+        params.set(TICameraParameters::KEY_CURRENT_ISO, mCurrentISO);
         }
 
 #endif
@@ -713,10 +788,9 @@ void OMXCameraAdapter::getParameters(CameraParameters& params)
     //Immediate zoom should not be avaialable while smooth zoom is running
     if ( ZOOM_ACTIVE & state )
         {
-        if ( mZoomParameterIdx != mCurrentZoomIdx )
-            {
-            mZoomParameterIdx += mZoomInc;
-            }
+        //The ramp can skip stages within a frame, the reported stage
+        //follows it instead of stepping on its own
+        mZoomParameterIdx = mCurrentZoomIdx;
         params.set( CameraParameters::KEY_ZOOM, mZoomParameterIdx);
         if ( ( mCurrentZoomIdx == mTargetZoomIdx ) &&
              ( mZoomParameterIdx == mCurrentZoomIdx ) )
@@ -1178,10 +1252,127 @@ status_t OMXCameraAdapter::switchToExecuting()
   return ret;
 }
 
+status_t OMXCameraAdapter::runTransition(const OMXTransitionStep *steps,
+                                         unsigned int count)
+{
+    status_t ret = NO_ERROR;
+    OMX_ERRORTYPE eError = OMX_ErrorNone;
+    unsigned int registered = 0;
+    unsigned int completed = 0;
+
+    LOG_FUNCTION_NAME;
+
+    if ( MAX_TRANSITION_STEPS < count )
+        {
+        CAMHAL_LOGEB("Too many transition steps %u", count);
+        return -EINVAL;
+        }
+
+    ///Every step waits on its own semaphore, so that a completion
+    ///can only ever satisfy the step it belongs to
+    for ( unsigned int i = 0 ; i < count ; i++ )
+        {
+        if ( 0 != mTransitionSem[i].Count() )
+            {
+            CAMHAL_LOGEB("Error transition semaphore %u count %d", i, mTransitionSem[i].Count());
+            return INVALID_OPERATION;
+            }
+        }
+
+    ///All events get registered upfront, the first command
+    ///can complete before the last one has been sent
+    for ( registered = 0 ; registered < count ; registered++ )
+        {
+        ret = RegisterForEvent(mCameraAdapterParameters.mHandleComp,
+                               OMX_EventCmdComplete,
+                               steps[registered].mCommand,
+                               steps[registered].mParam,
+                               mTransitionSem[registered]);
+        if ( NO_ERROR != ret )
+            {
+            CAMHAL_LOGEB("Error in registering for %s %d", steps[registered].mName, ret);
+            goto EXIT;
+            }
+        }
+
+    ///The component executes its commands in order, so each step starts
+    ///right after the previous one completes without a round trip to us
+    for ( unsigned int i = 0 ; i < count ; i++ )
+        {
+        eError = OMX_SendCommand(mCameraAdapterParameters.mHandleComp,
+                                 steps[i].mCommand,
+                                 steps[i].mParam,
+                                 NULL);
+        if ( OMX_ErrorNone != eError )
+            {
+            CAMHAL_LOGEB("OMX_SendCommand(%s) - %x", steps[i].mName, eError);
+            ret = ErrorUtils::omxToAndroidError(eError);
+            goto EXIT;
+            }
+        }
+
+    for ( completed = 0 ; completed < count ; completed++ )
+        {
+        ret = mTransitionSem[completed].WaitTimeout(OMX_CMD_TIMEOUT);
+
+        //If somethiing bad happened while we wait
+        if ( mComponentState == OMX_StateInvalid )
+            {
+            CAMHAL_LOGEB("Invalid State during %s Exitting!!!", steps[completed].mName);
+            ret = INVALID_OPERATION;
+            goto EXIT;
+            }
+
+        if ( NO_ERROR != ret )
+            {
+            CAMHAL_LOGEB("Timeout expired on %s", steps[completed].mName);
+            goto EXIT;
+            }
+
+        //Keep the state in line with the component after every step,
+        //a failure further down the chain leaves it where it stopped
+        if ( OMX_CommandStateSet == steps[completed].mCommand )
+            {
+            mComponentState = ( OMX_STATETYPE ) steps[completed].mParam;
+            }
+
+        CAMHAL_LOGDB("%s done", steps[completed].mName);
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+
+EXIT:
+
+    //Completed steps already dropped their waiters
+    for ( unsigned int i = completed ; i < registered ; i++ )
+        {
+        RemoveEvent(mCameraAdapterParameters.mHandleComp,
+                    OMX_EventCmdComplete,
+                    steps[i].mCommand,
+                    steps[i].mParam,
+                    NULL);
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+status_t OMXCameraAdapter::prepareReconfigure()
+{
+  LOG_FUNCTION_NAME;
+
+  mPreviewReconfigure = true;
+
+  LOG_FUNCTION_NAME_EXIT;
+  return NO_ERROR;
+}
+
 status_t OMXCameraAdapter::doSwitchToExecuting()
 {
   status_t ret = NO_ERROR;
-  OMX_ERRORTYPE eError = OMX_ErrorNone;
   LOG_FUNCTION_NAME;
 
   if ( (mComponentState == OMX_StateExecuting) || (mComponentState == OMX_StateInvalid) ){
@@ -1190,80 +1381,22 @@ status_t OMXCameraAdapter::doSwitchToExecuting()
     return NO_ERROR;
   }
 
-  if ( 0 != mSwitchToExecSem.Count() ){
-    CAMHAL_LOGEB("Error mSwitchToExecSem semaphore count %d", mSwitchToExecSem.Count());
-    goto EXIT;
-  }
-
-  ///Register for Preview port DISABLE  event
-  ret = RegisterForEvent(mCameraAdapterParameters.mHandleComp,
-                         OMX_EventCmdComplete,
-                         OMX_CommandPortDisable,
-                         mCameraAdapterParameters.mPrevPortIndex,
-                         mSwitchToExecSem);
-  if ( NO_ERROR != ret ){
-    CAMHAL_LOGEB("Error in registering Port Disable for event %d", ret);
-    goto EXIT;
-  }
-  ///Disable Preview Port
-  eError = OMX_SendCommand(mCameraAdapterParameters.mHandleComp,
-                           OMX_CommandPortDisable,
-                           mCameraAdapterParameters.mPrevPortIndex,
-                           NULL);
-  ret = mSwitchToExecSem.WaitTimeout(OMX_CMD_TIMEOUT);
-  if (ret != NO_ERROR){
-    CAMHAL_LOGEB("Timeout PREVIEW PORT DISABLE %d", ret);
-  }
-
-  CAMHAL_LOGVB("PREV PORT DISABLED %d", ret);
-
-  ///Register for IDLE state switch event
-  ret = RegisterForEvent(mCameraAdapterParameters.mHandleComp,
-                         OMX_EventCmdComplete,
-                         OMX_CommandStateSet,
-                         OMX_StateIdle,
-                         mSwitchToExecSem);
-  if(ret!=NO_ERROR)
+  {
+  ///Preview port disable, LOADED->IDLE and IDLE->EXECUTING need nothing
+  ///from us in between, so they go out together
+  const OMXTransitionStep steps[] =
     {
-      CAMHAL_LOGEB("Error in IDLE STATE SWITCH %d", ret);
-      goto EXIT;
-    }
-  eError = OMX_SendCommand (mCameraAdapterParameters.mHandleComp ,
-                            OMX_CommandStateSet,
-                            OMX_StateIdle,
-                            NULL);
-  GOTO_EXIT_IF((eError!=OMX_ErrorNone), eError);
-  ret = mSwitchToExecSem.WaitTimeout(OMX_CMD_TIMEOUT);
-  if (ret != NO_ERROR){
-    CAMHAL_LOGEB("Timeout IDLE STATE SWITCH %d", ret);
-    goto EXIT;
+      { OMX_CommandPortDisable, mCameraAdapterParameters.mPrevPortIndex, "PREVIEW PORT DISABLE" },
+      { OMX_CommandStateSet, OMX_StateIdle, "IDLE STATE SWITCH" },
+      { OMX_CommandStateSet, OMX_StateExecuting, "EXEC STATE SWITCH" },
+    };
+
+  ret = runTransition(steps, sizeof(steps) / sizeof(steps[0]));
   }
-  mComponentState = OMX_StateIdle;
-  CAMHAL_LOGVB("OMX_SendCommand(OMX_StateIdle) 0x%x", eError);
-
-  ///Register for EXECUTING state switch event
-  ret = RegisterForEvent(mCameraAdapterParameters.mHandleComp,
-                         OMX_EventCmdComplete,
-                         OMX_CommandStateSet,
-                         OMX_StateExecuting,
-                         mSwitchToExecSem);
-  if(ret!=NO_ERROR)
-    {
-      CAMHAL_LOGEB("Error in EXECUTING STATE SWITCH %d", ret);
-      goto EXIT;
-    }
-  eError = OMX_SendCommand (mCameraAdapterParameters.mHandleComp ,
-                            OMX_CommandStateSet,
-                            OMX_StateExecuting,
-                            NULL);
-  GOTO_EXIT_IF((eError!=OMX_ErrorNone), eError);
-  ret = mSwitchToExecSem.WaitTimeout(OMX_CMD_TIMEOUT);
-  if (ret != NO_ERROR){
-    CAMHAL_LOGEB("Timeout EXEC STATE SWITCH %d", ret);
+  if ( NO_ERROR != ret ){
     goto EXIT;
   }
-  mComponentState = OMX_StateExecuting;
-  CAMHAL_LOGVB("OMX_SendCommand(OMX_StateExecuting) 0x%x", eError);
+  CAMHAL_LOGVA("Switched to OMX_StateExecuting");
 
   mStateSwitchLock.unlock();
 
@@ -1271,17 +1404,16 @@ status_t OMXCameraAdapter::doSwitchToExecuting()
   return ret;
 
  EXIT:
-  CAMHAL_LOGEB("Exiting function %s because of ret %d eError=%x", __FUNCTION__, ret, eError);
+  CAMHAL_LOGEB("Exiting function %s because of ret %d", __FUNCTION__, ret);
   performCleanupAfterError();
   mStateSwitchLock.unlock();
   LOG_FUNCTION_NAME_EXIT;
-  return (ret | ErrorUtils::omxToAndroidError(eError));
+  return ret;
 }
 
 status_t OMXCameraAdapter::switchToLoaded()
 {
     status_t ret = NO_ERROR;
-    OMX_ERRORTYPE eError = OMX_ErrorNone;
 
     LOG_FUNCTION_NAME;
 
@@ -1293,176 +1425,35 @@ status_t OMXCameraAdapter::switchToLoaded()
         return NO_ERROR;
         }
 
-    if ( 0 != mSwitchToLoadedSem.Count() )
-        {
-        CAMHAL_LOGEB("Error mSwitchToLoadedSem semaphore count %d", mSwitchToLoadedSem.Count());
-        goto EXIT;
-        }
-
-    ///Register for EXECUTING state transition.
-    ///This method just inserts a message in Event Q, which is checked in the callback
-    ///The sempahore passed is signalled by the callback
-    ret = RegisterForEvent(mCameraAdapterParameters.mHandleComp,
-                           OMX_EventCmdComplete,
-                           OMX_CommandStateSet,
-                           OMX_StateIdle,
-                           mSwitchToLoadedSem);
-
-    if(ret!=NO_ERROR)
-        {
-        CAMHAL_LOGEB("Error in registering for event %d", ret);
-        goto EXIT;
-        }
-
-    eError = OMX_SendCommand (mCameraAdapterParameters.mHandleComp,
-                              OMX_CommandStateSet,
-                              OMX_StateIdle,
-                              NULL);
-
-    if(eError!=OMX_ErrorNone)
-        {
-        CAMHAL_LOGEB("OMX_SendCommand(OMX_StateIdle) - %x", eError);
-        }
-
-    GOTO_EXIT_IF((eError!=OMX_ErrorNone), eError);
-
-    ///Wait for the EXECUTING ->IDLE transition to arrive
-
-    CAMHAL_LOGDA("EXECUTING->IDLE state changed");
-    ret = mSwitchToLoadedSem.WaitTimeout(OMX_CMD_TIMEOUT);
-
-    //If somethiing bad happened while we wait
-    if (mComponentState == OMX_StateInvalid)
-      {
-        CAMHAL_LOGEA("Invalid State after EXECUTING->IDLE Exitting!!!");
-        goto EXIT;
-      }
-
-    if ( NO_ERROR == ret )
-        {
-        CAMHAL_LOGDA("EXECUTING->IDLE state changed");
-        }
-    else
-        {
-        ret |= RemoveEvent(mCameraAdapterParameters.mHandleComp,
-                           OMX_EventCmdComplete,
-                           OMX_CommandStateSet,
-                           OMX_StateIdle,
-                           NULL);
-        CAMHAL_LOGEA("Timeout expired on EXECUTING->IDLE state change");
-        goto EXIT;
-        }
-
-    ///Register for LOADED state transition.
-    ///This method just inserts a message in Event Q, which is checked in the callback
-    ///The sempahore passed is signalled by the callback
-    ret = RegisterForEvent(mCameraAdapterParameters.mHandleComp,
-                           OMX_EventCmdComplete,
-                           OMX_CommandStateSet,
-                           OMX_StateLoaded,
-                           mSwitchToLoadedSem);
-
-    if(ret!=NO_ERROR)
-        {
-        CAMHAL_LOGEB("Error in registering for event %d", ret);
-        goto EXIT;
-        }
-
-    eError = OMX_SendCommand (mCameraAdapterParameters.mHandleComp,
-                              OMX_CommandStateSet,
-                              OMX_StateLoaded,
-                              NULL);
-
-    if(eError!=OMX_ErrorNone)
         {
-        CAMHAL_LOGEB("OMX_SendCommand(OMX_StateLoaded) - %x", eError);
-        }
-    GOTO_EXIT_IF((eError!=OMX_ErrorNone), eError);
-
-    CAMHAL_LOGDA("Switching IDLE->LOADED state");
-    ret = mSwitchToLoadedSem.WaitTimeout(OMX_CMD_TIMEOUT);
-
-    //If somethiing bad happened while we wait
-    if (mComponentState == OMX_StateInvalid)
-      {
-        CAMHAL_LOGEA("Invalid State after IDLE->LOADED Exitting!!!");
-        goto EXIT;
-      }
+        ///The preview buffers are already gone with the disabled preview
+        ///port, so EXECUTING->IDLE->LOADED and the port enable can all
+        ///be queued at once
+        const OMXTransitionStep steps[] =
+            {
+            { OMX_CommandStateSet, OMX_StateIdle, "EXECUTING->IDLE state change" },
+            { OMX_CommandStateSet, OMX_StateLoaded, "IDLE->LOADED state change" },
+            { OMX_CommandPortEnable, mCameraAdapterParameters.mPrevPortIndex, "Preview port enable" },
+            };
 
-    if ( NO_ERROR == ret )
-        {
-        CAMHAL_LOGDA("IDLE->LOADED state changed");
-        }
-    else
-        {
-        ret |= RemoveEvent(mCameraAdapterParameters.mHandleComp,
-                           OMX_EventCmdComplete,
-                           OMX_CommandStateSet,
-                           OMX_StateLoaded,
-                           NULL);
-        CAMHAL_LOGEA("Timeout expired on IDLE->LOADED state change");
-        goto EXIT;
+        ret = runTransition(steps, sizeof(steps) / sizeof(steps[0]));
         }
 
-    mComponentState = OMX_StateLoaded;
-
-    ///Register for Preview port ENABLE event
-    ret = RegisterForEvent(mCameraAdapterParameters.mHandleComp,
-                           OMX_EventCmdComplete,
-                           OMX_CommandPortEnable,
-                           mCameraAdapterParameters.mPrevPortIndex,
-                           mSwitchToLoadedSem);
-
     if ( NO_ERROR != ret )
         {
-        CAMHAL_LOGEB("Error in registering for event %d", ret);
         goto EXIT;
         }
 
-    ///Enable Preview Port
-    eError = OMX_SendCommand(mCameraAdapterParameters.mHandleComp,
-                             OMX_CommandPortEnable,
-                             mCameraAdapterParameters.mPrevPortIndex,
-                             NULL);
-
-
-    CAMHAL_LOGDB("OMX_SendCommand(OMX_CommandStateSet) 0x%x", eError);
-    GOTO_EXIT_IF((eError!=OMX_ErrorNone), eError);
-
-    CAMHAL_LOGDA("Enabling Preview port");
-    ///Wait for state to switch to idle
-    ret = mSwitchToLoadedSem.WaitTimeout(OMX_CMD_TIMEOUT);
+    CAMHAL_LOGDA("Preview port enabled!");
 
-    //If somethiing bad happened while we wait
-    if (mComponentState == OMX_StateInvalid)
-      {
-        CAMHAL_LOGEA("Invalid State after Enabling Preview port Exitting!!!");
-        goto EXIT;
-      }
-
-    if ( NO_ERROR == ret )
-        {
-        CAMHAL_LOGDA("Preview port enabled!");
-        }
-    else
-        {
-        ret |= RemoveEvent(mCameraAdapterParameters.mHandleComp,
-                           OMX_EventCmdComplete,
-                           OMX_CommandPortEnable,
-                           mCameraAdapterParameters.mPrevPortIndex,
-                           NULL);
-        CAMHAL_LOGEA("Preview enable timedout");
-
-        goto EXIT;
-        }
-
-    return (ret | ErrorUtils::omxToAndroidError(eError));
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
 
 EXIT:
-    CAMHAL_LOGEB("Exiting function %s because of ret %d eError=%x", __FUNCTION__, ret, eError);
+    CAMHAL_LOGEB("Exiting function %s because of ret %d", __FUNCTION__, ret);
     performCleanupAfterError();
     LOG_FUNCTION_NAME_EXIT;
-    return (ret | ErrorUtils::omxToAndroidError(eError));
+    return ret;
 }
 
 status_t OMXCameraAdapter::UseBuffersPreview(void* bufArr, int num)
@@ -1501,6 +1492,21 @@ status_t OMXCameraAdapter::UseBuffersPreview(void* bufArr, int num)
         return BAD_VALUE;
         }
 
+    ///The component may have been kept executing during a preview
+    ///reconfiguration, settings changed since then need LOADED
+    if ( mOMXStateSwitch && ( OMX_StateLoaded != mComponentState ) )
+        {
+        ret = switchToLoaded();
+        if ( NO_ERROR != ret )
+            {
+            CAMHAL_LOGEB("switchToLoaded() failed 0x%x", ret);
+            LOG_FUNCTION_NAME_EXIT;
+            return ret;
+            }
+
+        mOMXStateSwitch = false;
+        }
+
     mStateSwitchLock.lock();
 
     if ( mComponentState == OMX_StateLoaded )
@@ -1779,6 +1785,9 @@ status_t OMXCameraAdapter::startPreview()
     mPreviewData = &mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mPrevPortIndex];
     measurementData = &mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mMeasurementPortIndex];
 
+    //Only a stop right before this start may keep the component executing
+    mPreviewReconfigure = false;
+
     if( OMX_StateIdle == mComponentState )
         {
         ///Register for EXECUTING state transition.
@@ -1838,6 +1847,7 @@ status_t OMXCameraAdapter::startPreview()
 
     mStateSwitchLock.unlock();
 
+    invalidate3Asettings();
     apply3Asettings(mParameters3A);
     //Queue all the buffers on preview port
     for(int index=0;index< mPreviewData->mMaxQueueable;index++)
@@ -1849,7 +1859,7 @@ status_t OMXCameraAdapter::startPreview()
             {
             CAMHAL_LOGEB("OMX_FillThisBuffer-0x%x", eError);
             }
-        mFramesWithDucati++;
+        android_atomic_inc(&mFramesWithDucati);
 #ifdef DEGUG_LOG
         mBuffersWithDucati.add((uint32_t)mPreviewData->mBufferHeader[index]->pBuffer,1);
 #endif
@@ -1890,9 +1900,9 @@ status_t OMXCameraAdapter::startPreview()
         ret = setFocusCallback(true);
     }
 
-    //reset frame rate estimates
-    mFPS = 0.0f;
-    mLastFPS = 0.0f;
+    //a non zero debug.camera.showfps logs the frame rate report every so many seconds
+    mSensorFps.setReportPeriod(s2ns(mDebugFps));
+
     // start frame count from 0. i.e first frame after
     // startPreview will be the 0th reference frame
     // this way we will wait for second frame until
@@ -1901,9 +1911,6 @@ status_t OMXCameraAdapter::startPreview()
     // calling after the first frame and not failing
     // after the second frame
     mFrameCount = -1;
-    mLastFrameCount = 0;
-    mIter = 1;
-    mLastFPSTime = systemTime();
 
     LOG_FUNCTION_NAME_EXIT;
 
@@ -2006,8 +2013,6 @@ status_t OMXCameraAdapter::stopPreview()
         goto EXIT;
     }
 
-    CAMHAL_LOGDB("Average framerate: %f", mFPS);
-
     //Avoid state switching of the OMX Component
     ret = flushBuffers();
     if ( NO_ERROR != ret )
@@ -2096,7 +2101,17 @@ status_t OMXCameraAdapter::stopPreview()
         mPreviewBuffersAvailable.clear();
         }
 
-    switchToLoaded();
+    ///Settings which can only change in LOADED, and the measurement port
+    ///which stays enabled, still need the full state cycle
+    if ( mPreviewReconfigure && !mOMXStateSwitch && !mMeasurementEnabled )
+        {
+        CAMHAL_LOGDA("Reconfiguring preview, component stays executing");
+        }
+    else
+        {
+        switchToLoaded();
+        }
+    mPreviewReconfigure = false;
 
 
     mFirstTimeInit = true;
@@ -2104,6 +2119,7 @@ status_t OMXCameraAdapter::stopPreview()
     mFramesWithDucati = 0;
     mFramesWithDisplay = 0;
     mFramesWithEncoder = 0;
+    resetPreviewBufferUsage();
 
     LOG_FUNCTION_NAME_EXIT;
 
@@ -2644,25 +2660,7 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterEventHandler(OMX_IN OMX_HANDLETY
                 Remove any unhandled events and
                 unblock any waiting semaphores
                 */
-                if ( !mEventSignalQ.isEmpty() )
-                  {
-                    for (unsigned int i = 0 ; i < mEventSignalQ.size(); i++ )
-                      {
-                        CAMHAL_LOGEB("***Removing %d EVENTS***** \n", mEventSignalQ.size());
-                        //remove from queue and free msg
-                        TIUTILS::Message *msg = mEventSignalQ.itemAt(i);
-                        if ( NULL != msg )
-                          {
-                            Semaphore *sem  = (Semaphore*) msg->arg3;
-                            if ( sem )
-                              {
-                                sem->Signal();
-                              }
-                            free(msg);
-                          }
-                      }
-                    mEventSignalQ.clear();
-                  }
+                flushEventWaiters(true);
                 ///Report Error to App
                 mErrorNotifier->errorNotify(CAMERA_ERROR_FATAL);
               }
@@ -2706,47 +2704,111 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterEventHandler(OMX_IN OMX_HANDLETY
     return eError;
 }
 
-OMX_ERRORTYPE OMXCameraAdapter::SignalEvent(OMX_IN OMX_HANDLETYPE hComponent,
-                                          OMX_IN OMX_EVENTTYPE eEvent,
-                                          OMX_IN OMX_U32 nData1,
-                                          OMX_IN OMX_U32 nData2,
-                                          OMX_IN OMX_PTR pEventData)
+//Waiters registered for OMX_ALL match the event on any port
+static inline bool eventDataMatches(OMX_U32 registered, OMX_U32 data)
+{
+    return ( registered == data ) || ( registered == ( OMX_U32 ) OMX_ALL );
+}
+
+static inline unsigned int eventWaiterBucket(OMX_EVENTTYPE eEvent, OMX_U32 nData2, unsigned int buckets)
+{
+    return ( ( ( unsigned int ) eEvent * 31 ) ^ ( unsigned int ) nData2 ) % buckets;
+}
+
+void OMXCameraAdapter::initEventWaiters()
 {
     Mutex::Autolock lock(mEventLock);
-    TIUTILS::Message *msg;
-    bool eventSignalled = false;
 
-    LOG_FUNCTION_NAME;
+    mFreeEventWaiters = NULL;
+    for ( int i = EVENT_WAITERS_MAX - 1 ; i >= 0 ; i-- )
+        {
+        mEventWaiters[i].mSemaphore = NULL;
+        mEventWaiters[i].mNext = mFreeEventWaiters;
+        mFreeEventWaiters = &mEventWaiters[i];
+        }
 
-    if ( !mEventSignalQ.isEmpty() )
+    for ( int i = 0 ; i < EVENT_WAITER_BUCKETS ; i++ )
         {
-        CAMHAL_LOGDA("Event queue not empty");
+        mEventWaiterBuckets[i] = NULL;
+        }
+}
 
-        for ( unsigned int i = 0 ; i < mEventSignalQ.size() ; i++ )
+void OMXCameraAdapter::flushEventWaiters(bool signal)
+{
+    Mutex::Autolock lock(mEventLock);
+    OMXEventWaiter *waiter;
+
+    for ( int i = 0 ; i < EVENT_WAITER_BUCKETS ; i++ )
+        {
+        while ( NULL != mEventWaiterBuckets[i] )
             {
-            msg = mEventSignalQ.itemAt(i);
-            if ( NULL != msg )
+            waiter = mEventWaiterBuckets[i];
+            mEventWaiterBuckets[i] = waiter->mNext;
+
+            CAMHAL_LOGDB("Removing unhandled event 0x%x 0x%x 0x%x",
+                         waiter->mEvent,
+                         ( unsigned int ) waiter->mData1,
+                         ( unsigned int ) waiter->mData2);
+
+            if ( signal && ( NULL != waiter->mSemaphore ) )
                 {
-                if( ( msg->command != 0 || msg->command == ( unsigned int ) ( eEvent ) )
-                    && ( !msg->arg1 || ( OMX_U32 ) msg->arg1 == nData1 )
-                    && ( !msg->arg2 || ( OMX_U32 ) msg->arg2 == nData2 )
-                    && msg->arg3)
-                    {
-                    Semaphore *sem  = (Semaphore*) msg->arg3;
-                    CAMHAL_LOGDA("Event matched, signalling sem");
-                    mEventSignalQ.removeAt(i);
-                    //Signal the semaphore provided
-                    sem->Signal();
-                    free(msg);
-                    eventSignalled = true;
-                    break;
-                    }
+                waiter->mSemaphore->Signal();
                 }
+
+            waiter->mSemaphore = NULL;
+            waiter->mNext = mFreeEventWaiters;
+            mFreeEventWaiters = waiter;
             }
         }
-    else
+}
+
+//Unlinks the oldest waiter matching the event, the caller holds mEventLock
+//and returns the node to the free list
+OMXCameraAdapter::OMXEventWaiter *OMXCameraAdapter::takeEventWaiter(OMX_EVENTTYPE eEvent,
+                                                                    OMX_U32 nData1,
+                                                                    OMX_U32 nData2)
+{
+    OMXEventWaiter **link;
+    OMXEventWaiter *waiter;
+
+    link = &mEventWaiterBuckets[eventWaiterBucket(eEvent, nData2, EVENT_WAITER_BUCKETS)];
+    for ( waiter = *link ; NULL != waiter ; link = &waiter->mNext, waiter = *link )
         {
-        CAMHAL_LOGDA("Event queue empty!!!");
+        if ( ( waiter->mEvent == eEvent ) &&
+             ( waiter->mData2 == nData2 ) &&
+             eventDataMatches(waiter->mData1, nData1) )
+            {
+            *link = waiter->mNext;
+            waiter->mNext = NULL;
+            return waiter;
+            }
+        }
+
+    return NULL;
+}
+
+OMX_ERRORTYPE OMXCameraAdapter::SignalEvent(OMX_IN OMX_HANDLETYPE hComponent,
+                                          OMX_IN OMX_EVENTTYPE eEvent,
+                                          OMX_IN OMX_U32 nData1,
+                                          OMX_IN OMX_U32 nData2,
+                                          OMX_IN OMX_PTR pEventData)
+{
+    Mutex::Autolock lock(mEventLock);
+    OMXEventWaiter *waiter;
+    bool eventSignalled = false;
+
+    LOG_FUNCTION_NAME;
+
+    waiter = takeEventWaiter(eEvent, nData1, nData2);
+    if ( NULL != waiter )
+        {
+        CAMHAL_LOGDA("Event matched, signalling sem");
+        //Signal the semaphore provided
+        waiter->mSemaphore->Signal();
+        waiter->mSemaphore = NULL;
+        waiter->mNext = mFreeEventWaiters;
+        mFreeEventWaiters = waiter;
+        eventSignalled = true;
         }
 
     // Special handling for any unregistered events
@@ -2774,35 +2836,20 @@ OMX_ERRORTYPE OMXCameraAdapter::RemoveEvent(OMX_IN OMX_HANDLETYPE hComponent,
                                             OMX_IN OMX_PTR pEventData)
 {
   Mutex::Autolock lock(mEventLock);
-  TIUTILS::Message *msg;
+  OMXEventWaiter *waiter;
   LOG_FUNCTION_NAME;
 
-  if ( !mEventSignalQ.isEmpty() )
+  waiter = takeEventWaiter(eEvent, nData1, nData2);
+  if ( NULL != waiter )
     {
-      CAMHAL_LOGDA("Event queue not empty");
-
-      for ( unsigned int i = 0 ; i < mEventSignalQ.size() ; i++ )
-        {
-          msg = mEventSignalQ.itemAt(i);
-          if ( NULL != msg )
-            {
-              if( ( msg->command != 0 || msg->command == ( unsigned int ) ( eEvent ) )
-                  && ( !msg->arg1 || ( OMX_U32 ) msg->arg1 == nData1 )
-                  && ( !msg->arg2 || ( OMX_U32 ) msg->arg2 == nData2 )
-                  && msg->arg3)
-                {
-                  Semaphore *sem  = (Semaphore*) msg->arg3;
-                  CAMHAL_LOGDA("Event matched, signalling sem");
-                  mEventSignalQ.removeAt(i);
-                  free(msg);
-                  break;
-                }
-            }
-        }
+      CAMHAL_LOGDA("Event matched, removing waiter");
+      waiter->mSemaphore = NULL;
+      waiter->mNext = mFreeEventWaiters;
+      mFreeEventWaiters = waiter;
     }
   else
     {
-      CAMHAL_LOGEA("Event queue empty!!!");
+      CAMHAL_LOGEA("Event not registered!!!");
     }
   LOG_FUNCTION_NAME_EXIT;
 
@@ -2817,25 +2864,35 @@ status_t OMXCameraAdapter::RegisterForEvent(OMX_IN OMX_HANDLETYPE hComponent,
                                           OMX_IN Semaphore &semaphore)
 {
     status_t ret = NO_ERROR;
-    ssize_t res;
+    OMXEventWaiter **link;
+    OMXEventWaiter *waiter;
     Mutex::Autolock lock(mEventLock);
 
     LOG_FUNCTION_NAME;
-    TIUTILS::Message * msg = ( struct TIUTILS::Message * ) malloc(sizeof(struct TIUTILS::Message));
-    if ( NULL != msg )
+
+    waiter = mFreeEventWaiters;
+    if ( NULL == waiter )
         {
-        msg->command = ( unsigned int ) eEvent;
-        msg->arg1 = ( void * ) nData1;
-        msg->arg2 = ( void * ) nData2;
-        msg->arg3 = ( void * ) &semaphore;
-        msg->arg4 =  ( void * ) hComponent;
-        res = mEventSignalQ.add(msg);
-        if ( NO_MEMORY == res )
+        CAMHAL_LOGEA("No ressources for inserting OMX events");
+        ret = -ENOMEM;
+        }
+    else
+        {
+        mFreeEventWaiters = waiter->mNext;
+
+        waiter->mEvent = eEvent;
+        waiter->mData1 = nData1;
+        waiter->mData2 = nData2;
+        waiter->mSemaphore = &semaphore;
+        waiter->mNext = NULL;
+
+        //Append, so that identical events wake their waiters in order
+        link = &mEventWaiterBuckets[eventWaiterBucket(eEvent, nData2, EVENT_WAITER_BUCKETS)];
+        while ( NULL != *link )
             {
-            CAMHAL_LOGEA("No ressources for inserting OMX events");
-            free(msg);
-            ret = -ENOMEM;
+            link = &( *link )->mNext;
             }
+        *link = waiter;
         }
 
     LOG_FUNCTION_NAME_EXIT;
@@ -2876,24 +2933,6 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterEmptyBufferDone(OMX_IN OMX_HANDL
    return OMX_ErrorNone;
 }
 
-static void debugShowFPS()
-{
-    static int mFrameCount = 0;
-    static int mLastFrameCount = 0;
-    static nsecs_t mLastFpsTime = 0;
-    static float mFps = 0;
-    mFrameCount++;
-    if (!(mFrameCount & 0x1F)) {
-        nsecs_t now = systemTime();
-        nsecs_t diff = now - mLastFpsTime;
-        mFps = ((mFrameCount - mLastFrameCount) * float(s2ns(1))) / diff;
-        mLastFpsTime = now;
-        mLastFrameCount = mFrameCount;
-        ALOGD("Camera %d Frames, %f FPS", mFrameCount, mFps);
-    }
-    // XXX: mFPS has the value we want
-}
-
 /*========================================================*/
 /* @ fn SampleTest_FillBufferDone ::  Application callback*/
 /*========================================================*/
@@ -2904,10 +2943,6 @@ OMX_ERRORTYPE OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLETYPE hComponent,
     TIUTILS::Message msg;
     OMX_ERRORTYPE eError = OMX_ErrorNone;
 
-    if (UNLIKELY(mDebugFps)) {
-        debugShowFPS();
-    }
-
     OMXCameraAdapter *adapter =  ( OMXCameraAdapter * ) pAppData;
     if ( NULL != adapter )
         {
@@ -2936,7 +2971,6 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
     BaseCameraAdapter::AdapterState state, nextState;
     BaseCameraAdapter::getState(state);
     BaseCameraAdapter::getNextState(nextState);
-    sp<CameraFDResult> fdResult = NULL;
     unsigned int mask = 0xFFFF;
     CameraFrame cameraFrame;
     OMX_TI_PLATFORMPRIVATE *platformPrivate;
@@ -2952,6 +2986,8 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
         return OMX_ErrorNone;
     }
 
+    CameraFrameStats::frameReached(&cameraFrame, CameraFrame::STAGE_FILLED);
+
     if (pBuffHeader->nOutputPortIndex == OMX_CAMERA_PORT_VIDEO_OUT_PREVIEW)
         {
 
@@ -2974,29 +3010,21 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
                 }
             }
 
-        recalculateFPS();
-            {
-            Mutex::Autolock lock(mFaceDetectionLock);
-            if ( mFaceDetectionRunning && !mFaceDetectionPaused ) {
-                detectFaces(pBuffHeader, fdResult, pPortParam->mWidth, pPortParam->mHeight);
-                if ( NULL != fdResult.get() ) {
-                    notifyFaceSubscribers(fdResult);
-                    fdResult.clear();
-                }
-                if ( mFDSwitchAlgoPriority ) {
+        recalculateFPS(pBuffHeader->nTimeStamp * 1000);
 
-                    //Disable region priority and enable face priority for AF
-                    setAlgoPriority(REGION_PRIORITY, FOCUS_ALGO, false);
-                    setAlgoPriority(FACE_PRIORITY, FOCUS_ALGO , true);
-
-                    //Disable Region priority and enable Face priority
-                    setAlgoPriority(REGION_PRIORITY, EXPOSURE_ALGO, false);
-                    setAlgoPriority(FACE_PRIORITY, EXPOSURE_ALGO, true);
-                    mFDSwitchAlgoPriority = false;
-                }
-            }
+        if ( CURRENT_ISO_REFRESH_FRAMES <= ++mCurrentISOFrames )
+            {
+            Mutex::Autolock lock(m3ASettingsUpdateLock);
+            mCurrentISOValid = false;
+            mCurrentISOFrames = 0;
             }
 
+        //Faces are processed by the face detection handler, the flags are
+        //checked again there under mFaceDetectionLock
+        if ( mFaceDetectionRunning && !mFaceDetectionPaused ) {
+            detectFaces(pBuffHeader, pPortParam->mWidth, pPortParam->mHeight);
+        }
+
         ///Prepare the frames to be sent - initialize CameraFrame object and reference count
         // TODO(XXX): ancillary data for snapshot frame is not being sent for video snapshot
         //            if we are waiting for a snapshot and in video mode...go ahead and send
@@ -3045,7 +3073,9 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
         stat = sendCallBacks(cameraFrame, pBuffHeader, mask, pPortParam);
         mFramesWithDisplay++;
 
-        mFramesWithDucati--;
+        android_atomic_dec(&mFramesWithDucati);
+
+        updatePreviewBufferUsage();
 
 #ifdef DEBUG_LOG
         if(mBuffersWithDucati.indexOfKey((int)pBuffHeader->pBuffer)<0)
@@ -3068,7 +3098,9 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
                 ( (nextState & CAPTURE_ACTIVE) == 0 ) &&
                 ( (state & CAPTURE_ACTIVE) == 0 ) )
             {
-            apply3Asettings(mParameters3A);
+            //Spread the settings over several frames, so that a
+            //scene change doesn't stall a single preview frame
+            apply3Asettings(mParameters3A, MAX_3A_SETTINGS_PER_FRAME);
             }
 
         }
@@ -3142,6 +3174,27 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
 
         CAMHAL_LOGDB("Captured Frames: %d", mCapturedFrames);
 
+        //Bracketed images of one capture come back to back, tag them so
+        //that subscribers can collect the whole group. A temporal noise
+        //reduction burst is tagged the same way.
+        if ( ( 0 < mExposureBracketingValidEntries ) || ( 0 < mTemporalNRFrames ) )
+            {
+            cameraFrame.mBracketIndex = mBurstFrames - mCapturedFrames;
+            cameraFrame.mBracketCount = mBurstFrames;
+
+            if ( CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG & cameraFrame.mQuirks )
+                {
+                if ( mExposureBracketMerge && ( 0 < mExposureBracketingValidEntries ) )
+                    {
+                    cameraFrame.mQuirks |= CameraFrame::MERGE_EXPOSURE_BRACKET;
+                    }
+                else if ( 0 < mTemporalNRFrames )
+                    {
+                    cameraFrame.mQuirks |= CameraFrame::DENOISE_BURST;
+                    }
+                }
+            }
+
         mCapturedFrames--;
 
         stat = sendCallBacks(cameraFrame, pBuffHeader, mask, pPortParam);
@@ -3176,10 +3229,8 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
     return eError;
 }
 
-status_t OMXCameraAdapter::recalculateFPS()
+status_t OMXCameraAdapter::recalculateFPS(nsecs_t timestamp)
 {
-    float currentFPS;
-
     {
         Mutex::Autolock lock(mFrameCountMutex);
         mFrameCount++;
@@ -3188,27 +3239,9 @@ status_t OMXCameraAdapter::recalculateFPS()
         }
     }
 
-    if ( ( mFrameCount % FPS_PERIOD ) == 0 )
-        {
-        nsecs_t now = systemTime();
-        nsecs_t diff = now - mLastFPSTime;
-        currentFPS =  ((mFrameCount - mLastFrameCount) * float(s2ns(1))) / diff;
-        mLastFPSTime = now;
-        mLastFrameCount = mFrameCount;
-
-        if ( 1 == mIter )
-            {
-            mFPS = currentFPS;
-            }
-        else
-            {
-            //cumulative moving average
-            mFPS = mLastFPS + (currentFPS - mLastFPS)/mIter;
-            }
-
-        mLastFPS = mFPS;
-        mIter++;
-        }
+    //Sensor timestamps reflect the actual frame pacing, unlike the
+    //time this callback gets scheduled
+    mSensorFps.frame(timestamp);
 
     return NO_ERROR;
 }
@@ -3230,6 +3263,96 @@ status_t OMXCameraAdapter::sendFrame(CameraFrame &frame)
     return ret;
 }
 
+void OMXCameraAdapter::resetPreviewBufferUsage()
+{
+    mPreviewBufsEvalFrames = 0;
+    mPreviewBufsStarved = 0;
+    mPreviewBufsMinWithDucati = MAX_NO_BUFFERS;
+}
+
+void OMXCameraAdapter::updatePreviewBufferUsage()
+{
+    OMXCameraPortParameters *previewPort;
+    unsigned int current, recommended;
+    int32_t withDucati = mFramesWithDucati;
+
+    // No buffer left queued on the preview port means the sensor will
+    // drop frames until one gets returned by the consumers
+    if ( 0 >= withDucati )
+        {
+        mPreviewBufsStarved++;
+        withDucati = 0;
+        }
+
+    if ( ( unsigned int ) withDucati < mPreviewBufsMinWithDucati )
+        {
+        mPreviewBufsMinWithDucati = withDucati;
+        }
+
+    if ( ++mPreviewBufsEvalFrames < PREVIEW_BUFS_EVAL_FRAMES )
+        {
+        return;
+        }
+
+    previewPort = &mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mPrevPortIndex];
+    current = previewPort->mNumBufs;
+    recommended = current;
+
+    if ( ( PREVIEW_BUFS_STARVED_THRESHOLD <= mPreviewBufsStarved ) &&
+         ( MAX_CAMERA_BUFFERS > current ) )
+        {
+        recommended = current + 1;
+        }
+    else if ( ( 0 == mPreviewBufsStarved ) &&
+              ( PREVIEW_BUFS_IDLE_WITH_DUCATI < mPreviewBufsMinWithDucati ) &&
+              ( PREVIEW_BUFS_MIN < current ) )
+        {
+        // Buffers which never leave the preview port queue are idle
+        recommended = current - 1;
+        }
+
+    if ( recommended != mPreviewBufsRecommended )
+        {
+        CAMHAL_LOGDB("Preview buffers: current %d starved %d min with Ducati %d -> next %d",
+                     current,
+                     mPreviewBufsStarved,
+                     mPreviewBufsMinWithDucati,
+                     recommended);
+        mPreviewBufsRecommended = recommended;
+        }
+
+    resetPreviewBufferUsage();
+}
+
+status_t OMXCameraAdapter::getPreviewBufferCount(unsigned int &count)
+{
+    LOG_FUNCTION_NAME;
+
+    // Applied on the next preview start, the buffer set in use
+    // is never resized while preview is running
+    if ( 0 != mPreviewBufsRecommended )
+        {
+        count = mPreviewBufsRecommended;
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+status_t OMXCameraAdapter::getCaptureFrameCount(unsigned int &count)
+{
+    LOG_FUNCTION_NAME;
+
+    // Burst and temporal noise reduction both end up here once the
+    // capture parameters were applied
+    count = mBurstFrames;
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
 status_t OMXCameraAdapter::sendCallBacks(CameraFrame frame, OMX_IN OMX_BUFFERHEADERTYPE *pBuffHeader, unsigned int mask, OMXCameraPortParameters *port)
 {
   status_t ret = NO_ERROR;
@@ -3498,10 +3621,13 @@ OMXCameraAdapter::OMXCameraAdapter(size_t sensor_index)
     mStopPreviewSem.Create(0);
     mStartCaptureSem.Create(0);
     mStopCaptureSem.Create(0);
-    mSwitchToLoadedSem.Create(0);
+    for ( int i = 0 ; i < MAX_TRANSITION_STEPS ; i++ )
+        {
+        mTransitionSem[i].Create(0);
+        }
     mCaptureSem.Create(0);
 
-    mSwitchToExecSem.Create(0);
+    initEventWaiters();
 
     mCameraAdapterParameters.mHandleComp = 0;
 
@@ -3512,6 +3638,12 @@ OMXCameraAdapter::OMXCameraAdapter(size_t sensor_index)
     mFramesWithDisplay = 0;
     mFramesWithEncoder = 0;
 
+    mPreviewBufsRecommended = 0;
+    resetPreviewBufferUsage();
+
+    mAlgoAreas = NULL;
+    mAlgoAreasSize = 0;
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -3521,6 +3653,19 @@ OMXCameraAdapter::~OMXCameraAdapter()
 
     Mutex::Autolock lock(gAdapterLock);
 
+    // Queued face results call back into the component, so the face
+    // detection thread has to be gone before the component is released
+    if ( mOmxInitialized && mFaceDetectionRunning ) {
+        stopFaceDetection();
+    }
+
+    //Exit and free ref to face detection handling thread
+    if ( NULL != mFaceDetectionHandler.get() )
+    {
+        mFaceDetectionHandler->exit();
+        mFaceDetectionHandler.clear();
+    }
+
     if ( mOmxInitialized ) {
         // return to OMX Loaded state
         switchToLoaded();
@@ -3539,22 +3684,7 @@ OMXCameraAdapter::~OMXCameraAdapter()
     }
 
     //Remove any unhandled events
-    if ( !mEventSignalQ.isEmpty() )
-      {
-        for (unsigned int i = 0 ; i < mEventSignalQ.size() ; i++ )
-          {
-            TIUTILS::Message *msg = mEventSignalQ.itemAt(i);
-            //remove from queue and free msg
-            if ( NULL != msg )
-              {
-                Semaphore *sem  = (Semaphore*) msg->arg3;
-                sem->Signal();
-                free(msg);
-
-              }
-          }
-       mEventSignalQ.clear();
-      }
+    flushEventWaiters(true);
 
     //Exit and free ref to command handling thread
     if ( NULL != mCommandHandler.get() )
@@ -3580,6 +3710,12 @@ OMXCameraAdapter::~OMXCameraAdapter()
         mOMXCallbackHandler.clear();
     }
 
+    if ( NULL != mAlgoAreas )
+    {
+        mAlgoAreasMemMgr.freeBuffer((void*) mAlgoAreas);
+        mAlgoAreas = NULL;
+    }
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -28,6 +28,7 @@
 #include "CameraHal.h"
 #include "OMXCameraAdapter.h"
 #include "ErrorUtils.h"
+#include "FrameMerge.h"
 
 
 namespace android {
@@ -116,6 +117,43 @@ status_t OMXCameraAdapter::setParametersCapture(const CameraParameters &params,
         pixFormat = OMX_COLOR_FormatCbYCrY;
     }
 
+#ifdef OMAP_ENHANCEMENT
+
+    // Merging an exposure bracket is done on A9 too, so
+    // the bracketed frames are captured as yuv422i
+    valstr = params.get(TICameraParameters::KEY_EXP_BRACKETING_MERGE);
+    mExposureBracketMerge = ( NULL != valstr ) &&
+                            ( 0 == strcmp(valstr, TICameraParameters::BRACKET_ENABLE) ) &&
+                            ( NULL != params.get(TICameraParameters::KEY_EXP_BRACKETING_RANGE) );
+
+    // Temporal noise reduction averages a short burst on A9, it only
+    // applies to single JPEG shots without bracketing, other formats
+    // would hand every frame of the burst to the client
+    varint = params.getInt(TICameraParameters::KEY_TEMPORAL_NR_FRAMES);
+    if ( ( varint < 2 ) ||
+         ( NULL != params.get(TICameraParameters::KEY_EXP_BRACKETING_RANGE) ) ||
+         ( params.getInt(TICameraParameters::KEY_BURST) > 1 ) ||
+         ( mPictureFormatFromClient &&
+           strcmp(mPictureFormatFromClient, CameraParameters::PIXEL_FORMAT_JPEG) ) )
+        {
+        varint = 0;
+        }
+    else if ( varint > FrameMerge::MAX_FRAMES )
+        {
+        varint = FrameMerge::MAX_FRAMES;
+        }
+    mTemporalNRFrames = varint;
+
+    if ( ( mExposureBracketMerge || mTemporalNRFrames ) &&
+         (pixFormat == OMX_COLOR_FormatUnused) &&
+         ( !mPictureFormatFromClient ||
+           !strcmp(mPictureFormatFromClient, CameraParameters::PIXEL_FORMAT_JPEG) ) ) {
+        CAMHAL_LOGDA("Merging frames...selecting yuv422i");
+        pixFormat = OMX_COLOR_FormatCbYCrY;
+    }
+
+#endif
+
     if ( pixFormat != cap->mColorFormat )
         {
         mPendingCaptureSettings |= SetFormat;
@@ -126,7 +164,16 @@ status_t OMXCameraAdapter::setParametersCapture(const CameraParameters &params,
 
     str = params.get(TICameraParameters::KEY_EXP_BRACKETING_RANGE);
     if ( NULL != str ) {
-        parseExpRange(str, mExposureBracketingValues, EXP_BRACKET_RANGE, mExposureBracketingValidEntries);
+        int expValues[EXP_BRACKET_RANGE];
+        size_t validEntries = 0;
+
+        parseExpRange(str, expValues, EXP_BRACKET_RANGE, validEntries);
+        if ( ( validEntries != mExposureBracketingValidEntries ) ||
+             memcmp(expValues, mExposureBracketingValues, validEntries * sizeof(int)) ) {
+            mPendingCaptureSettings |= SetExpBracket;
+            memcpy(mExposureBracketingValues, expValues, validEntries * sizeof(int));
+            mExposureBracketingValidEntries = validEntries;
+        }
     } else {
         // if bracketing was previously set...we set again before capturing to clear
         if (mExposureBracketingValidEntries) mPendingCaptureSettings |= SetExpBracket;
@@ -173,19 +220,28 @@ status_t OMXCameraAdapter::setParametersCapture(const CameraParameters &params,
 
      CAMHAL_LOGVB("Sensor Orientation  set : %d", mSensorOrientation);
 
+    //The frame limit is a live setting, only going from single shot
+    //to burst or back changes the capture buffers
     varint = params.getInt(TICameraParameters::KEY_BURST);
-    if ( varint >= 1 )
+    if ( varint < 1 )
         {
-        if (varint != mBurstFrames) {
-            mPendingCaptureSettings |= SetExpBracket;
+        varint = 1;
         }
-        mBurstFrames = varint;
+
+    if ( 0 < mTemporalNRFrames )
+        {
+        varint = mTemporalNRFrames;
         }
-    else
+
+    if ( ( size_t ) varint != mBurstFrames )
         {
-        if (mBurstFrames != 1) mPendingCaptureSettings |= SetExpBracket;
-        mBurstFrames = 1;
+        mPendingCaptureSettings |= SetExpBracket;
+        if ( ( 1 < varint ) != ( 1 < mBurstFrames ) )
+            {
+            mPendingCaptureSettings |= SetBurst;
+            }
         }
+    mBurstFrames = varint;
 
     CAMHAL_LOGVB("Burst Frames set %d", mBurstFrames);
 
@@ -263,7 +319,7 @@ status_t OMXCameraAdapter::setParametersCapture(const CameraParameters &params,
         mPendingCaptureSettings = ECapturesettingsAll;
     }
 
-    if (mPendingCaptureSettings) {
+    if (mPendingCaptureSettings & ~ECaptureSettingsLive) {
         disableImagePort();
         if ( NULL != mReleaseImageBuffersCallback ) {
             mReleaseImageBuffersCallback(mReleaseData);
@@ -519,6 +575,62 @@ status_t OMXCameraAdapter::setShutterCallback(bool enabled)
     return ret;
 }
 
+//Assumes a negative nDelay makes the component hand over the frame
+//exposed that many ms before the capture command from the ZSL history.
+//OMX_TI_IVCommon.h only documents nDelay as "Capture frame delay in ms",
+//so this is unverified against the firmware.
+status_t OMXCameraAdapter::setZslDelay(nsecs_t shutterTimestamp)
+{
+    status_t ret = NO_ERROR;
+    OMX_ERRORTYPE eError = OMX_ErrorNone;
+    OMX_TI_CONFIG_ZSLDELAYTYPE zslDelay;
+    OMX_S32 delay, historySpan;
+    OMXCameraPortParameters *cap;
+
+    LOG_FUNCTION_NAME;
+
+    cap = &mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mPrevPortIndex];
+
+    //Time passed since the shutter press, the frame exposed back then
+    //is the one the history should hand over
+    delay = ( OMX_S32 ) ns2ms(systemTime(SYSTEM_TIME_MONOTONIC) - shutterTimestamp);
+    if ( 0 > delay )
+        {
+        delay = 0;
+        }
+
+    //Nothing older than the history itself can be selected
+    if ( 0 < cap->mFrameRate )
+        {
+        historySpan = ( mZslHistoryLen * 1000 ) / cap->mFrameRate;
+        if ( delay > historySpan )
+            {
+            delay = historySpan;
+            }
+        }
+
+    OMX_INIT_STRUCT_PTR (&zslDelay, OMX_TI_CONFIG_ZSLDELAYTYPE);
+    //Negative delays reach back into the history
+    zslDelay.nDelay = -delay;
+
+    eError = OMX_SetConfig(mCameraAdapterParameters.mHandleComp,
+                           ( OMX_INDEXTYPE ) OMX_TI_IndexConfigZslDelay,
+                           &zslDelay);
+    if ( OMX_ErrorNone != eError )
+        {
+        CAMHAL_LOGEB("Error while configuring ZSL delay 0x%x", eError);
+        ret = ErrorUtils::omxToAndroidError(eError);
+        }
+    else
+        {
+        CAMHAL_LOGDB("ZSL frame selected %d ms before capture", ( int ) delay);
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
 status_t OMXCameraAdapter::doBracketing(OMX_BUFFERHEADERTYPE *pBuffHeader,
                                         CameraFrame::FrameType typeOfFrame)
 {
@@ -770,6 +882,20 @@ status_t OMXCameraAdapter::startImageCapture()
         }
     }
 
+    //Bracketing and the frame limit are configs of the live port, a new
+    //sequence gets queued here instead of reconfiguring the port
+    if ( NO_ERROR == ret ) {
+        if (mPendingCaptureSettings & SetExpBracket) {
+            mPendingCaptureSettings &= ~SetExpBracket;
+            ret = setExposureBracketing( mExposureBracketingValues,
+                                         mExposureBracketingValidEntries, mBurstFrames);
+            if ( NO_ERROR != ret ) {
+                CAMHAL_LOGEB("setExposureBracketing() failed %d", ret);
+                goto EXIT;
+            }
+        }
+    }
+
     // need to enable wb data for video snapshot to fill in exif data
     if ((ret == NO_ERROR) && (mCapMode == VIDEO_MODE)) {
         // video snapshot uses wb data from snapshot frame
@@ -812,6 +938,15 @@ status_t OMXCameraAdapter::startImageCapture()
         mWaitingForSnapshot = true;
         mCaptureSignalled = false;
 
+        //Pick the history frame closest to the shutter press, if the
+        //component rejects the delay the most recent frame gets captured
+        if ( HIGH_QUALITY_ZSL == mCapMode ) {
+            status_t zslRet = setZslDelay(mShutterTimestamp);
+            if ( NO_ERROR != zslRet ) {
+                CAMHAL_LOGEB("ZSL delay not applied %d, capturing latest frame", zslRet);
+            }
+        }
+
         // Capturing command is not needed when capturing in video mode
         // Only need to queue buffers on image ports
         if (mCapMode != VIDEO_MODE) {
@@ -1109,15 +1244,8 @@ status_t OMXCameraAdapter::UseBuffersCapture(void* bufArr, int num)
         }
     }
 
-    if (mPendingCaptureSettings & SetExpBracket) {
-        mPendingCaptureSettings &= ~SetExpBracket;
-        ret = setExposureBracketing( mExposureBracketingValues,
-                                     mExposureBracketingValidEntries, mBurstFrames);
-        if ( ret != NO_ERROR ) {
-            CAMHAL_LOGEB("setExposureBracketing() failed %d", ret);
-            goto EXIT;
-        }
-    }
+    //The buffers registered below already reflect the burst setting
+    mPendingCaptureSettings &= ~SetBurst;
 
     if (mPendingCaptureSettings & SetQuality) {
         mPendingCaptureSettings &= ~SetQuality;
@@ -32,6 +32,7 @@
 namespace android {
 
 status_t OMXCameraAdapter::setParametersEXIF(const CameraParameters &params,
+                                             const CameraParameterChanges &changes,
                                              BaseCameraAdapter::AdapterState state)
 {
     status_t ret = NO_ERROR;
@@ -40,6 +41,23 @@ status_t OMXCameraAdapter::setParametersEXIF(const CameraParameters &params,
 
     LOG_FUNCTION_NAME;
 
+    //The EXIF data only mirrors these keys, so it is up to date
+    //unless one of them changed
+    if ( !changes.changed(CameraParameters::KEY_GPS_LATITUDE) &&
+         !changes.changed(CameraParameters::KEY_GPS_LONGITUDE) &&
+         !changes.changed(CameraParameters::KEY_GPS_ALTITUDE) &&
+         !changes.changed(CameraParameters::KEY_GPS_TIMESTAMP) &&
+         !changes.changed(CameraParameters::KEY_GPS_PROCESSING_METHOD) &&
+         !changes.changed(TICameraParameters::KEY_GPS_MAPDATUM) &&
+         !changes.changed(TICameraParameters::KEY_GPS_VERSION) &&
+         !changes.changed(TICameraParameters::KEY_EXIF_MODEL) &&
+         !changes.changed(TICameraParameters::KEY_EXIF_MAKE) &&
+         !changes.changed(CameraParameters::KEY_FOCAL_LENGTH) )
+        {
+        LOG_FUNCTION_NAME_EXIT;
+        return ret;
+        }
+
     if( ( valstr = params.get(CameraParameters::KEY_GPS_LATITUDE) ) != NULL )
         {
         gpsPos = strtod(valstr, NULL);
@@ -57,6 +57,11 @@ status_t OMXCameraAdapter::startFaceDetection()
 
     Mutex::Autolock lock(mFaceDetectionLock);
 
+    ret = allocateFaceResults();
+    if (ret != NO_ERROR) {
+        goto out;
+    }
+
     ret = setFaceDetection(true, mDeviceOrientation);
     if (ret != NO_ERROR) {
         goto out;
@@ -71,6 +76,7 @@ status_t OMXCameraAdapter::startFaceDetection()
     // regions alone.
 
     faceDetectionNumFacesLastOutput = 0;
+    mFaceNumLastNotified = -1;
  out:
     return ret;
 }
@@ -90,7 +96,7 @@ status_t OMXCameraAdapter::stopFaceDetection()
     }
 
     // Reset 3A settings
-    ret = setParameters3A(mParams, state);
+    ret = setParameters3A(mParams, CameraParameterChanges(mParams, mParams, true), state);
     if (ret != NO_ERROR) {
         goto out;
     }
@@ -100,6 +106,7 @@ status_t OMXCameraAdapter::stopFaceDetection()
     }
 
     faceDetectionNumFacesLastOutput = 0;
+    mFaceNumLastNotified = -1;
  out:
     return ret;
 }
@@ -111,6 +118,7 @@ void OMXCameraAdapter::pauseFaceDetection(bool pause)
     if (mFaceDetectionRunning) {
         mFaceDetectionPaused = pause;
         faceDetectionNumFacesLastOutput = 0;
+        mFaceNumLastNotified = -1;
     }
 }
 
@@ -185,8 +193,70 @@ status_t OMXCameraAdapter::setFaceDetection(bool enable, OMX_U32 orientation)
     return ret;
 }
 
+status_t OMXCameraAdapter::allocateFaceResults()
+{
+    camera_frame_metadata_t *faceResult;
+
+    LOG_FUNCTION_NAME;
+
+    for ( int i = 0 ; i < FACE_RESULT_POOL_SIZE ; i++ ) {
+        if ( NULL != mFaceResultPool[i].get() ) {
+            continue;
+        }
+
+        faceResult = ( camera_frame_metadata_t * ) malloc(sizeof(camera_frame_metadata_t));
+        if ( NULL == faceResult ) {
+            return -ENOMEM;
+        }
+
+        faceResult->number_of_faces = 0;
+        faceResult->faces = ( camera_face_t * ) malloc(sizeof(camera_face_t) *
+                                                       MAX_NUM_FACES_SUPPORTED);
+        if ( NULL == faceResult->faces ) {
+            free(faceResult);
+            return -ENOMEM;
+        }
+
+        mFaceResultPool[i] = new CameraFDResult(faceResult);
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+bool OMXCameraAdapter::facesChanged(const camera_frame_metadata_t *faceResult)
+{
+    const camera_face_t *face, *last;
+    bool changed = false;
+
+    if ( faceResult->number_of_faces != mFaceNumLastNotified ) {
+        changed = true;
+    }
+
+    for ( int i = 0 ; !changed && ( i < faceResult->number_of_faces ) ; i++ ) {
+        face = &faceResult->faces[i];
+        last = &mFaceLastNotified[i];
+        for ( int j = 0 ; j < 4 ; j++ ) {
+            if ( abs(face->rect[j] - last->rect[j]) > FACE_DELTA_THRESHOLD ) {
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    if ( changed ) {
+        if ( 0 < faceResult->number_of_faces ) {
+            memcpy(mFaceLastNotified, faceResult->faces,
+                   sizeof(camera_face_t) * faceResult->number_of_faces);
+        }
+        mFaceNumLastNotified = faceResult->number_of_faces;
+    }
+
+    return changed;
+}
+
 status_t OMXCameraAdapter::detectFaces(OMX_BUFFERHEADERTYPE* pBuffHeader,
-                                       sp<CameraFDResult> &result,
                                        size_t previewWidth,
                                        size_t previewHeight)
 {
@@ -196,7 +266,6 @@ status_t OMXCameraAdapter::detectFaces(OMX_BUFFERHEADERTYPE* pBuffHeader,
     OMX_OTHER_EXTRADATATYPE *extraData;
     OMX_FACEDETECTIONTYPE *faceData;
     OMX_TI_PLATFORMPRIVATE *platformPrivate;
-    camera_frame_metadata_t *faces;
 
     LOG_FUNCTION_NAME;
 
@@ -275,13 +344,12 @@ status_t OMXCameraAdapter::detectFaces(OMX_BUFFERHEADERTYPE* pBuffHeader,
         return -EINVAL;
     }
 
-    ret = encodeFaceCoordinates(faceData, &faces, previewWidth, previewHeight);
-
-    if ( NO_ERROR == ret ) {
-        result = new CameraFDResult(faces);
-    } else {
-        result.clear();
-        result = NULL;
+    // The extradata goes back to the component with the buffer, the
+    // face handler gets a copy of it
+    if ( ( NULL == mFaceDetectionHandler.get() ) ||
+         !mFaceDetectionHandler->put(faceData, previewWidth, previewHeight) ) {
+        CAMHAL_LOGVA("Face detection queue full");
+        ret = -EBUSY;
     }
 
     LOG_FUNCTION_NAME_EXIT;
@@ -289,20 +357,73 @@ status_t OMXCameraAdapter::detectFaces(OMX_BUFFERHEADERTYPE* pBuffHeader,
     return ret;
 }
 
+void OMXCameraAdapter::processFaces(const OMX_FACEDETECTIONTYPE *faceData,
+                                    size_t previewWidth,
+                                    size_t previewHeight)
+{
+    sp<CameraFDResult> result;
+    status_t ret;
+
+    LOG_FUNCTION_NAME;
+
+    Mutex::Autolock lock(mFaceDetectionLock);
+
+    // Snapshots queued before face detection stopped are stale
+    if ( !mFaceDetectionRunning || mFaceDetectionPaused ) {
+        return;
+    }
+
+    // A result is free again once the notifier dropped its reference.
+    // If the subscribers are lagging behind, this frame is skipped.
+    for ( int i = 0 ; i < FACE_RESULT_POOL_SIZE ; i++ ) {
+        if ( ( NULL != mFaceResultPool[i].get() ) &&
+             ( 1 == mFaceResultPool[i]->getStrongCount() ) ) {
+            result = mFaceResultPool[i];
+            break;
+        }
+    }
+
+    if ( NULL != result.get() ) {
+        ret = encodeFaceCoordinates(faceData, result->getFaceResult(), previewWidth, previewHeight);
+
+        // Faces which didn't move aren't sent again
+        if ( ( NO_ERROR == ret ) && facesChanged(result->getFaceResult()) ) {
+            notifyFaceSubscribers(result);
+        }
+        result.clear();
+    } else {
+        CAMHAL_LOGVA("No free face detection result");
+    }
+
+    if ( mFDSwitchAlgoPriority ) {
+
+        //Disable region priority and enable face priority for AF
+        setAlgoPriority(REGION_PRIORITY, FOCUS_ALGO, false);
+        setAlgoPriority(FACE_PRIORITY, FOCUS_ALGO , true);
+
+        //Disable Region priority and enable Face priority
+        setAlgoPriority(REGION_PRIORITY, EXPOSURE_ALGO, false);
+        setAlgoPriority(FACE_PRIORITY, EXPOSURE_ALGO, true);
+        mFDSwitchAlgoPriority = false;
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
 status_t OMXCameraAdapter::encodeFaceCoordinates(const OMX_FACEDETECTIONTYPE *faceData,
-                                                 camera_frame_metadata_t **pFaces,
+                                                 camera_frame_metadata_t *faceResult,
                                                  size_t previewWidth,
                                                  size_t previewHeight)
 {
     status_t ret = NO_ERROR;
     camera_face_t *faces;
-    camera_frame_metadata_t *faceResult;
     size_t hRange, vRange;
+    OMX_U32 faceCount;
     double tmp;
 
     LOG_FUNCTION_NAME;
 
-    if ( NULL == faceData ) {
+    if ( ( NULL == faceData ) || ( NULL == faceResult ) ) {
         CAMHAL_LOGEA("Invalid OMX_FACEDETECTIONTYPE parameter");
         return EINVAL;
     }
@@ -312,20 +433,17 @@ status_t OMXCameraAdapter::encodeFaceCoordinates(const OMX_FACEDETECTIONTYPE *fa
     hRange = CameraFDResult::RIGHT - CameraFDResult::LEFT;
     vRange = CameraFDResult::BOTTOM - CameraFDResult::TOP;
 
-    faceResult = ( camera_frame_metadata_t * ) malloc(sizeof(camera_frame_metadata_t));
-    if ( NULL == faceResult ) {
-        return -ENOMEM;
+    // The result comes with room for the maximum number of faces
+    faces = faceResult->faces;
+    faceCount = faceData->ulFaceCount;
+    if ( MAX_NUM_FACES_SUPPORTED < faceCount ) {
+        faceCount = MAX_NUM_FACES_SUPPORTED;
     }
 
-    if ( 0 < faceData->ulFaceCount ) {
+    if ( 0 < faceCount ) {
         int orient_mult;
         int trans_left, trans_top, trans_right, trans_bot;
 
-        faces = ( camera_face_t * ) malloc(sizeof(camera_face_t)*faceData->ulFaceCount);
-        if ( NULL == faces ) {
-            return -ENOMEM;
-        }
-
         /**
         / * When device is 180 degrees oriented to the sensor, need to translate
         / * the output from Ducati to what Android expects
@@ -374,7 +492,7 @@ status_t OMXCameraAdapter::encodeFaceCoordinates(const OMX_FACEDETECTIONTYPE *fa
         }
 
         int j = 0, i = 0;
-        for ( ; j < faceData->ulFaceCount ; j++)
+        for ( ; j < faceCount ; j++)
             {
              OMX_S32 nLeft = 0;
              OMX_S32 nTop = 0;
@@ -427,7 +545,6 @@ status_t OMXCameraAdapter::encodeFaceCoordinates(const OMX_FACEDETECTIONTYPE *fa
             }
 
         faceResult->number_of_faces = i;
-        faceResult->faces = faces;
 
         for (int i = 0; i  < faceResult->number_of_faces; i++)
         {
@@ -477,14 +594,87 @@ status_t OMXCameraAdapter::encodeFaceCoordinates(const OMX_FACEDETECTIONTYPE *fa
         faceDetectionNumFacesLastOutput = faceResult->number_of_faces;
     } else {
         faceResult->number_of_faces = 0;
-        faceResult->faces = NULL;
     }
 
-    *pFaces = faceResult;
-
     LOG_FUNCTION_NAME_EXIT;
 
     return ret;
 }
 
+/*--------------------FaceDetectionHandler Class STARTS here-----------------------------*/
+
+OMXCameraAdapter::FaceDetectionHandler::FaceDetectionHandler(OMXCameraAdapter* ca)
+    : Thread(false), mHead(0), mTail(0), mExit(false), mCameraAdapter(ca)
+{
+    mSem.Create(0);
+}
+
+bool OMXCameraAdapter::FaceDetectionHandler::put(const OMX_FACEDETECTIONTYPE *faces,
+                                                 size_t previewWidth,
+                                                 size_t previewHeight)
+{
+    Snapshot *snapshot;
+    uint32_t head = mHead;
+
+    // Only the fill buffer done thread queues, only this thread
+    // dequeues. A full queue drops the snapshot instead of waiting.
+    if ( ( head - mTail ) >= QUEUE_SIZE ) {
+        return false;
+    }
+
+    snapshot = &mQueue[head % QUEUE_SIZE];
+    memcpy(&snapshot->mFaces, faces, sizeof(OMX_FACEDETECTIONTYPE));
+    snapshot->mPreviewWidth = previewWidth;
+    snapshot->mPreviewHeight = previewHeight;
+
+    //Make the snapshot visible before it gets published
+    __sync_synchronize();
+    mHead = head + 1;
+
+    mSem.Signal();
+
+    return true;
+}
+
+void OMXCameraAdapter::FaceDetectionHandler::exit()
+{
+    mExit = true;
+    mSem.Signal();
+    requestExitAndWait();
+}
+
+bool OMXCameraAdapter::FaceDetectionHandler::threadLoop()
+{
+    Snapshot *snapshot;
+    uint32_t head;
+
+    mSem.Wait();
+
+    if ( mExit ) {
+        CAMHAL_LOGDA("Exiting face detection handler");
+        return false;
+    }
+
+    head = mHead;
+    if ( head == mTail ) {
+        return true;
+    }
+
+    // Only the latest faces matter, older snapshots are released unseen
+    __sync_synchronize();
+    mTail = head - 1;
+
+    snapshot = &mQueue[( head - 1 ) % QUEUE_SIZE];
+    mCameraAdapter->processFaces(&snapshot->mFaces,
+                                 snapshot->mPreviewWidth,
+                                 snapshot->mPreviewHeight);
+
+    __sync_synchronize();
+    mTail = head;
+
+    return true;
+}
+
+/*--------------------FaceDetectionHandler Class ENDS here-----------------------------*/
+
 };
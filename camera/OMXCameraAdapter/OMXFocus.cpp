@@ -37,16 +37,22 @@
 namespace android {
 
 status_t OMXCameraAdapter::setParametersFocus(const CameraParameters &params,
+                                              const CameraParameterChanges &changes,
                                               BaseCameraAdapter::AdapterState state)
 {
     status_t ret = NO_ERROR;
     const char *str = NULL;
     Vector< sp<CameraArea> > tempAreas;
     size_t MAX_FOCUS_AREAS;
+    bool pending = false;
 
     LOG_FUNCTION_NAME;
 
-    Mutex::Autolock lock(mFocusAreasLock);
+    if ( !changes.changed(CameraParameters::KEY_FOCUS_AREAS) )
+        {
+        LOG_FUNCTION_NAME_EXIT;
+        return ret;
+        }
 
     str = params.get(CameraParameters::KEY_FOCUS_AREAS);
 
@@ -56,6 +62,9 @@ status_t OMXCameraAdapter::setParametersFocus(const CameraParameters &params,
         ret = CameraArea::parseAreas(str, ( strlen(str) + 1 ), tempAreas);
     }
 
+    {
+    Mutex::Autolock lock(mFocusAreasLock);
+
     if ( (NO_ERROR == ret) && CameraArea::areAreasDifferent(mFocusAreas, tempAreas) ) {
         mFocusAreas.clear();
         mFocusAreas = tempAreas;
@@ -66,11 +75,17 @@ status_t OMXCameraAdapter::setParametersFocus(const CameraParameters &params,
             ret = -EINVAL;
         }
         else {
-            if ( !mFocusAreas.isEmpty() ) {
-                setTouchFocus();
-            }
+            pending = !mFocusAreas.isEmpty();
         }
     }
+    }
+
+    // Sent from the next preview frame, so that several updates
+    // in between cost a single RPC
+    if ( pending ) {
+        Mutex::Autolock lock(m3ASettingsUpdateLock);
+        mPending3Asettings |= SetFocusAreas;
+    }
 
     LOG_FUNCTION_NAME;
 
@@ -113,6 +128,21 @@ status_t OMXCameraAdapter::doAutoFocus()
     // If the app calls autoFocus, the camera will stop sending face callbacks.
     pauseFaceDetection(true);
 
+    // The scan must not start before the latest focus areas are sent
+    {
+    Mutex::Autolock lock(m3ASettingsUpdateLock);
+    if ( SetFocusAreas & mPending3Asettings )
+        {
+        mPending3Asettings &= ~SetFocusAreas;
+        if ( NO_ERROR != setTouchFocus() )
+            {
+            //Retried from the next preview frame
+            CAMHAL_LOGEA("Focus areas not applied, scanning with the previous ones");
+            mPending3Asettings |= SetFocusAreas;
+            }
+        }
+    }
+
     // This is needed for applying FOCUS_REGION correctly
     if ( (!mFocusAreas.isEmpty()) && (!mFocusAreas.itemAt(0)->isZeroArea()))
     {
@@ -682,104 +712,14 @@ status_t OMXCameraAdapter::addFocusDistances(OMX_U32 &near,
 status_t OMXCameraAdapter::setTouchFocus()
 {
     status_t ret = NO_ERROR;
-    OMX_ERRORTYPE eError = OMX_ErrorNone;
-
-    OMX_ALGOAREASTYPE **focusAreas;
-    OMX_TI_CONFIG_SHAREDBUFFER sharedBuffer;
-    MemoryManager memMgr;
-    int areasSize = 0;
 
     LOG_FUNCTION_NAME;
 
-    if ( OMX_StateInvalid == mComponentState )
-        {
-        CAMHAL_LOGEA("OMX component is in invalid state");
-        ret = -1;
-        }
+    Mutex::Autolock lock(mFocusAreasLock);
 
-    if ( NO_ERROR == ret )
+    if ( !mFocusAreas.isEmpty() )
         {
-
-        areasSize = ((sizeof(OMX_ALGOAREASTYPE)+4095)/4096)*4096;
-        focusAreas = (OMX_ALGOAREASTYPE**) memMgr.allocateBuffer(0, 0, NULL, areasSize, 1);
-
-        OMXCameraPortParameters * mPreviewData = NULL;
-        mPreviewData = &mCameraAdapterParameters.mCameraPortParams[mCameraAdapterParameters.mPrevPortIndex];
-
-        if (!focusAreas)
-            {
-            CAMHAL_LOGEB("Error allocating buffer for focus areas %d", eError);
-            return -ENOMEM;
-            }
-
-        OMX_INIT_STRUCT_PTR (focusAreas[0], OMX_ALGOAREASTYPE);
-
-        focusAreas[0]->nPortIndex = OMX_ALL;
-        focusAreas[0]->nNumAreas = mFocusAreas.size();
-        focusAreas[0]->nAlgoAreaPurpose = OMX_AlgoAreaFocus;
-
-        // If the area is the special case of (0, 0, 0, 0, 0), then
-        // the algorithm needs nNumAreas to be set to 0,
-        // in order to automatically choose the best fitting areas.
-        if ( mFocusAreas.itemAt(0)->isZeroArea() )
-            {
-            focusAreas[0]->nNumAreas = 0;
-            }
-
-        for ( unsigned int n = 0; n < mFocusAreas.size(); n++)
-            {
-            // transform the coordinates to 3A-type coordinates
-            mFocusAreas.itemAt(n)->transfrom((size_t)mPreviewData->mWidth,
-                                            (size_t)mPreviewData->mHeight,
-                                            (size_t&)focusAreas[0]->tAlgoAreas[n].nTop,
-                                            (size_t&)focusAreas[0]->tAlgoAreas[n].nLeft,
-                                            (size_t&)focusAreas[0]->tAlgoAreas[n].nWidth,
-                                            (size_t&)focusAreas[0]->tAlgoAreas[n].nHeight);
-
-            focusAreas[0]->tAlgoAreas[n].nLeft =
-                    ( focusAreas[0]->tAlgoAreas[n].nLeft * TOUCH_FOCUS_RANGE ) / mPreviewData->mWidth;
-            focusAreas[0]->tAlgoAreas[n].nTop =
-                    ( focusAreas[0]->tAlgoAreas[n].nTop* TOUCH_FOCUS_RANGE ) / mPreviewData->mHeight;
-            focusAreas[0]->tAlgoAreas[n].nWidth =
-                    ( focusAreas[0]->tAlgoAreas[n].nWidth * TOUCH_FOCUS_RANGE ) / mPreviewData->mWidth;
-            focusAreas[0]->tAlgoAreas[n].nHeight =
-                    ( focusAreas[0]->tAlgoAreas[n].nHeight * TOUCH_FOCUS_RANGE ) / mPreviewData->mHeight;
-            focusAreas[0]->tAlgoAreas[n].nPriority = mFocusAreas.itemAt(n)->getWeight();
-
-             CAMHAL_LOGDB("Focus area %d : top = %d left = %d width = %d height = %d prio = %d",
-                    n, (int)focusAreas[0]->tAlgoAreas[n].nTop, (int)focusAreas[0]->tAlgoAreas[n].nLeft,
-                    (int)focusAreas[0]->tAlgoAreas[n].nWidth, (int)focusAreas[0]->tAlgoAreas[n].nHeight,
-                    (int)focusAreas[0]->tAlgoAreas[n].nPriority);
-             }
-
-        OMX_INIT_STRUCT_PTR (&sharedBuffer, OMX_TI_CONFIG_SHAREDBUFFER);
-
-        sharedBuffer.nPortIndex = OMX_ALL;
-        sharedBuffer.nSharedBuffSize = areasSize;
-        sharedBuffer.pSharedBuff = (OMX_U8 *) focusAreas[0];
-
-        if ( NULL == sharedBuffer.pSharedBuff )
-            {
-            CAMHAL_LOGEA("No resources to allocate OMX shared buffer");
-            ret = -ENOMEM;
-            goto EXIT;
-            }
-
-            eError =  OMX_SetConfig(mCameraAdapterParameters.mHandleComp,
-                                      (OMX_INDEXTYPE) OMX_TI_IndexConfigAlgoAreas, &sharedBuffer);
-
-        if ( OMX_ErrorNone != eError )
-            {
-            CAMHAL_LOGEB("Error while setting Focus Areas configuration 0x%x", eError);
-            ret = -EINVAL;
-            }
-
-    EXIT:
-        if (NULL != focusAreas)
-            {
-            memMgr.freeBuffer((void*) focusAreas);
-            focusAreas = NULL;
-            }
+        ret = setAlgoAreas(OMX_AlgoAreaFocus, mFocusAreas, TOUCH_FOCUS_RANGE);
         }
 
     LOG_FUNCTION_NAME_EXIT;
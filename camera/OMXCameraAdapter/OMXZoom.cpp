@@ -84,10 +84,27 @@ status_t OMXCameraAdapter::setParametersZoom(const CameraParameters &params,
 }
 
 status_t OMXCameraAdapter::doZoom(int index)
+{
+    LOG_FUNCTION_NAME;
+
+    if (  ( 0 > index) || ( ( ZOOM_STAGES - 1 ) < index ) )
+        {
+        CAMHAL_LOGEB("Zoom index %d out of range", index);
+        return -EINVAL;
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return setZoomPosition(index << 8);
+}
+
+status_t OMXCameraAdapter::setZoomPosition(int position)
 {
     status_t ret = NO_ERROR;
     OMX_ERRORTYPE eError = OMX_ErrorNone;
     OMX_CONFIG_SCALEFACTORTYPE zoomControl;
+    int32_t factor;
+    int index, frac;
 
     LOG_FUNCTION_NAME;
 
@@ -97,37 +114,50 @@ status_t OMXCameraAdapter::doZoom(int index)
         ret = -1;
         }
 
-    if (  ( 0 > index) || ( ( ZOOM_STAGES - 1 ) < index ) )
+    if (  ( 0 > position) || ( ( ( ZOOM_STAGES - 1 ) << 8 ) < position ) )
         {
-        CAMHAL_LOGEB("Zoom index %d out of range", index);
+        CAMHAL_LOGEB("Zoom position %d out of range", position);
         ret = -EINVAL;
         }
 
-    if (mPreviousZoomIndx == index )
+    if ( NO_ERROR != ret )
+        {
+        return ret;
+        }
+
+    //Positions between two stages are interpolated linearly
+    index = position >> 8;
+    frac = position & 0xFF;
+    factor = ZOOM_STEPS[index];
+    if ( 0 < frac )
+        {
+        factor += ( ( ZOOM_STEPS[index + 1] - ZOOM_STEPS[index] ) * frac ) >> 8;
+        }
+
+    if ( mPreviousZoomFactor == factor )
         {
+        mZoomPosition = position;
         return NO_ERROR;
         }
 
-    if ( NO_ERROR == ret )
+    OMX_INIT_STRUCT_PTR (&zoomControl, OMX_CONFIG_SCALEFACTORTYPE);
+    zoomControl.nPortIndex = OMX_ALL;
+    zoomControl.xHeight = factor;
+    zoomControl.xWidth = factor;
+
+    eError =  OMX_SetConfig(mCameraAdapterParameters.mHandleComp,
+                            OMX_IndexConfigCommonDigitalZoom,
+                            &zoomControl);
+    if ( OMX_ErrorNone != eError )
         {
-        OMX_INIT_STRUCT_PTR (&zoomControl, OMX_CONFIG_SCALEFACTORTYPE);
-        zoomControl.nPortIndex = OMX_ALL;
-        zoomControl.xHeight = ZOOM_STEPS[index];
-        zoomControl.xWidth = ZOOM_STEPS[index];
-
-        eError =  OMX_SetConfig(mCameraAdapterParameters.mHandleComp,
-                                OMX_IndexConfigCommonDigitalZoom,
-                                &zoomControl);
-        if ( OMX_ErrorNone != eError )
-            {
-            CAMHAL_LOGEB("Error while applying digital zoom 0x%x", eError);
-            ret = -1;
-            }
-        else
-            {
-            CAMHAL_LOGDA("Digital zoom applied successfully");
-            mPreviousZoomIndx = index;
-            }
+        CAMHAL_LOGEB("Error while applying digital zoom 0x%x", eError);
+        ret = -1;
+        }
+    else
+        {
+        CAMHAL_LOGDA("Digital zoom applied successfully");
+        mPreviousZoomFactor = factor;
+        mZoomPosition = position;
         }
 
     LOG_FUNCTION_NAME_EXIT;
@@ -139,76 +169,93 @@ status_t OMXCameraAdapter::advanceZoom()
 {
     status_t ret = NO_ERROR;
     AdapterState state;
+    nsecs_t elapsed;
+    int64_t t, ease;
+    int position, target, index;
     Mutex::Autolock lock(mZoomLock);
 
     BaseCameraAdapter::getState(state);
 
+    target = mTargetZoomIdx << 8;
+
     if ( mReturnZoomStatus )
         {
-        mCurrentZoomIdx +=mZoomInc;
+        //Settle on the next whole stage in the direction of the ramp
+        if ( 0 < mZoomInc )
+            {
+            mCurrentZoomIdx = ( mZoomPosition + 0xFF ) >> 8;
+            }
+        else
+            {
+            mCurrentZoomIdx = mZoomPosition >> 8;
+            }
         mTargetZoomIdx = mCurrentZoomIdx;
         mReturnZoomStatus = false;
         ret = doZoom(mCurrentZoomIdx);
         notifyZoomSubscribers(mCurrentZoomIdx, true);
         }
-    else if ( mCurrentZoomIdx != mTargetZoomIdx )
+    else if ( ( ZOOM_ACTIVE & state ) && ( mZoomPosition != target ) )
         {
-        if ( ZOOM_ACTIVE & state )
+        //One update per preview frame, placed on an eased time curve,
+        //so the frame rate doesn't change how long the zoom takes
+        elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - mZoomRampStartTime;
+        if ( ( 0 >= mZoomRampDuration ) || ( elapsed >= mZoomRampDuration ) )
             {
-            if ( mCurrentZoomIdx < mTargetZoomIdx )
-                {
-                mZoomInc = 1;
-                }
-            else
-                {
-                mZoomInc = -1;
-                }
-
-            mCurrentZoomIdx += mZoomInc;
+            position = target;
             }
         else
             {
-            mCurrentZoomIdx = mTargetZoomIdx;
+            t = ( elapsed << 16 ) / mZoomRampDuration;
+            ease = ( t * t * ( ( 3 << 16 ) - 2 * t ) ) >> 32;
+            position = mZoomRampStart + ( int ) ( ( ( target - mZoomRampStart ) * ease ) >> 16 );
             }
 
-        ret = doZoom(mCurrentZoomIdx);
-
-        if ( ZOOM_ACTIVE & state )
+        //Movements too small to be seen are left for a later frame
+        if ( ( position == target ) ||
+             ( abs(position - mZoomPosition) >= ZOOM_MIN_POSITION_DELTA ) )
             {
-            if ( mCurrentZoomIdx == mTargetZoomIdx )
+            ret = setZoomPosition(position);
+            index = ( mZoomPosition + 0x80 ) >> 8;
+
+            if ( ( NO_ERROR == ret ) && ( mZoomPosition == target ) )
                 {
                 CAMHAL_LOGDB("[Goal Reached] Smooth Zoom notify currentIdx = %d, targetIdx = %d",
-                             mCurrentZoomIdx,
+                             mTargetZoomIdx,
                              mTargetZoomIdx);
 
-                if ( NO_ERROR == ret )
-                    {
-
-                    ret =  BaseCameraAdapter::setState(CAMERA_STOP_SMOOTH_ZOOM);
+                mCurrentZoomIdx = mTargetZoomIdx;
 
-                    if ( NO_ERROR == ret )
-                        {
-                        ret = BaseCameraAdapter::commitState();
-                        }
-                    else
-                        {
-                        ret |= BaseCameraAdapter::rollbackState();
-                        }
+                ret =  BaseCameraAdapter::setState(CAMERA_STOP_SMOOTH_ZOOM);
 
+                if ( NO_ERROR == ret )
+                    {
+                    ret = BaseCameraAdapter::commitState();
+                    }
+                else
+                    {
+                    ret |= BaseCameraAdapter::rollbackState();
                     }
+
                 mReturnZoomStatus = false;
                 notifyZoomSubscribers(mCurrentZoomIdx, true);
                 }
-            else
+            else if ( ( unsigned int ) index != mCurrentZoomIdx )
                 {
                 CAMHAL_LOGDB("[Advancing] Smooth Zoom notify currentIdx = %d, targetIdx = %d",
-                             mCurrentZoomIdx,
+                             index,
                              mTargetZoomIdx);
+                mCurrentZoomIdx = index;
                 notifyZoomSubscribers(mCurrentZoomIdx, false);
                 }
             }
         }
-    else if ( (mCurrentZoomIdx == mTargetZoomIdx ) &&
+    else if ( ( mCurrentZoomIdx != mTargetZoomIdx ) &&
+              !( ZOOM_ACTIVE & state ) )
+        {
+        mCurrentZoomIdx = mTargetZoomIdx;
+        ret = doZoom(mCurrentZoomIdx);
+        }
+    else if ( ( mZoomPosition == target ) &&
               ( ZOOM_ACTIVE & state ) )
         {
             ret = BaseCameraAdapter::setState(CameraAdapter::CAMERA_STOP_SMOOTH_ZOOM);
@@ -249,9 +296,16 @@ status_t OMXCameraAdapter::startSmoothZoom(int targetIdx)
 
     if ( ( targetIdx >= 0 ) && ( targetIdx < ZOOM_STAGES ) )
         {
+        //A new target replaces the running ramp, which restarts from
+        //wherever the zoom is now
         mTargetZoomIdx = targetIdx;
         mZoomParameterIdx = mCurrentZoomIdx;
         mReturnZoomStatus = false;
+        mZoomInc = ( ( targetIdx << 8 ) < mZoomPosition ) ? -1 : 1;
+        mZoomRampStart = mZoomPosition;
+        mZoomRampStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+        mZoomRampDuration = ms2ns(( ( nsecs_t ) abs(( targetIdx << 8 ) - mZoomPosition) *
+                                    ZOOM_STAGE_DURATION_MS ) >> 8);
         }
     else
         {
@@ -271,9 +325,9 @@ status_t OMXCameraAdapter::stopSmoothZoom()
 
     LOG_FUNCTION_NAME;
 
-    if ( mTargetZoomIdx != mCurrentZoomIdx )
+    if ( ( mTargetZoomIdx << 8 ) != ( unsigned int ) mZoomPosition )
         {
-        if ( mCurrentZoomIdx < mTargetZoomIdx )
+        if ( ( int ) ( mTargetZoomIdx << 8 ) > mZoomPosition )
             {
             mZoomInc = 1;
             }
@@ -282,7 +336,6 @@ status_t OMXCameraAdapter::stopSmoothZoom()
             mZoomInc = -1;
             }
         mReturnZoomStatus = true;
-        mReturnZoomStatus = true;
         CAMHAL_LOGDB("Stop smooth zoom mCurrentZoomIdx = %d, mTargetZoomIdx = %d",
                      mCurrentZoomIdx,
                      mTargetZoomIdx);
@@ -56,6 +56,8 @@ const char TICameraParameters::KEY_METERING_MODE[] = "meter-mode";
 const char TICameraParameters::KEY_PADDED_WIDTH[] = "padded-width";
 const char TICameraParameters::KEY_PADDED_HEIGHT[] = "padded-height";
 const char TICameraParameters::KEY_EXP_BRACKETING_RANGE[] = "exp-bracketing-range";
+const char TICameraParameters::KEY_EXP_BRACKETING_MERGE[] = "exp-bracketing-merge";
+const char TICameraParameters::KEY_TEMPORAL_NR_FRAMES[] = "temporal-nr-frames";
 const char TICameraParameters::KEY_TEMP_BRACKETING[] = "temporal-bracketing";
 const char TICameraParameters::KEY_TEMP_BRACKETING_RANGE_POS[] = "temporal-bracketing-range-positive";
 const char TICameraParameters::KEY_TEMP_BRACKETING_RANGE_NEG[] = "temporal-bracketing-range-negative";
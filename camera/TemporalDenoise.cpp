@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file TemporalDenoise.cpp
+*
+* Block matching and temporal averaging of a YUV422I capture burst.
+*
+*/
+
+#define LOG_TAG "CameraHAL"
+
+#include "CameraHal.h"
+#include "TemporalDenoise.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace android {
+
+pthread_once_t TemporalDenoise::sWeightsOnce = PTHREAD_ONCE_INIT;
+uint16_t TemporalDenoise::sWeights[256];
+
+void TemporalDenoise::createWeights()
+{
+    //Differences up to the sensor noise are averaged fully, larger ones
+    //fade out so that motion the blocks couldn't follow doesn't ghost
+    for ( int i = 0 ; i < 256 ; i++ )
+        {
+        if ( i <= 4 )
+            {
+            sWeights[i] = 256;
+            }
+        else if ( i < 24 )
+            {
+            sWeights[i] = ( uint16_t ) ( ( 256 * ( 24 - i ) ) / 20 );
+            }
+        else
+            {
+            sWeights[i] = 0;
+            }
+        }
+}
+
+unsigned int TemporalDenoise::blockCost(const Band *band,
+                                        size_t frame,
+                                        int bx,
+                                        int by,
+                                        int dx,
+                                        int dy)
+{
+    const uint8_t *ref = band->mFrames[0];
+    const uint8_t *cur = band->mFrames[frame];
+    unsigned int cost = 0;
+    int xe = ( ( bx + BLOCK_SIZE ) < band->mWidth ) ? ( bx + BLOCK_SIZE ) : band->mWidth;
+    int ye = ( ( by + BLOCK_SIZE ) < band->mHeight ) ? ( by + BLOCK_SIZE ) : band->mHeight;
+    int xs, ys;
+
+    for ( int y = by ; y < ye ; y += MATCH_STEP )
+        {
+        ys = y + dy;
+        ys = ( ys < 0 ) ? 0 : ( ( ys >= band->mHeight ) ? ( band->mHeight - 1 ) : ys );
+        for ( int x = bx ; x < xe ; x += MATCH_STEP )
+            {
+            xs = x + dx;
+            xs = ( xs < 0 ) ? 0 : ( ( xs >= band->mWidth ) ? ( band->mWidth - 1 ) : xs );
+            cost += abs(ref[y * band->mStride + 2 * x + 1] -
+                        cur[ys * band->mStride + 2 * xs + 1]);
+            }
+        }
+
+    return cost;
+}
+
+void TemporalDenoise::matchBlock(const Band *band,
+                                 size_t frame,
+                                 int bx,
+                                 int by,
+                                 int &dx,
+                                 int &dy)
+{
+    int gx = band->mDx[frame];
+    int gy = band->mDy[frame];
+    unsigned int cost, bestCost = 0xFFFFFFFF;
+    int dist, bestDist = 0;
+
+    dx = gx;
+    dy = gy;
+
+    //Refine the global shift, horizontal steps stay on whole macropixels
+    for ( int y = -BLOCK_RANGE ; y <= BLOCK_RANGE ; y += 2 )
+        {
+        for ( int x = -BLOCK_RANGE ; x <= BLOCK_RANGE ; x += 2 )
+            {
+            cost = blockCost(band, frame, bx, by, gx + x, gy + y);
+            dist = abs(x) + abs(y);
+            if ( ( cost < bestCost ) ||
+                 ( ( cost == bestCost ) && ( dist < bestDist ) ) )
+                {
+                bestCost = cost;
+                bestDist = dist;
+                dx = gx + x;
+                dy = gy + y;
+                }
+            }
+        }
+}
+
+void *TemporalDenoise::denoiseBand(void *arg)
+{
+    Band *band = ( Band * ) arg;
+    int blocks = ( band->mWidth + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+    int half = band->mWidth / 2;
+    int *vectors;
+    int *v;
+    const uint8_t *r;
+    const uint8_t *p;
+    uint8_t *out;
+    int ye, sx, sy;
+    unsigned int w0, w1, wc;
+    unsigned int sumW0, sumW1, sumWc;
+    unsigned int sumU, sumY0, sumV, sumY1;
+
+    vectors = ( int * ) malloc(blocks * FrameMerge::MAX_FRAMES * 2 * sizeof(int));
+    if ( NULL == vectors )
+        {
+        CAMHAL_LOGEA("Unable to allocate block vectors");
+        return NULL;
+        }
+
+    for ( int by = band->mFirstRow ; by < band->mLastRow ; by += BLOCK_SIZE )
+        {
+        //Matching only reads reference rows of this block row, which
+        //haven't been overwritten yet
+        for ( int b = 0 ; b < blocks ; b++ )
+            {
+            for ( size_t k = 1 ; k < band->mCount ; k++ )
+                {
+                v = vectors + ( b * FrameMerge::MAX_FRAMES + k ) * 2;
+                matchBlock(band, k, b * BLOCK_SIZE, by, v[0], v[1]);
+                }
+            }
+
+        ye = ( ( by + BLOCK_SIZE ) < band->mLastRow ) ? ( by + BLOCK_SIZE ) : band->mLastRow;
+        for ( int y = by ; y < ye ; y++ )
+            {
+            out = band->mFrames[0] + y * band->mStride;
+
+            for ( int x = 0 ; x < half ; x++ )
+                {
+                r = out + 4 * x;
+
+                sumW0 = sumW1 = sumWc = 256;
+                sumU = 256 * r[0];
+                sumY0 = 256 * r[1];
+                sumV = 256 * r[2];
+                sumY1 = 256 * r[3];
+
+                for ( size_t k = 1 ; k < band->mCount ; k++ )
+                    {
+                    v = vectors + ( ( ( 2 * x ) / BLOCK_SIZE ) * FrameMerge::MAX_FRAMES + k ) * 2;
+
+                    sx = x + v[0] / 2;
+                    sx = ( sx < 0 ) ? 0 : ( ( sx >= half ) ? ( half - 1 ) : sx );
+                    sy = y + v[1];
+                    sy = ( sy < 0 ) ? 0 : ( ( sy >= band->mHeight ) ? ( band->mHeight - 1 ) : sy );
+                    p = band->mFrames[k] + sy * band->mStride + 4 * sx;
+
+                    w0 = sWeights[abs(p[1] - r[1])];
+                    w1 = sWeights[abs(p[3] - r[3])];
+                    wc = ( w0 + w1 ) >> 1;
+
+                    sumU += wc * p[0];
+                    sumY0 += w0 * p[1];
+                    sumV += wc * p[2];
+                    sumY1 += w1 * p[3];
+                    sumW0 += w0;
+                    sumW1 += w1;
+                    sumWc += wc;
+                    }
+
+                out[4 * x + 0] = ( uint8_t ) ( ( sumU + ( sumWc >> 1 ) ) / sumWc );
+                out[4 * x + 1] = ( uint8_t ) ( ( sumY0 + ( sumW0 >> 1 ) ) / sumW0 );
+                out[4 * x + 2] = ( uint8_t ) ( ( sumV + ( sumWc >> 1 ) ) / sumWc );
+                out[4 * x + 3] = ( uint8_t ) ( ( sumY1 + ( sumW1 >> 1 ) ) / sumW1 );
+                }
+            }
+        }
+
+    free(vectors);
+
+    return NULL;
+}
+
+status_t TemporalDenoise::merge(uint8_t **frames,
+                                size_t count,
+                                int width,
+                                int height,
+                                int stride)
+{
+    int dx[FrameMerge::MAX_FRAMES], dy[FrameMerge::MAX_FRAMES];
+    Band band;
+    status_t ret;
+
+    LOG_FUNCTION_NAME;
+
+    if ( ( NULL == frames ) || ( 2 > count ) || ( FrameMerge::MAX_FRAMES < count ) )
+        {
+        CAMHAL_LOGEB("Invalid burst of %u frames", ( unsigned int ) count);
+        return -EINVAL;
+        }
+
+    if ( ( width < BLOCK_SIZE ) || ( height < BLOCK_SIZE ) ||
+         ( stride < ( 2 * width ) ) )
+        {
+        CAMHAL_LOGEB("Invalid frame geometry %dx%d stride %d", width, height, stride);
+        return -EINVAL;
+        }
+
+    for ( size_t k = 0 ; k < count ; k++ )
+        {
+        if ( NULL == frames[k] )
+            {
+            CAMHAL_LOGEB("Burst frame %u missing", ( unsigned int ) k);
+            return -EINVAL;
+            }
+        }
+
+    pthread_once(&sWeightsOnce, createWeights);
+
+    //Hand shake between the frames is mostly a translation, the blocks
+    //only search a small window around it. The frames are equally
+    //exposed, plain luma projections match.
+    ret = FrameMerge::align(frames, count, 0, width, height, stride,
+                            MATCH_STEP, GLOBAL_RANGE, NULL, dx, dy);
+    if ( NO_ERROR != ret )
+        {
+        return ret;
+        }
+
+    band.mFrames = frames;
+    band.mCount = count;
+    band.mReference = 0;
+    band.mDx = dx;
+    band.mDy = dy;
+    band.mWidth = width;
+    band.mHeight = height;
+    band.mStride = stride;
+    //Bands start on block rows, so that blocks don't straddle threads
+    FrameMerge::runBands(band, BLOCK_SIZE, denoiseBand);
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+};
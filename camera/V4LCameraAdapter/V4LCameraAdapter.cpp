@@ -39,7 +39,6 @@
 
 
 #include <cutils/properties.h>
-#define UNLIKELY( exp ) (__builtin_expect( (exp) != 0, false ))
 static int mDebugFps = 0;
 
 #define Q16_OFFSET 16
@@ -52,9 +51,6 @@ namespace android {
 ///Maintain a separate tag for V4LCameraAdapter logs to isolate issues OMX specific
 #define LOG_TAG "CameraHAL"
 
-//frames skipped before recalculating the framerate
-#define FPS_PERIOD 30
-
 Mutex gAdapterLock;
 const char *device = DEVICE;
 
@@ -68,6 +64,8 @@ status_t V4LCameraAdapter::initialize(CameraProperties::Properties* caps)
     char value[PROPERTY_VALUE_MAX];
     property_get("debug.camera.showfps", value, "0");
     mDebugFps = atoi(value);
+    //a non zero debug.camera.showfps logs the frame rate report every so many seconds
+    mSensorFps.setReportPeriod(s2ns(mDebugFps));
 
     int ret = NO_ERROR;
 
@@ -293,6 +291,9 @@ status_t V4LCameraAdapter::startPreview()
     return BAD_VALUE;
     }
 
+   mSensorFps.setExpectedRange(mParams.getPreviewFrameRate(), mParams.getPreviewFrameRate());
+   mFrameCount = 0;
+
    for (int i = 0; i < mPreviewBufferCount; i++) {
 
        mVideoInfo->buf.index = i;
@@ -425,51 +426,10 @@ status_t V4LCameraAdapter::getPictureBufferSize(size_t &length, size_t bufferCou
     return NO_ERROR;
 }
 
-static void debugShowFPS()
+status_t V4LCameraAdapter::recalculateFPS(nsecs_t timestamp)
 {
-    static int mFrameCount = 0;
-    static int mLastFrameCount = 0;
-    static nsecs_t mLastFpsTime = 0;
-    static float mFps = 0;
     mFrameCount++;
-    if (!(mFrameCount & 0x1F)) {
-        nsecs_t now = systemTime();
-        nsecs_t diff = now - mLastFpsTime;
-        mFps = ((mFrameCount - mLastFrameCount) * float(s2ns(1))) / diff;
-        mLastFpsTime = now;
-        mLastFrameCount = mFrameCount;
-        ALOGD("Camera %d Frames, %f FPS", mFrameCount, mFps);
-    }
-    // XXX: mFPS has the value we want
-}
-
-status_t V4LCameraAdapter::recalculateFPS()
-{
-    float currentFPS;
-
-    mFrameCount++;
-
-    if ( ( mFrameCount % FPS_PERIOD ) == 0 )
-        {
-        nsecs_t now = systemTime();
-        nsecs_t diff = now - mLastFPSTime;
-        currentFPS =  ((mFrameCount - mLastFrameCount) * float(s2ns(1))) / diff;
-        mLastFPSTime = now;
-        mLastFrameCount = mFrameCount;
-
-        if ( 1 == mIter )
-            {
-            mFPS = currentFPS;
-            }
-        else
-            {
-            //cumulative moving average
-            mFPS = mLastFPS + (currentFPS - mLastFPS)/mIter;
-            }
-
-        mLastFPS = mFPS;
-        mIter++;
-        }
+    mSensorFps.frame(timestamp);
 
     return NO_ERROR;
 }
@@ -525,6 +485,9 @@ int V4LCameraAdapter::previewThread()
             return BAD_VALUE;
             }
 
+        CameraFrameStats::frameReached(&frame, CameraFrame::STAGE_FILLED);
+        recalculateFPS(frame.mStamps[CameraFrame::STAGE_FILLED]);
+
         uint8_t* ptr = (uint8_t*) mPreviewBufs.keyAt(index);
 
         int width, height;
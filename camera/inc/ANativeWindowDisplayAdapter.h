@@ -44,6 +44,7 @@ public:
         int mHeightStride;
         int mLength;
         CameraFrame::FrameType mType;
+        uint32_t mFrameId;
         } DisplayFrame;
 
     enum DisplayStates
@@ -65,17 +66,10 @@ public:
     virtual int setPreviewWindow(struct preview_stream_ops *window);
     virtual int setFrameProvider(FrameNotifier *frameProvider);
     virtual int setErrorHandler(ErrorNotifier *errorNotifier);
-    virtual int enableDisplay(int width, int height, struct timeval *refTime = NULL, S3DParameters *s3dParams = NULL);
+    virtual int enableDisplay(int width, int height, S3DParameters *s3dParams = NULL);
     virtual int disableDisplay(bool cancel_buffer = true);
     virtual status_t pauseDisplay(bool pause);
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //Used for shot to snapshot measurement
-    virtual status_t setSnapshotTimeRef(struct timeval *refTime = NULL);
-
-#endif
-
     virtual int useBuffers(void* bufArr, int num);
     virtual bool supportsExternalBuffering();
 
@@ -87,6 +81,9 @@ public:
 
     virtual int maxQueueableBuffers(unsigned int& queueable);
 
+    virtual status_t dump(int fd);
+    virtual int setCpuAccess(bool enable);
+
     ///Class specific functions
     static void frameCallbackRelay(CameraFrame* caFrame);
     void frameCallback(CameraFrame* caFrame);
@@ -99,6 +96,13 @@ public:
     status_t PostFrame(ANativeWindowDisplayAdapter::DisplayFrame &dispFrame);
     bool handleFrameReturn();
     status_t returnBuffersToWindow();
+    status_t lockBuffer(int slot);
+    void unlockBuffer(int slot);
+
+    ///Handle to slot lookup, avoids scanning the buffer maps per frame
+    status_t initHandleSlotTable();
+    void clearHandleSlotTable();
+    int getSlotForHandle(const void *handle) const;
 
 public:
 
@@ -159,7 +163,15 @@ private:
     IMG_native_handle_t** mGrallocHandleMap;
     uint32_t* mOffsetsMap;
     int mFD;
-    KeyedVector<int, int> mFramesWithCameraAdapterMap;
+    ///Per-slot flag, set while the buffer is owned by the camera adapter
+    bool* mFramesWithCameraAdapter;
+    ///Open addressed gralloc handle -> slot table, -1 marks an empty entry
+    int* mHandleSlotTable;
+    unsigned int mHandleSlotMask;
+    ///Per-slot flag, set while the buffer is locked through the gralloc mapper
+    bool* mGrallocLocked;
+    ///Lock buffers per frame only while a CPU consumer needs them
+    bool mCpuAccess;
     sp<ErrorNotifier> mErrorNotifier;
 
     uint32_t mFrameWidth;
@@ -172,14 +184,14 @@ private:
 
     const char *mPixelFormat;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-    //Used for calculating standby to first shot
-    struct timeval mStandbyToShot;
+    //Rate at which preview frames are queued to the window
+    CameraFpsStats mDisplayFps;
+
+#if CAMHAL_TRACE
+    //Used for tracing standby to first frame
     bool mMeasureStandby;
-    //Used for shot to snapshot/shot calculation
-    struct timeval mStartCapture;
+    //Used for tracing shot to snapshot/shot
     bool mShotToShot;
-
 #endif
 
 };
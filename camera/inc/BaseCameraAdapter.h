@@ -62,6 +62,9 @@ public:
     // Rolls the state machine back to INTIALIZED_STATE from the current state
     virtual status_t rollbackToInitializedState();
 
+    // Writes the sensor frame rate statistics
+    virtual status_t dump(int fd);
+
 protected:
     //The first two methods will try to switch the adapter state.
     //Every call to setState() should be followed by a corresponding
@@ -140,6 +143,18 @@ protected:
 
     virtual status_t switchToExecuting();
 
+    // Should be implemented by deriving classes which can keep the sensor
+    // running while the next stop-/startPreview pair reconfigures preview
+    virtual status_t prepareReconfigure();
+
+    // Should be implemented by deriving classes in order to adjust the
+    // number of preview buffers to the measured pipeline occupancy
+    virtual status_t getPreviewBufferCount(unsigned int &count);
+
+    // Should be implemented by deriving classes which capture more than
+    // one frame per shot with the current configuration
+    virtual status_t getCaptureFrameCount(unsigned int &count);
+
     // Receive orientation events from CameraHal
     virtual void onOrientationEvent(uint32_t orientation, uint32_t tilt);
 
@@ -191,13 +206,6 @@ protected:
         ERROR
     };
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    struct timeval mStartFocus;
-    struct timeval mStartCapture;
-
-#endif
-
     mutable Mutex mReturnFrameLock;
 
     //Lock protecting the Adapter state
@@ -254,10 +262,21 @@ protected:
     void *mEndCaptureData;
     bool mRecording;
 
-    uint32_t mFramesWithDucati;
+    //Time the shutter was pressed for the capture in progress
+    nsecs_t mShutterTimestamp;
+
+    //Preview buffers queued to the component, updated from the FBD
+    //and the frame return paths with android_atomic_inc/dec
+    volatile int32_t mFramesWithDucati;
     uint32_t mFramesWithDisplay;
     uint32_t mFramesWithEncoder;
 
+    //Sequence number given to each frame sent to the subscribers
+    uint32_t mNextFrameId;
+
+    //Frame rate and pacing of the preview stream coming from the sensor
+    CameraFpsStats mSensorFps;
+
 #ifdef DEBUG_LOG
     KeyedVector<int, bool> mBuffersWithDucati;
 #endif
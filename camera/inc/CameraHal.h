@@ -31,6 +31,9 @@
 #include <sys/stat.h>
 #include <utils/Log.h>
 #include <utils/threads.h>
+#include <utils/KeyedVector.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
 #include <linux/videodev2.h>
 #include "binder/MemoryBase.h"
 #include "binder/MemoryHeapBase.h"
@@ -42,6 +45,7 @@
 #include "CameraProperties.h"
 #include "DebugUtils.h"
 #include "SensorListener.h"
+#include "CameraTrace.h"
 
 #include <ui/GraphicBufferAllocator.h>
 #include <ui/GraphicBuffer.h>
@@ -71,8 +75,6 @@
                              GRALLOC_USAGE_SW_READ_RARELY | \
                              GRALLOC_USAGE_SW_WRITE_NEVER
 
-//Enables Absolute PPM measurements in logcat
-#define PPM_INSTRUMENTATION_ABS 1
 
 #define LOCK_BUFFER_TRIES 5
 #define HAL_PIXEL_FORMAT_NV12 0x100
@@ -192,6 +194,69 @@ protected:
     size_t mWeight;
 };
 
+///Typed set of the values supported for a single camera parameter.
+///The comma separated capability string is parsed once, so that
+///validating a parameter is an exact lookup instead of a substring
+///search (which would accept "40x30" as part of "640x300").
+class CameraSupportedValues
+{
+public:
+
+    CameraSupportedValues() {}
+
+    ///Commas inside parentheses don't split tokens, so ranges
+    ///like "(15000,30000),(30000,30000)" parse as two entries,
+    ///stored without the parentheses ("15000,30000") the way
+    ///CameraParameters reports a single range
+    status_t parse(const char *supported);
+
+    void clear();
+
+    bool isEmpty() const
+        {
+        return mValues.isEmpty();
+        }
+
+    bool contains(const char *value) const;
+    bool contains(int value) const;
+    bool containsResolution(unsigned int width, unsigned int height) const;
+
+private:
+
+    static uint32_t packResolution(unsigned int width, unsigned int height)
+        {
+        return ( ( width & 0xFFFF ) << 16 ) | ( height & 0xFFFF );
+        }
+
+    SortedVector<String8> mValues;
+    SortedVector<int> mIntValues;
+    SortedVector<uint32_t> mResolutions;
+};
+
+///Change-set between a new set of camera parameters and the one applied
+///before it. Adapters use it to skip settings, and the hardware calls
+///behind them, whose values did not change.
+class CameraParameterChanges
+{
+public:
+
+    ///@param all When set, every key is reported as changed (first time
+    ///           configuration or a forced re-apply)
+    CameraParameterChanges(const CameraParameters &params,
+                           const CameraParameters &oldParams,
+                           bool all) : mParams(params),
+                                       mOldParams(oldParams),
+                                       mAll(all) {}
+
+    bool changed(const char *key) const;
+
+private:
+
+    const CameraParameters &mParams;
+    const CameraParameters &mOldParams;
+    bool mAll;
+};
+
 class CameraFDResult : public RefBase
 {
 public:
@@ -249,8 +314,23 @@ class CameraFrame
     {
         ENCODE_RAW_YUV422I_TO_JPEG = 0x1 << 0,
         HAS_EXIF_DATA = 0x1 << 1,
+        ///Bracketed frames to be merged into one image before encoding
+        MERGE_EXPOSURE_BRACKET = 0x1 << 2,
+        ///Burst frames to be averaged into one image before encoding
+        DENOISE_BURST = 0x1 << 3,
     };
 
+    ///Points in the pipeline where a frame gets timestamped
+    enum FrameStage
+        {
+        STAGE_FILLED = 0, ///Buffer received from the sensor pipeline
+        STAGE_DISPATCHED, ///Handed over to the frame subscribers
+        STAGE_DISPLAYED, ///Queued to the preview window
+        STAGE_PREVIEW_CALLBACK, ///Delivered to the application preview callback
+        STAGE_VIDEO_CALLBACK, ///Delivered to the video recorder
+        STAGE_MAX
+        };
+
     //default contrustor
     CameraFrame():
     mCookie(NULL),
@@ -265,10 +345,14 @@ class CameraFrame
     mFd(0),
     mLength(0),
     mFrameMask(0),
-    mQuirks(0) {
+    mQuirks(0),
+    mFrameId(0),
+    mBracketIndex(0),
+    mBracketCount(0) {
 
       mYuv[0] = NULL;
       mYuv[1] = NULL;
+      memset(mStamps, 0, sizeof(mStamps));
     }
 
     //copy constructor
@@ -285,10 +369,14 @@ class CameraFrame
     mFd(frame.mFd),
     mLength(frame.mLength),
     mFrameMask(frame.mFrameMask),
-    mQuirks(frame.mQuirks) {
+    mQuirks(frame.mQuirks),
+    mFrameId(frame.mFrameId),
+    mBracketIndex(frame.mBracketIndex),
+    mBracketCount(frame.mBracketCount) {
 
       mYuv[0] = frame.mYuv[0];
       mYuv[1] = frame.mYuv[1];
+      memcpy(mStamps, frame.mStamps, sizeof(mStamps));
     }
 
     void *mCookie;
@@ -304,9 +392,123 @@ class CameraFrame
     unsigned mFrameMask;
     unsigned int mQuirks;
     unsigned int mYuv[2];
+    uint32_t mFrameId;
+    ///Position of an exposure bracketed image within its capture,
+    ///mBracketCount is 0 for frames which aren't bracketed
+    unsigned int mBracketIndex;
+    unsigned int mBracketCount;
+    ///Monotonic time at which the frame reached each stage, 0 if it didn't
+    nsecs_t mStamps[STAGE_MAX];
     ///@todo add other member vars like  stride etc
 };
 
+///Log-linear histogram of durations, 8 buckets per power of two microseconds
+class CameraHistogram
+{
+public:
+
+    enum
+        {
+        BUCKET_COUNT = 240
+        };
+
+    CameraHistogram() { reset(); }
+
+    void reset();
+    void add(nsecs_t value);
+    nsecs_t percentile(unsigned int pct) const;
+    uint32_t count() const { return mCount; }
+    nsecs_t max() const { return mMax; }
+
+private:
+
+    uint32_t mBuckets[BUCKET_COUNT];
+    uint32_t mCount;
+    nsecs_t mMax;
+};
+
+///Per stage latency and per consumer buffer hold time statistics of the
+///frames flowing through the pipeline. The adapter and its consumers only
+///see each other through the FrameNotifier interface, so the statistics
+///are shared process wide.
+class CameraFrameStats
+{
+public:
+
+    enum Consumer
+        {
+        CONSUMER_DISPLAY = 0,
+        CONSUMER_VIDEO_ENCODER,
+        CONSUMER_APP_CALLBACKS,
+        CONSUMER_MAX
+        };
+
+    ///Stamps the frame and accounts the time elapsed since the previous stage
+    static void frameReached(CameraFrame *frame, CameraFrame::FrameStage stage);
+
+    ///Hold times are measured from the dispatch of a buffer until a consumer returns it
+    static void frameDispatched(void *frameBuf, int frameType);
+    static void frameReturned(void *frameBuf, int frameType, Consumer consumer);
+
+    static void reset();
+    static void log();
+    static status_t dump(int fd);
+
+private:
+
+    static int format(char *buffer, size_t size, const char *name, const CameraHistogram &histogram);
+
+    static Mutex sLock;
+    static CameraHistogram sLatency[CameraFrame::STAGE_MAX];
+    static CameraHistogram sHoldTime[CONSUMER_MAX];
+    static KeyedVector<uint64_t, nsecs_t> sDispatchTimes;
+};
+
+///Frame rate and frame pacing statistics of a single stream
+class CameraFpsStats
+{
+public:
+
+    CameraFpsStats(const char *name);
+
+    void reset();
+
+    ///Gaps longer than the frame interval of the slowest configured
+    ///rate are accounted as dropped frames
+    void setExpectedRange(unsigned int minFps, unsigned int maxFps);
+
+    ///When non zero, a report is logged each period
+    void setReportPeriod(nsecs_t period);
+
+    void frame(nsecs_t timestamp);
+
+    float getFps() const;
+    void log() const;
+    status_t dump(int fd) const;
+
+private:
+
+    int format(char *buffer, size_t size) const;
+
+    const char *mName;
+    mutable Mutex mLock;
+    CameraHistogram mIntervals;
+    uint32_t mFrames;
+    uint32_t mDropped;
+    unsigned int mMinFps;
+    unsigned int mMaxFps;
+    nsecs_t mFirstTimestamp;
+    nsecs_t mLastTimestamp;
+    nsecs_t mLastInterval;
+    nsecs_t mReportPeriod;
+    nsecs_t mLastReport;
+    ///Smoothed inter-frame interval variation (RFC 3550)
+    double mJitter;
+    ///Running mean and variance of the interval (Welford)
+    double mIntervalMean;
+    double mIntervalM2;
+};
+
 enum CameraHalError
 {
     CAMERA_ERROR_FATAL = 0x1, //Fatal errors can only be recovered by restarting media server
@@ -453,10 +655,12 @@ class FrameProvider
     FrameNotifier* mFrameNotifier;
     void* mCookie;
     frame_callback mFrameCallback;
+    CameraFrameStats::Consumer mConsumer;
 
 public:
-    FrameProvider(FrameNotifier *fn, void* cookie, frame_callback frameCallback)
-        :mFrameNotifier(fn), mCookie(cookie),mFrameCallback(frameCallback) { }
+    FrameProvider(FrameNotifier *fn, void* cookie, frame_callback frameCallback,
+                  CameraFrameStats::Consumer consumer = CameraFrameStats::CONSUMER_APP_CALLBACKS)
+        :mFrameNotifier(fn), mCookie(cookie),mFrameCallback(frameCallback), mConsumer(consumer) { }
 
     int enableFrameNotification(int32_t frameTypes);
     int disableFrameNotification(int32_t frameTypes);
@@ -511,6 +715,8 @@ public:
     ///Constants
     static const int NOTIFIER_TIMEOUT;
     static const int32_t MAX_BUFFERS = 8;
+    ///Software jpeg encodes running at the same time
+    static const int32_t MAX_ENCODERS = 2;
 
     enum NotifierCommands
         {
@@ -623,6 +829,8 @@ private:
     status_t dummyRaw();
     void copyAndSendPictureFrame(CameraFrame* frame, int32_t msgType);
     void copyAndSendPreviewFrame(CameraFrame* frame, int32_t msgType);
+    CameraFrame *gatherBracketFrame(CameraFrame* frame);
+    void releaseBracketFrames();
 
 private:
     mutable Mutex mLock;
@@ -670,6 +878,9 @@ private:
     bool mUseMetaDataBufferMode;
     bool mRawAvailable;
 
+    //Bracket or denoise burst frames held until all of them are merged
+    Vector<CameraFrame *> mBracketFrames;
+
     bool mUseVideoBuffers;
 
     int mVideoWidth;
@@ -764,6 +975,9 @@ public:
         CAMERA_START_FD                             = 22,
         CAMERA_STOP_FD                              = 23,
         CAMERA_SWITCH_TO_EXECUTING                  = 24,
+        CAMERA_QUERY_PREVIEW_BUFFER_COUNT           = 25,
+        CAMERA_PREPARE_PREVIEW_RECONFIGURE          = 26,
+        CAMERA_QUERY_CAPTURE_FRAME_COUNT            = 27,
         };
 
     enum CameraMode
@@ -847,6 +1061,9 @@ public:
     // Retrieves the next Adapter state - for internal use (not locked)
     virtual status_t getNextState(AdapterState &state) = 0;
 
+    // Writes the adapter statistics
+    virtual status_t dump(int fd) = 0;
+
 protected:
     //The first two methods will try to switch the adapter state.
     //Every call to setState() should be followed by a corresponding
@@ -874,16 +1091,11 @@ public:
     virtual int setPreviewWindow(struct preview_stream_ops *window) = 0;
     virtual int setFrameProvider(FrameNotifier *frameProvider) = 0;
     virtual int setErrorHandler(ErrorNotifier *errorNotifier) = 0;
-    virtual int enableDisplay(int width, int height, struct timeval *refTime = NULL, S3DParameters *s3dParams = NULL) = 0;
+    virtual int enableDisplay(int width, int height, S3DParameters *s3dParams = NULL) = 0;
     virtual int disableDisplay(bool cancel_buffer = true) = 0;
     //Used for Snapshot review temp. pause
     virtual int pauseDisplay(bool pause) = 0;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-    //Used for shot to snapshot measurement
-    virtual int setSnapshotTimeRef(struct timeval *refTime = NULL) = 0;
-#endif
-
     virtual int useBuffers(void *bufArr, int num) = 0;
     virtual bool supportsExternalBuffering() = 0;
 
@@ -891,6 +1103,14 @@ public:
     // This function should only be called after
     // allocateBuffer
     virtual int maxQueueableBuffers(unsigned int& queueable) = 0;
+
+    // Writes the display statistics
+    virtual status_t dump(int fd) = 0;
+
+    // Enables per-frame gralloc locking of the preview buffers.
+    // Should only be enabled while some CPU consumer (preview
+    // callbacks, software video scaling) is reading the frames
+    virtual int setCpuAccess(bool enable) = 0;
 };
 
 static void releaseImageBuffers(void *userData);
@@ -1068,17 +1288,6 @@ public:
     /** Deinitialize CameraHal */
     void deinitialize();
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //Uses the constructor timestamp as a reference to calcluate the
-    // elapsed time
-    static void PPM(const char *);
-    //Uses a user provided timestamp as a reference to calcluate the
-    // elapsed time
-    static void PPM(const char *, struct timeval*, ...);
-
-#endif
-
     /** Free image bufs */
     status_t freeImageBufs();
 
@@ -1132,12 +1341,18 @@ private:
 
     //Check if a given resolution is supported by the current camera
     //instance
-    bool isResolutionValid(unsigned int width, unsigned int height, const char *supportedResolutions);
+    bool isResolutionValid(unsigned int width, unsigned int height, const CameraSupportedValues &supportedResolutions);
 
     //Check if a given parameter is supported by the current camera
     // instance
-    bool isParameterValid(const char *param, const char *supportedParams);
-    bool isParameterValid(int param, const char *supportedParams);
+    bool isParameterValid(const char *param, const CameraSupportedValues &supportedParams);
+    bool isParameterValid(int param, const CameraSupportedValues &supportedParams);
+
+    /** Parse the supported capability strings into typed sets */
+    void initSupportedValues();
+
+    /** Merge flattened "key=value;..." pairs into params, keeping other keys */
+    static void mergeParameters(CameraParameters &params, const String8 &flattened);
     status_t doesSetParameterNeedUpdate(const char *new_param, const char *old_params, bool &update);
 
     /** Initialize default parameters */
@@ -1158,6 +1373,8 @@ private:
     void setPreferredPreviewRes(int width, int height);
     void resetPreviewRes(CameraParameters *mParams, int width, int height);
 
+    void updateDisplayCpuAccess();
+
     //@}
 
 
@@ -1189,23 +1406,6 @@ public:
 
 
 
-
-
-///static member vars
-
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //Timestamp from the CameraHal constructor
-    static struct timeval ppm_start;
-    //Timestamp of the autoFocus command
-    static struct timeval mStartFocus;
-    //Timestamp of the startPreview command
-    static struct timeval mStartPreview;
-    //Timestamp of the takePicture command
-    static struct timeval mStartCapture;
-
-#endif
-
 /*----------Member variables - Private ---------------------*/
 private:
     bool mDynamicPreviewSwitch;
@@ -1264,6 +1464,33 @@ private:
     int mVideoWidth;
     int mVideoHeight;
 
+    //Number of preview buffers used by the current preview session
+    unsigned int mPreviewBufCount;
+
+    //Bumped on every change of mParameters, mFlattenedParameters caches
+    //the parameters returned to the application for one generation
+    uint32_t mParametersGeneration;
+    uint32_t mFlattenedParametersGeneration;
+    String8 mFlattenedParameters;
+    String8 mAdapterReportedParams;
+
+    //Supported values parsed from mCameraProperties at initialization
+    CameraSupportedValues mSupportedPreviewFormats;
+    CameraSupportedValues mSupportedIPPModes;
+    CameraSupportedValues mSupportedPreviewSizes;
+    CameraSupportedValues mSupportedFocusModes;
+    CameraSupportedValues mSupportedPictureFormats;
+    CameraSupportedValues mSupportedPictureSizes;
+    CameraSupportedValues mSupportedFramerateRanges;
+    CameraSupportedValues mSupportedFramerates;
+    CameraSupportedValues mSupportedExposureModes;
+    CameraSupportedValues mSupportedWhiteBalance;
+    CameraSupportedValues mSupportedAntibanding;
+    CameraSupportedValues mSupportedISOValues;
+    CameraSupportedValues mSupportedSceneModes;
+    CameraSupportedValues mSupportedFlashModes;
+    CameraSupportedValues mSupportedEffects;
+
 };
 
 
@@ -40,6 +40,13 @@ namespace android {
 #define EXIF_MAKE_DEFAULT "default_make"
 #define EXIF_MODEL_DEFAULT "default_model"
 
+///Capabilities of all cameras are cached here, so that only the first start
+///after a firmware update needs to query them from the remote core
+#define CAMERA_CAPS_CACHE_FILE "/data/misc/camera/camera_caps.bin"
+#define CAMERA_CAPS_CACHE_VERSION 2
+///The cache is valid only for the firmware image and build it was made with
+#define CAMERA_FIRMWARE_FILE "/system/vendor/firmware/ducati-m3.bin"
+
 // Class that handles the Camera Properties
 class CameraProperties
 {
@@ -150,7 +157,17 @@ public:
             Properties()
             {
                 mProperties = new DefaultKeyedVector<String8, String8>(String8(DEFAULT_VALUE));
+                reset();
+            }
+            ~Properties()
+            {
+                delete mProperties;
+            }
+            // drops every key but the ones set on construction
+            void reset()
+            {
                 char property[PROPERTY_VALUE_MAX];
+                mProperties->clear();
                 property_get("ro.product.manufacturer", property, EXIF_MAKE_DEFAULT);
                 property[0] = toupper(property[0]);
                 set(EXIF_MAKE, property);
@@ -158,19 +175,19 @@ public:
                 property[0] = toupper(property[0]);
                 set(EXIF_MODEL, property);
             }
-            ~Properties()
-            {
-                delete mProperties;
-            }
             ssize_t set(const char *prop, const char *value);
             ssize_t set(const char *prop, int value);
             const char* get(const char * prop);
             void dump();
 
+            size_t size() const;
+
         protected:
             const char* keyAt(unsigned int);
             const char* valueAt(unsigned int);
 
+            friend class CameraProperties;
+
         private:
             DefaultKeyedVector<String8, String8>* mProperties;
 
@@ -184,6 +201,10 @@ public:
 
 private:
 
+    status_t loadCachedProperties();
+    status_t storeCachedProperties();
+    status_t getFirmwareId(uint32_t &size, uint32_t &mtime, char *fingerprint);
+
     uint32_t mCamerasSupported;
     int mInitialized;
     mutable Mutex mLock;
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraTrace.h
+*
+* Low overhead binary event trace used to attribute camera latencies.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_CAMERA_TRACE_H
+#define ANDROID_CAMERA_HARDWARE_CAMERA_TRACE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+//Enables the camera trace ring. When disabled all trace points compile to nothing
+#ifndef CAMHAL_TRACE
+#define CAMHAL_TRACE 1
+#endif
+
+//Property holding a file path. When set, the trace is written there as
+//Chrome trace JSON each time preview stops
+#define CAMHAL_TRACE_FILE_PROPERTY "debug.camera.trace.file"
+
+#if CAMHAL_TRACE
+
+#define CAMHAL_TRACE_EVENT(event, frameId, arg0, arg1) \
+    android::CameraTrace::record(android::CameraTrace::event, frameId, arg0, arg1)
+
+#else
+
+#define CAMHAL_TRACE_EVENT(event, frameId, arg0, arg1)
+
+#endif
+
+namespace android {
+
+///Every thread recording events owns a ring, so recording takes no locks and
+///costs a timestamp and a few stores. Rings are only walked when dumping.
+class CameraTrace
+{
+public:
+
+    enum Event
+        {
+        PREVIEW_START = 0,
+        PREVIEW_FIRST_FRAME,
+        FOCUS_START,
+        FOCUS_DONE,
+        CAPTURE_START,
+        CAPTURE_SNAPSHOT,
+        CAPTURE_PREVIEW_RESUMED,
+        CAPTURE_JPEG,
+        EVENT_MAX
+        };
+
+    static void record(Event event, uint32_t frameId, uint32_t arg0, uint32_t arg1);
+
+    ///Writes the recorded events as Chrome trace (Perfetto compatible) JSON
+    static status_t dump(int fd);
+    static status_t dump(const char *path);
+
+private:
+
+    enum
+        {
+        RING_SIZE = 1024
+        };
+
+    struct Record
+        {
+        nsecs_t mTimestamp;
+        ///Rings outlive their threads, each record keeps its own
+        pid_t mTid;
+        uint32_t mEvent;
+        uint32_t mFrameId;
+        uint32_t mArg0;
+        uint32_t mArg1;
+        };
+
+    struct Ring
+        {
+        ///Thread currently owning the ring
+        pid_t mTid;
+        bool mInUse;
+        ///Only written by the owning thread, published after the record
+        volatile uint32_t mHead;
+        Record mRecords[RING_SIZE];
+        Ring *mNext;
+        };
+
+    static Ring *getRing();
+    static void createKey();
+    static void releaseRing(void *ring);
+
+    static pthread_once_t sKeyOnce;
+    static pthread_key_t sRingKey;
+    static Mutex sRingsLock;
+    static Ring *sRings;
+};
+
+};
+
+#endif //ANDROID_CAMERA_HARDWARE_CAMERA_TRACE_H
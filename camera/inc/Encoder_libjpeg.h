@@ -27,10 +27,6 @@
 #include <utils/threads.h>
 #include <utils/RefBase.h>
 
-extern "C" {
-#include "jhead.h"
-}
-
 #define CANCEL_TIMEOUT 3000000 // 3 seconds
 
 namespace android {
@@ -39,6 +35,11 @@ namespace android {
  */
 
 #define MAX_EXIF_TAGS_SUPPORTED 30
+
+// Room the encoder leaves ahead of the main jpeg for the APP1 segment:
+// marker plus the largest length a JPEG segment can carry
+#define EXIF_APP1_MAX_SIZE (2 + 0xFFFF)
+
 typedef void (*encoder_libjpeg_callback_t) (void* main_jpeg,
                                             void* thumb_jpeg,
                                             CameraFrame::FrameType type,
@@ -47,7 +48,10 @@ typedef void (*encoder_libjpeg_callback_t) (void* main_jpeg,
                                             void* cookie3,
                                             bool canceled);
 
-// these have to match strings defined in external/jhead/exif.c
+// prefix of EXIF strings stored with the UNDEFINED format
+static const char ExifAsciiPrefix[] = { 0x41, 0x53, 0x43, 0x49, 0x49, 0x0, 0x0, 0x0 };
+
+// tag names accepted by ExifElementsTable::insertElement()
 static const char TAG_MODEL[] = "Model";
 static const char TAG_MAKE[] = "Make";
 static const char TAG_FOCALLENGTH[] = "FocalLength";
@@ -85,24 +89,43 @@ static const char TAG_CUSTOM_RENDERED[] = "CustomRendered";
 class ExifElementsTable {
     public:
         ExifElementsTable() :
-           gps_tag_count(0), exif_tag_count(0), position(0),
-           jpeg_opened(false), has_datetime_tag(false) { }
+           position(0), thumbnail(NULL), thumbnail_size(0) { }
         ~ExifElementsTable();
 
         status_t insertElement(const char* tag, const char* value);
-        void insertExifToJpeg(unsigned char* jpeg, size_t jpeg_size);
+        size_t insertExifToJpeg(unsigned char* jpeg, size_t jpeg_size, size_t headroom);
         status_t insertExifThumbnailImage(const char*, int);
-        void saveJpeg(unsigned char* picture, size_t jpeg_size);
         static const char* degreesToExifOrientation(unsigned int);
         static void stringToRational(const char*, unsigned int*, unsigned int*);
         static bool isAsciiTag(const char* tag);
     private:
-        ExifElement_t table[MAX_EXIF_TAGS_SUPPORTED];
-        unsigned int gps_tag_count;
-        unsigned int exif_tag_count;
+        enum ExifIfd {
+            IFD_0 = 0,
+            IFD_EXIF,
+            IFD_GPS,
+            IFD_1,
+            IFD_MAX
+        };
+
+        // one directory entry, value already in TIFF (little endian) layout
+        struct ExifElement {
+            unsigned short tag;
+            unsigned short format;
+            unsigned int ifd;
+            unsigned int count;
+            unsigned int size;
+            unsigned char* data;
+        };
+
+        static unsigned int ifdSize(ExifElement** entries, unsigned int count);
+        static unsigned int writeIfd(unsigned char* tiff, unsigned int offset,
+                                     ExifElement** entries, unsigned int count,
+                                     unsigned int next);
+
+        ExifElement table[MAX_EXIF_TAGS_SUPPORTED];
         unsigned int position;
-        bool jpeg_opened;
-        bool has_datetime_tag;
+        const unsigned char* thumbnail;
+        size_t thumbnail_size;
 };
 
 class Encoder_libjpeg : public Thread {
@@ -121,6 +144,7 @@ class Encoder_libjpeg : public Thread {
             int right_crop;
             int start_offset;
             const char* format;
+            bool jfif;
             size_t jpeg_size;
          };
     /* public member functions */
@@ -146,7 +170,7 @@ class Encoder_libjpeg : public Thread {
         virtual bool threadLoop() {
             size_t size = 0;
             sp<Encoder_libjpeg> tn = NULL;
-            if (mThumbnailInput) {
+            if (mThumbnailInput && !mCancelEncoding) {
                 // start thread to encode thumbnail
                 mThumb = new Encoder_libjpeg(mThumbnailInput, NULL, NULL, mType, NULL, NULL, NULL);
                 mThumb->run();
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ExposureFusion.h
+*
+* Merges the frames of an exposure bracket into a single image.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_EXPOSURE_FUSION_H
+#define ANDROID_CAMERA_HARDWARE_EXPOSURE_FUSION_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+#include "FrameMerge.h"
+
+namespace android {
+
+///Exposure fusion of bracketed YUV422I (UYVY) frames. The frames are
+///aligned on a global translation and blended per pixel with weights
+///favouring well exposed luma. The result is written over the best
+///exposed frame, so no extra image sized buffer is needed.
+class ExposureFusion
+{
+public:
+
+    enum
+        {
+        ///Largest misalignment searched for, in pixels
+        MAX_SHIFT = 32
+        };
+
+    ///Merges count frames of width x height pixels. Returns the index of
+    ///the frame holding the result in reference.
+    static status_t merge(uint8_t **frames,
+                          size_t count,
+                          int width,
+                          int height,
+                          int stride,
+                          size_t &reference);
+
+private:
+
+    ///Sampling step of the alignment and exposure statistics
+    enum
+        {
+        STATS_STEP = 4
+        };
+
+    typedef FrameMerge::Band Band;
+
+    static void createWeights();
+    static void *blendBand(void *band);
+    static int median(const uint8_t *frame, int width, int height, int stride);
+
+    static pthread_once_t sWeightsOnce;
+    ///Well-exposedness of each luma value
+    static uint16_t sWeights[256];
+};
+
+};
+
+#endif //ANDROID_CAMERA_HARDWARE_EXPOSURE_FUSION_H
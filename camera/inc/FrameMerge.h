@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameMerge.h
+*
+* Alignment and band scheduling shared by the multi-frame capture merges.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_FRAME_MERGE_H
+#define ANDROID_CAMERA_HARDWARE_FRAME_MERGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+namespace android {
+
+///Common parts of ExposureFusion and TemporalDenoise. Both merge a few
+///YUV422I (UYVY) frames into one of them after aligning the others on a
+///global translation, with the per pixel work split into horizontal bands.
+class FrameMerge
+{
+public:
+
+    enum
+        {
+        ///Frames held at once, must stay below the capture buffers
+        MAX_FRAMES = 3,
+        ///Worker threads merging horizontal bands of the image
+        THREADS = 2
+        };
+
+    ///Rows [mFirstRow, mLastRow) of a merge, handed to the band kernel
+    struct Band
+        {
+        uint8_t **mFrames;
+        size_t mCount;
+        size_t mReference;
+        const int *mDx;
+        const int *mDy;
+        int mWidth;
+        int mHeight;
+        int mStride;
+        int mFirstRow;
+        int mLastRow;
+        };
+
+    typedef void *(*BandKernel)(void *band);
+
+    ///Estimates the translation of every frame against the reference from
+    ///row and column luma projections sampled every step pixels. With
+    ///thresholds the projections count the pixels brighter than the
+    ///frame's threshold, which makes differently exposed frames comparable.
+    ///Shifts are multiples of step, range is the largest one searched.
+    static status_t align(uint8_t **frames,
+                          size_t count,
+                          size_t reference,
+                          int width,
+                          int height,
+                          int stride,
+                          int step,
+                          int range,
+                          const int *thresholds,
+                          int *dx,
+                          int *dy);
+
+    ///Runs kernel over THREADS bands of the image described by merge.
+    ///Bands start on multiples of rowAlign rows.
+    static void runBands(const Band &merge, int rowAlign, BandKernel kernel);
+
+private:
+
+    static void project(const uint8_t *frame,
+                        int width,
+                        int height,
+                        int stride,
+                        int step,
+                        int threshold,
+                        int *rows,
+                        int *cols);
+    static int bestShift(const int *ref, const int *cur, int len, int range);
+};
+
+};
+
+#endif //ANDROID_CAMERA_HARDWARE_FRAME_MERGE_H
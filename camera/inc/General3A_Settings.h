@@ -41,9 +41,23 @@ struct userToOMX_LUT{
     int         omxDefinition;
 };
 
+//Identifies a table, so that its lookup index can be shared by all copies
+enum LUTId{
+    ExpLUTId = 0,
+    WBalLUTId,
+    FlickerLUTId,
+    SceneLUTId,
+    FlashLUTId,
+    EffLUTId,
+    FocusLUTId,
+    IsoLUTId,
+    LUTIdMax
+};
+
 struct LUTtype{
     int size;
     const userToOMX_LUT *Table;
+    LUTId id;
 };
 
 const userToOMX_LUT isoUserToOMX[] = {
@@ -175,49 +189,57 @@ const userToOMX_LUT flash_UserToOMX [] = {
 const LUTtype ExpLUT =
     {
     sizeof(exposure_UserToOMX)/sizeof(exposure_UserToOMX[0]),
-    exposure_UserToOMX
+    exposure_UserToOMX,
+    ExpLUTId
     };
 
 const LUTtype WBalLUT =
     {
     sizeof(whiteBal_UserToOMX)/sizeof(whiteBal_UserToOMX[0]),
-    whiteBal_UserToOMX
+    whiteBal_UserToOMX,
+    WBalLUTId
     };
 
 const LUTtype FlickerLUT =
     {
     sizeof(antibanding_UserToOMX)/sizeof(antibanding_UserToOMX[0]),
-    antibanding_UserToOMX
+    antibanding_UserToOMX,
+    FlickerLUTId
     };
 
 const LUTtype SceneLUT =
     {
     sizeof(scene_UserToOMX)/sizeof(scene_UserToOMX[0]),
-    scene_UserToOMX
+    scene_UserToOMX,
+    SceneLUTId
     };
 
 const LUTtype FlashLUT =
     {
     sizeof(flash_UserToOMX)/sizeof(flash_UserToOMX[0]),
-    flash_UserToOMX
+    flash_UserToOMX,
+    FlashLUTId
     };
 
 const LUTtype EffLUT =
     {
     sizeof(effects_UserToOMX)/sizeof(effects_UserToOMX[0]),
-    effects_UserToOMX
+    effects_UserToOMX,
+    EffLUTId
     };
 
 const LUTtype FocusLUT =
     {
     sizeof(focus_UserToOMX)/sizeof(focus_UserToOMX[0]),
-    focus_UserToOMX
+    focus_UserToOMX,
+    FocusLUTId
     };
 
 const LUTtype IsoLUT =
     {
     sizeof(isoUserToOMX)/sizeof(isoUserToOMX[0]),
-    isoUserToOMX
+    isoUserToOMX,
+    IsoLUTId
     };
 
 /*
@@ -270,6 +292,7 @@ enum E3ASettingsFlags
     SetExpLock              = 1 << 16,
     SetWBLock               = 1 << 17,
     SetMeteringAreas        = 1 << 18,
+    SetFocusAreas           = 1 << 19,
 
     E3aSettingMax,
     E3AsettingsAll = ( ((E3aSettingMax -1 ) << 1) -1 ) /// all possible flags raised
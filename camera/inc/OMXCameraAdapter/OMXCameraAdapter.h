@@ -69,9 +69,17 @@ namespace android {
 #define DEFAULT_THUMB_HEIGHT        120
 #define FRAME_RATE_FULL_HD          27
 #define ZOOM_STAGES                 61
+#define ZOOM_STAGE_DURATION_MS      25 //Smooth zoom time spent per zoom stage
+#define ZOOM_MIN_POSITION_DELTA     32 //Smallest smooth zoom update, in 1/256 of a stage
+#define MAX_3A_SETTINGS_PER_FRAME   2 //3A settings applied from a preview frame callback
+#define MAX_TRANSITION_STEPS        3 //OMX commands queued by a single state transition
+#define CURRENT_ISO_REFRESH_FRAMES  15 //Preview frames between reads of the current ISO
 
 #define FACE_DETECTION_BUFFER_SIZE  0x1000
 #define MAX_NUM_FACES_SUPPORTED     35
+#define FACE_RESULT_POOL_SIZE       4
+//Face rectangle movement, in -1000..1000 units, below which no new result is sent
+#define FACE_DELTA_THRESHOLD        10
 
 #define EXIF_MODEL_SIZE             100
 #define EXIF_MAKE_SIZE              100
@@ -264,8 +272,10 @@ public:
         SetExpBracket           = 1 << 2,
         SetQuality              = 1 << 3,
         SetRotation             = 1 << 4,
+        SetBurst                = 1 << 5,
         ECaptureSettingMax,
-        ECapturesettingsAll = ( ((ECaptureSettingMax -1 ) << 1) -1 ) /// all possible flags raised
+        ECapturesettingsAll = ( ((ECaptureSettingMax -1 ) << 1) -1 ), /// all possible flags raised
+        ECaptureSettingsLive = SetExpBracket | SetRotation /// applied without reconfiguring the capture port
     };
 
     class GPSData
@@ -410,6 +420,9 @@ protected:
     virtual status_t startFaceDetection();
     virtual status_t stopFaceDetection();
     virtual status_t switchToExecuting();
+    virtual status_t prepareReconfigure();
+    virtual status_t getPreviewBufferCount(unsigned int &count);
+    virtual status_t getCaptureFrameCount(unsigned int &count);
     virtual void onOrientationEvent(uint32_t orientation, uint32_t tilt);
 
 private:
@@ -420,6 +433,17 @@ private:
 
     status_t switchToLoaded();
 
+    ///One OMX command of a transition, completed by its OMX_EventCmdComplete
+    struct OMXTransitionStep
+        {
+        OMX_COMMANDTYPE mCommand;
+        OMX_U32 mParam;
+        const char *mName;
+        };
+
+    //Issues all steps back to back and waits for each one's completion at the end
+    status_t runTransition(const OMXTransitionStep *steps, unsigned int count);
+
     OMXCameraPortParameters *getPortParams(CameraFrame::FrameType frameType);
 
     OMX_ERRORTYPE SignalEvent(OMX_IN OMX_HANDLETYPE hComponent,
@@ -439,6 +463,12 @@ private:
                                           OMX_IN OMX_U32 nData2,
                                           OMX_IN Semaphore &semaphore);
 
+    //Pending event waiters, all of them are protected by mEventLock
+    struct OMXEventWaiter;
+    void initEventWaiters();
+    void flushEventWaiters(bool signal);
+    OMXEventWaiter *takeEventWaiter(OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2);
+
     status_t setPictureRotation(unsigned int degree);
     status_t setSensorOrientation(unsigned int degree);
     status_t setImageQuality(unsigned int quality);
@@ -446,6 +476,7 @@ private:
 
     //EXIF
     status_t setParametersEXIF(const CameraParameters &params,
+                               const CameraParameterChanges &changes,
                                BaseCameraAdapter::AdapterState state);
     status_t convertGPSCoord(double coord, int &deg, int &min, int &sec, int &secDivisor);
     status_t setupEXIF();
@@ -463,6 +494,7 @@ private:
 
     //Focus distances
     status_t setParametersFocus(const CameraParameters &params,
+                                const CameraParameterChanges &changes,
                                 BaseCameraAdapter::AdapterState state);
     status_t addFocusDistances(OMX_U32 &near,
                                OMX_U32 &optimal,
@@ -479,10 +511,12 @@ private:
     status_t setParametersZoom(const CameraParameters &params,
                                BaseCameraAdapter::AdapterState state);
     status_t doZoom(int index);
+    status_t setZoomPosition(int position);
     status_t advanceZoom();
 
     //3A related parameters
     status_t setParameters3A(const CameraParameters &params,
+                             const CameraParameterChanges &changes,
                              BaseCameraAdapter::AdapterState state);
 
     // scene modes
@@ -511,6 +545,9 @@ private:
     status_t setISO(Gen3A_settings& Gen3A);
     status_t setEffect(Gen3A_settings& Gen3A);
     status_t setMeteringAreas(Gen3A_settings& Gen3A);
+    status_t setAlgoAreas(OMX_ALGOAREAPURPOSE purpose,
+                          const Vector< sp<CameraArea> > &areas,
+                          unsigned int range);
 
     status_t getEVCompensation(Gen3A_settings& Gen3A);
     status_t getWBMode(Gen3A_settings& Gen3A);
@@ -528,6 +565,7 @@ private:
     status_t setVFramerate(OMX_U32 minFrameRate,OMX_U32 maxFrameRate);
 
     status_t setParametersAlgo(const CameraParameters &params,
+                               const CameraParameterChanges &changes,
                                BaseCameraAdapter::AdapterState state);
 
     //Noise filtering
@@ -553,13 +591,17 @@ private:
     status_t updateFocusDistances(CameraParameters &params);
     status_t setFaceDetection(bool enable, OMX_U32 orientation);
     status_t detectFaces(OMX_BUFFERHEADERTYPE* pBuffHeader,
-                         sp<CameraFDResult> &result,
                          size_t previewWidth,
                          size_t previewHeight);
+    void processFaces(const OMX_FACEDETECTIONTYPE *faceData,
+                      size_t previewWidth,
+                      size_t previewHeight);
     status_t encodeFaceCoordinates(const OMX_FACEDETECTIONTYPE *faceData,
-                                   camera_frame_metadata_t **pFaces,
+                                   camera_frame_metadata_t *faceResult,
                                    size_t previewWidth,
                                    size_t previewHeight);
+    status_t allocateFaceResults();
+    bool facesChanged(const camera_frame_metadata_t *faceResult);
     void pauseFaceDetection(bool pause);
 
     //3A Algorithms priority configuration
@@ -622,13 +664,21 @@ private:
     //Shutter callback notifications
     status_t setShutterCallback(bool enabled);
 
+    //Selects the ZSL history frame exposed at the shutter press
+    status_t setZslDelay(nsecs_t shutterTimestamp);
+
     //Sets eithter HQ or HS mode and the frame count
     status_t setCaptureMode(OMXCameraAdapter::CaptureMode mode);
     status_t UseBuffersCapture(void* bufArr, int num);
     status_t UseBuffersPreviewData(void* bufArr, int num);
 
     //Used for calculation of the average frame rate during preview
-    status_t recalculateFPS();
+    status_t recalculateFPS(nsecs_t timestamp);
+
+    //Tracks preview buffer occupancy and derives the buffer count
+    //for the next preview start
+    void updatePreviewBufferUsage();
+    void resetPreviewBufferUsage();
 
     //Helper method for initializing a CameFrame object
     status_t initCameraFrame(CameraFrame &frame, OMX_IN OMX_BUFFERHEADERTYPE *pBuffHeader, int typeOfFrame, OMXCameraPortParameters *port);
@@ -638,7 +688,11 @@ private:
 
     status_t sendCallBacks(CameraFrame frame, OMX_IN OMX_BUFFERHEADERTYPE *pBuffHeader, unsigned int mask, OMXCameraPortParameters *port);
 
-    status_t apply3Asettings( Gen3A_settings& Gen3A );
+    ///Applies at most maxSettings of the pending 3A settings, 0 applies all.
+    ///The rest stay pending for the next call.
+    status_t apply3Asettings( Gen3A_settings& Gen3A, unsigned int maxSettings = 0 );
+    void invalidate3Asettings();
+    void clearApplied3Asettings();
     status_t init3AParams(Gen3A_settings &Gen3A);
 
     // AutoConvergence
@@ -724,6 +778,44 @@ public:
 
     sp<OMXCallbackHandler> mOMXCallbackHandler;
 
+    ///Turns face detection extradata into face events, so that preview
+    ///buffers don't wait for face processing or algo priority configs
+    class FaceDetectionHandler : public Thread {
+        public:
+            FaceDetectionHandler(OMXCameraAdapter* ca);
+
+            virtual bool threadLoop();
+
+            ///Queues a copy of the faces, returns false if the queue is full
+            bool put(const OMX_FACEDETECTIONTYPE *faces,
+                     size_t previewWidth,
+                     size_t previewHeight);
+
+            void exit();
+
+        private:
+            enum {
+                QUEUE_SIZE = 4,
+            };
+
+            struct Snapshot {
+                OMX_FACEDETECTIONTYPE mFaces;
+                size_t mPreviewWidth;
+                size_t mPreviewHeight;
+            };
+
+            Snapshot mQueue[QUEUE_SIZE];
+            ///Written by the producer only, published after the snapshot
+            volatile uint32_t mHead;
+            ///Written by the handler only
+            volatile uint32_t mTail;
+            volatile bool mExit;
+            Semaphore mSem;
+            OMXCameraAdapter* mCameraAdapter;
+    };
+
+    sp<FaceDetectionHandler> mFaceDetectionHandler;
+
 private:
 
     //AF callback
@@ -810,6 +902,12 @@ private:
     Vector< sp<CameraArea> > mMeteringAreas;
     mutable Mutex mMeteringAreasLock;
 
+    // Shared buffers the areas are sent in, one per OMX_ALGOAREAPURPOSE.
+    // Allocated on first use, they also hold the areas last sent.
+    MemoryManager mAlgoAreasMemMgr;
+    OMX_ALGOAREASTYPE **mAlgoAreas;
+    int mAlgoAreasSize;
+
     CaptureMode mCapMode;
     size_t mBurstFrames;
     size_t mCapturedFrames;
@@ -819,6 +917,8 @@ private:
     //Exposure Bracketing
     int mExposureBracketingValues[EXP_BRACKET_RANGE];
     size_t mExposureBracketingValidEntries;
+    bool mExposureBracketMerge;
+    size_t mTemporalNRFrames;
 
     mutable Mutex mFaceDetectionLock;
     //Face detection status
@@ -829,6 +929,12 @@ private:
     camera_face_t  faceDetectionLastOutput [MAX_NUM_FACES_SUPPORTED];
     int faceDetectionNumFacesLastOutput;
 
+    //Results are reused once the subscribers released them
+    sp<CameraFDResult> mFaceResultPool[FACE_RESULT_POOL_SIZE];
+    //Faces of the last result sent, -1 when none was sent yet
+    camera_face_t mFaceLastNotified[MAX_NUM_FACES_SUPPORTED];
+    int mFaceNumLastNotified;
+
     //Geo-tagging
     EXIFData mEXIFData;
 
@@ -844,9 +950,6 @@ private:
     //thumbnail quality
     unsigned int mThumbQuality;
 
-    //variables holding the estimated framerate
-    float mFPS, mLastFPS;
-
     //automatically disable AF after a given amount of frames
     unsigned int mFocusThreshold;
 
@@ -858,10 +961,16 @@ private:
 
     //current zoom
     Mutex mZoomLock;
-    unsigned int mCurrentZoomIdx, mTargetZoomIdx, mPreviousZoomIndx;
+    unsigned int mCurrentZoomIdx, mTargetZoomIdx;
+    int32_t mPreviousZoomFactor;
     bool mZoomUpdating, mZoomUpdate;
     int mZoomInc;
     bool mReturnZoomStatus;
+    //Smooth zoom ramp, positions are zoom stages in 1/256 units
+    int mZoomPosition;
+    int mZoomRampStart;
+    nsecs_t mZoomRampStartTime;
+    nsecs_t mZoomRampDuration;
     static const int32_t ZOOM_STEPS [];
 
      //local copy
@@ -870,6 +979,9 @@ private:
     unsigned int mPending3Asettings;
     Mutex m3ASettingsUpdateLock;
     Gen3A_settings mParameters3A;
+    ///Last value the component accepted for each 3A setting,
+    ///used to drop settings which wouldn't change anything
+    KeyedVector<unsigned int, int> mApplied3Asettings;
     const char *mPictureFormatFromClient;
 
     OMX_TI_CONFIG_3A_FACE_PRIORITY mFacePriority;
@@ -894,12 +1006,25 @@ private:
     int mBracketingRange;
 
     bool mIternalRecordingHint;
+    OMX_U32 mZslHistoryLen;
 
     CameraParameters mParameters;
     bool mOmxInitialized;
     OMXCameraAdapterComponentContext mCameraAdapterParameters;
     bool mFirstTimeInit;
 
+    ///Hardware settings not re-applied by setParameters because their keys
+    ///didn't change
+    uint32_t mParamRPCsAvoided;
+
+    ///ISO reported by getParameters, read back from the component after
+    ///3A settings were applied, the scene changed or every
+    ///CURRENT_ISO_REFRESH_FRAMES preview frames
+    OMX_U32 mCurrentISO;
+    bool mCurrentISOValid;
+    bool mCurrentISORead;
+    unsigned int mCurrentISOFrames;
+
     ///Semaphores used internally
     Semaphore mInitSem;
     Semaphore mFlushSem;
@@ -910,12 +1035,31 @@ private:
     Semaphore mStopPreviewSem;
     Semaphore mStartCaptureSem;
     Semaphore mStopCaptureSem;
-    Semaphore mSwitchToLoadedSem;
-    Semaphore mSwitchToExecSem;
+    ///One per step of the transition in progress
+    Semaphore mTransitionSem[MAX_TRANSITION_STEPS];
 
     mutable Mutex mStateSwitchLock;
 
-    Vector<struct TIUTILS::Message *> mEventSignalQ;
+    ///Threads waiting for an OMX event. The waiters are preallocated and
+    ///hashed by event and nData2, which are never wildcards.
+    struct OMXEventWaiter
+        {
+        OMX_EVENTTYPE mEvent;
+        OMX_U32 mData1;
+        OMX_U32 mData2;
+        Semaphore *mSemaphore;
+        OMXEventWaiter *mNext;
+        };
+
+    enum
+        {
+        EVENT_WAITERS_MAX = 16,
+        EVENT_WAITER_BUCKETS = 8
+        };
+
+    OMXEventWaiter mEventWaiters[EVENT_WAITERS_MAX];
+    OMXEventWaiter *mEventWaiterBuckets[EVENT_WAITER_BUCKETS];
+    OMXEventWaiter *mFreeEventWaiters;
     Mutex mEventLock;
 
     OMX_STATETYPE mComponentState;
@@ -932,10 +1076,11 @@ private:
     //stop-/startPreview
     bool mOMXStateSwitch;
 
+    //The next stopPreview is followed by startPreview right away,
+    //so the component may stay in OMX_Executing
+    bool mPreviewReconfigure;
+
     int mFrameCount;
-    int mLastFrameCount;
-    unsigned int mIter;
-    nsecs_t mLastFPSTime;
     Mutex mFrameCountMutex;
     Condition mFirstFrameCondition;
 
@@ -955,6 +1100,16 @@ private:
     OMX_BOOL mUserSetExpLock;
     OMX_BOOL mUserSetWbLock;
 
+    //Adaptive preview buffer count
+    static const unsigned int PREVIEW_BUFS_MIN = 4;
+    static const unsigned int PREVIEW_BUFS_EVAL_FRAMES = 300;
+    static const unsigned int PREVIEW_BUFS_STARVED_THRESHOLD = 3;
+    static const unsigned int PREVIEW_BUFS_IDLE_WITH_DUCATI = 3;
+    unsigned int mPreviewBufsRecommended;
+    unsigned int mPreviewBufsEvalFrames;
+    unsigned int mPreviewBufsStarved;
+    unsigned int mPreviewBufsMinWithDucati;
+
 };
 }; //// namespace
 #endif //OMX_CAMERA_ADAPTER_H
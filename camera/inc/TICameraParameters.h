@@ -55,6 +55,8 @@ static const  char KEY_METERING_MODE[];
 static const  char KEY_PADDED_WIDTH[];
 static const  char KEY_PADDED_HEIGHT[];
 static const char  KEY_EXP_BRACKETING_RANGE[];
+static const char  KEY_EXP_BRACKETING_MERGE[];
+static const char  KEY_TEMPORAL_NR_FRAMES[];
 static const char  KEY_TEMP_BRACKETING[];
 static const char  KEY_TEMP_BRACKETING_RANGE_POS[];
 static const char  KEY_TEMP_BRACKETING_RANGE_NEG[];
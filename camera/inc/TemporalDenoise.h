@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file TemporalDenoise.h
+*
+* Multi-frame noise reduction of a short still capture burst.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_TEMPORAL_DENOISE_H
+#define ANDROID_CAMERA_HARDWARE_TEMPORAL_DENOISE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+#include "FrameMerge.h"
+
+namespace android {
+
+///Temporal averaging of equally exposed YUV422I (UYVY) frames. Every block
+///of the first frame is matched against the other frames, the matched
+///pixels are averaged in unless they differ too much from the reference,
+///so that moving objects don't ghost. The result is written over the first
+///frame.
+class TemporalDenoise
+{
+public:
+
+    ///Averages count frames of width x height pixels into the first one
+    static status_t merge(uint8_t **frames,
+                          size_t count,
+                          int width,
+                          int height,
+                          int stride);
+
+private:
+
+    enum
+        {
+        ///Square blocks sharing one motion vector
+        BLOCK_SIZE = 32,
+        ///Block search range around the global shift, in pixels
+        BLOCK_RANGE = 4,
+        ///Global search range, in pixels
+        GLOBAL_RANGE = 32,
+        ///Sampling step of the block and global matching
+        MATCH_STEP = 4
+        };
+
+    typedef FrameMerge::Band Band;
+
+    static void createWeights();
+    static void *denoiseBand(void *band);
+    static void matchBlock(const Band *band,
+                           size_t frame,
+                           int bx,
+                           int by,
+                           int &dx,
+                           int &dy);
+    static unsigned int blockCost(const Band *band,
+                                  size_t frame,
+                                  int bx,
+                                  int by,
+                                  int dx,
+                                  int dy);
+
+    static pthread_once_t sWeightsOnce;
+    ///Weight of a pixel by its luma difference to the reference
+    static uint16_t sWeights[256];
+};
+
+};
+
+#endif //ANDROID_CAMERA_HARDWARE_TEMPORAL_DENOISE_H
@@ -112,8 +112,8 @@ private:
             }
         };
 
-    //Used for calculation of the average frame rate during preview
-    status_t recalculateFPS();
+    //Feeds the preview frame rate statistics
+    status_t recalculateFPS(nsecs_t timestamp);
 
     char * GetFrame(int &index);
 
@@ -133,12 +133,6 @@ private:
     Mutex mLock;
 
     int mFrameCount;
-    int mLastFrameCount;
-    unsigned int mIter;
-    nsecs_t mLastFPSTime;
-
-    //variables holding the estimated framerate
-    float mFPS, mLastFPS;
 
     int mSensorIndex;
 